@@ -8,7 +8,9 @@
 #include "fcntl.h"
 #include "string.h"
 #include "fuse.h"
+#include "fuse_lowlevel.h"
 #include <stddef.h>
+#include <pthread.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
@@ -20,12 +22,31 @@ typedef int boolean;
 *******************************************************************************/
 #define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
 #define NEWFS_DBG(fmt, ...) do { printf("NEWFS_DBG: " fmt, ##__VA_ARGS__); } while(0)
+/* FUSE 操作入口持命名空间读锁，函数返回时自动释放 */
+#define NEWFS_OP_LOCK() \
+	int __newfs_op_lock __attribute__((cleanup(newfs_op_unlock), unused)) = newfs_op_lock()
+/* 会释放 dentry 的操作持命名空间写锁 */
+#define NEWFS_OP_LOCK_EXCL() \
+	int __newfs_op_lock __attribute__((cleanup(newfs_op_unlock), unused)) = newfs_op_lock_excl()
 
 /******************************************************************************
 * SECTION: 全局变量
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--backend=%s", backend),
+	OPTION("--cache-mb=%d", cache_mb),
+	OPTION("--queue-depth=%d", queue_depth),
+	OPTION("--dirty-mb=%d", dirty_mb),
+	OPTION("--dirty-expire-ms=%d", dirty_expire_ms),
+	OPTION("--max-inodes=%d", max_inodes),
+	OPTION("--lowlevel", lowlevel),
+	OPTION("--entry-timeout-ms=%d", entry_timeout_ms),
+	OPTION("--attr-timeout-ms=%d", attr_timeout_ms),
+	OPTION("--readahead-kb=%d", readahead_kb),
+#ifdef NEWFS_FAULT_INJECT
+	OPTION("--fail-commits=%d", fail_commits),
+#endif
 	FUSE_OPT_END
 };
 struct newfs_super super; 
@@ -39,19 +60,240 @@ void newfs_dump_map();
 /******************************************************************************
 * SECTION: newfs_utils.c
 *******************************************************************************/
-int newfs_driver_read(int offset, char *out_content, int size);
-int newfs_driver_write(int offset, char *in_content, int size);
+boolean newfs_blk_sz_valid(int blk_sz);
+int newfs_dev_read(int64_t offset, char *out_content, int size);
+int newfs_dev_write(int64_t offset, char *in_content, int size);
+int newfs_dev_submit(struct newfs_io_req* reqs, int cnt);
+int newfs_dev_pread(int64_t offset, char *out_content, int size);
+int newfs_driver_read(int64_t offset, char *out_content, int size);
+int newfs_driver_write(int64_t offset, char *in_content, int size);
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry* dentry);
-int newfs_syn_inode(struct newfs_inode* inode);
+void newfs_mark_dirty(struct newfs_inode* inode, int flags);
+void newfs_dirty_add(struct newfs_inode* inode, int bytes);
+void newfs_clean_inode(struct newfs_inode* inode);
+long newfs_dirty_oldest();
+int newfs_sync_data(struct newfs_inode* inode);
+int newfs_sync_inode(struct newfs_inode* inode);
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void newfs_drop_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void newfs_free_inode(struct newfs_inode* inode);
+int newfs_create(struct newfs_dentry* parent, const char* fname, FILE_TYPE ftype,
+				 struct newfs_dentry** created);
+int newfs_remove_dentry(struct newfs_dentry* dentry);
+void newfs_orphan_hold(struct newfs_inode* inode);
+void newfs_orphan_put(struct newfs_inode* inode, int refs, uint64_t nlookup);
+void newfs_fill_stat(struct newfs_dentry* dentry, boolean is_root, struct stat* newfs_stat);
+void newfs_fill_stat_orphan(struct newfs_inode* inode, struct stat* newfs_stat);
 struct newfs_inode* newfs_read_inode(struct newfs_dentry* dentry, int ino);
+int newfs_write_super();
 int newfs_mount(struct custom_options olptions);
+int newfs_writeback();
+boolean newfs_retry_nospace(int ret);
+int newfs_sync_fs();
 int newfs_umount();
 char* newfs_get_fname(const char* path);
 struct newfs_dentry* new_dentry(char *fname, FILE_TYPE ftype);
+struct newfs_inode* newfs_lookup_load(struct newfs_dentry* dentry);
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root);
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir);
 
+/******************************************************************************
+* SECTION: newfs_data.c
+*******************************************************************************/
+int newfs_data_read(struct newfs_inode* inode, char* buf, size_t size, off_t off);
+int newfs_data_read_buf(struct newfs_inode* inode, struct fuse_bufvec** bufp,
+						size_t size, off_t off, struct newfs_fh* fh);
+void newfs_data_unpin();
+unsigned long newfs_data_pin_gen();
+unsigned long newfs_data_pin_oldest();
+void newfs_data_buf_free(struct fuse_bufvec* bufv);
+int newfs_data_write_buf(struct newfs_inode* inode, struct fuse_bufvec* src, off_t off);
+int newfs_data_truncate(struct newfs_inode* inode, off_t size);
+int newfs_data_fallocate(struct newfs_inode* inode, int mode, off_t off, off_t len);
+int newfs_data_sync(struct newfs_inode* inode);
+void newfs_data_conn_init(struct fuse_conn_info* conn);
+struct newfs_fh* newfs_fh_open(struct newfs_inode* inode);
+void newfs_fh_close(struct newfs_fh* fh);
+void newfs_data_prefetch(struct newfs_inode* inode, int lblk, int cnt);
+
+/******************************************************************************
+* SECTION: newfs_dir.c
+*******************************************************************************/
+unsigned int newfs_name_hash(const char* name, int len);
+int newfs_dir_index_init(struct newfs_inode* inode, int cnt);
+int newfs_dir_index_insert(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void newfs_dir_index_remove(struct newfs_inode* inode, struct newfs_dentry* dentry);
+struct newfs_dentry* newfs_dir_find(struct newfs_inode* inode, const char* name, int len);
+struct newfs_dir_cursor* newfs_dir_open(struct newfs_inode* inode);
+void newfs_dir_seek(struct newfs_dir_cursor* cursor, long off);
+void newfs_dir_close(struct newfs_dir_cursor* cursor);
+
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find, boolean* is_root);
+void newfs_dcache_insert(const char* path, struct newfs_dentry* dentry,
+						 boolean is_find, boolean is_root);
+void newfs_dcache_remove(const char* path);
+void newfs_dcache_drop(struct newfs_dentry* dentry);
+void newfs_dcache_invalidate();
+void newfs_dcache_clear();
+
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+int newfs_bitmap_count_free(const char* map, int nbits);
+int newfs_bitmap_find(const char* map, int nbits, int hint);
+int newfs_bitmap_find_run(const char* map, int nbits, int hint, int want);
+int newfs_bitmap_alloc(char* map, int nbits, int* hint);
+void newfs_bitmap_set(char* map, int bit);
+void newfs_bitmap_clear(char* map, int bit);
+boolean newfs_bitmap_test(const char* map, int bit);
+void newfs_alloc_init();
+int newfs_alloc_ino();
+void newfs_free_ino(int ino);
+int newfs_alloc_data_blk();
+int newfs_alloc_data_run(int goal, int want, boolean resv, int* got);
+int newfs_reserve_data_blks(int cnt);
+void newfs_unreserve_data_blks(int cnt);
+void newfs_free_data_blk(int blk);
+void newfs_free_defer_begin();
+void newfs_free_defer_hold();
+void newfs_free_defer_end(boolean committed);
+int newfs_map_txn_bytes();
+boolean newfs_space_pending();
+void newfs_map_dirty(char* map, int bit, int cnt);
+void newfs_map_redirty(int ino_lo, int ino_hi, int data_lo, int data_hi);
+void newfs_map_clean();
+
+/******************************************************************************
+* SECTION: newfs_extent.c
+*******************************************************************************/
+int newfs_bmap(struct newfs_inode* inode, int lblk);
+int newfs_bmap_len(struct newfs_inode* inode, int lblk, int* len, boolean* unwritten);
+int newfs_inode_extend(struct newfs_inode* inode, int cnt);
+int newfs_inode_reserve(struct newfs_inode* inode, int lblk, int cnt);
+void newfs_inode_unreserve(struct newfs_inode* inode, int cnt);
+int newfs_inode_prealloc(struct newfs_inode* inode, int lblk, int cnt);
+int newfs_inode_map_delayed(struct newfs_inode* inode);
+int newfs_inode_convert(struct newfs_inode* inode, int lblk, int cnt);
+int newfs_inode_punch(struct newfs_inode* inode, int lblk, int cnt);
+void newfs_inode_shrink(struct newfs_inode* inode, int nblks);
+int newfs_extent_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+int newfs_extent_store(struct newfs_inode* inode, struct newfs_inode_d* inode_d);
+void newfs_inode_free_blks(struct newfs_inode* inode);
+int newfs_inode_relocate(struct newfs_inode* inode);
+
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int newfs_journal_init(boolean is_format);
+int newfs_journal_replay();
+void newfs_journal_begin();
+void newfs_journal_abort();
+void newfs_journal_mark();
+void newfs_journal_rollback();
+boolean newfs_journal_fits(int extra);
+void newfs_journal_direct(boolean on);
+int newfs_meta_write(int64_t offset, char* in_content, int size);
+int newfs_journal_commit();
+int newfs_journal_checkpoint();
+void newfs_journal_destroy();
+
+/******************************************************************************
+* SECTION: newfs_driver.c
+*******************************************************************************/
+const struct newfs_driver_ops* newfs_driver_find(const char* name);
+
+/******************************************************************************
+* SECTION: newfs_uring.c
+*******************************************************************************/
+int newfs_uring_open(const char* path);
+int newfs_uring_close();
+int newfs_uring_submit(struct newfs_io_req* reqs, int cnt);
+
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int newfs_cache_init(int cache_blks);
+boolean newfs_cache_enabled();
+int newfs_cache_read(int64_t offset, char *out_content, int size);
+int newfs_cache_write(int64_t offset, char *in_content, int size);
+int newfs_cache_flush();
+int newfs_cache_dirty_blks();
+int newfs_cache_prefetch(int* blk_nos, int cnt);
+int newfs_cache_prefetch_range(int blk_no, int cnt);
+void newfs_cache_invalidate(int blk_no, int cnt);
+int newfs_cache_destroy();
+
+/******************************************************************************
+* SECTION: newfs_icache.c
+*******************************************************************************/
+void newfs_icache_add(struct newfs_inode* inode);
+void newfs_icache_del(struct newfs_inode* inode);
+void newfs_icache_touch(struct newfs_inode* inode);
+void newfs_inode_hold(struct newfs_inode* inode);
+void newfs_inode_put(struct newfs_inode* inode);
+void newfs_icache_shrink();
+void newfs_icache_reclaim(boolean wait);
+int newfs_icache_count();
+void newfs_icache_clear();
+
+/******************************************************************************
+* SECTION: newfs_mem.c
+*******************************************************************************/
+struct newfs_inode* newfs_inode_new();
+void newfs_inode_release(struct newfs_inode* inode);
+struct newfs_dentry* newfs_dentry_new();
+void newfs_dentry_release(struct newfs_dentry* dentry);
+char* newfs_name_dup(const char* name);
+void newfs_name_release(char* name);
+void newfs_mem_stat(struct newfs_mem_stats* stats);
+void newfs_mem_dump();
+void newfs_mem_destroy();
+
+/******************************************************************************
+* SECTION: newfs_mkfs.c
+*******************************************************************************/
+int newfs_mkfs(struct newfs_mkfs_options* opts);
+
+/******************************************************************************
+* SECTION: newfs_flusher.c
+*******************************************************************************/
+long newfs_now_ms();
+int newfs_flusher_start();
+void newfs_flusher_stop();
+void newfs_flusher_kick();
+
+/******************************************************************************
+* SECTION: newfs_readahead.c
+*******************************************************************************/
+int newfs_ra_start();
+void newfs_ra_stop();
+void newfs_ra_read(struct newfs_fh* fh, off_t off, size_t size);
+
+/******************************************************************************
+* SECTION: newfs_lock.c
+*******************************************************************************/
+int newfs_op_lock();
+int newfs_op_lock_excl();
+void newfs_op_unlock(int* unused);
+void newfs_ns_rdlock();
+void newfs_ns_wrlock();
+boolean newfs_ns_trywrlock();
+void newfs_ns_unlock();
+void newfs_wb_lock();
+boolean newfs_wb_trylock();
+void newfs_wb_unlock();
+void newfs_inode_rdlock(struct newfs_inode* inode);
+void newfs_inode_wrlock(struct newfs_inode* inode);
+void newfs_inode_unlock(struct newfs_inode* inode);
+
+/******************************************************************************
+* SECTION: newfs_ll.c
+*******************************************************************************/
+int newfs_ll_main(struct fuse_args* args);
+
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
@@ -66,14 +308,27 @@ int   			   newfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   newfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
+int   			   newfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					                      struct fuse_file_info *);
+int   			   newfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t,
+					                     struct fuse_file_info *);
 int   			   newfs_access(const char *, int);
 int   			   newfs_unlink(const char *);
 int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   newfs_truncate(const char *, off_t);
+int   			   newfs_ftruncate(const char *, off_t, struct fuse_file_info *);
+int   			   newfs_fallocate(const char *, int, off_t, off_t, struct fuse_file_info *);
+int   			   newfs_fgetattr(const char *, struct stat *, struct fuse_file_info *);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
+int   			   newfs_create_open(const char *, mode_t, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
+int   			   newfs_flush(const char *, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   newfs_fsyncdir(const char *, int, struct fuse_file_info *);
 
 #endif  /* _newfs_H_ */
\ No newline at end of file
@@ -9,7 +9,7 @@
 #define TRUE            1
 #define UINT8_BITS      8
 
-#define NEWFS_MAGIC           	0x12345678  /* TODO: Define by yourself */
+#define NEWFS_MAGIC           	0x1234567A  /* 增加元数据日志区后的格式 */
 #define NEWFS_SUPER_OFS			0
 #define NEWFS_ROOT_INO  		2
 #define NEWFS_DEFAULT_PERM    	0777   		/* 全权限打开 */
@@ -17,16 +17,41 @@
 #define ROUND_DOWN(value, round) ((value) / (round) * (round))
 #define ROUND_UP(value, round) (((value) + (round) - 1) / (round) * (round))
 
-#define NEWFS_DATA_PER_FILE 6
-#define NEWFS_FILE_NUM 500
+#define NEWFS_INODE_RATIO 16384         /* mkfs 默认每多少字节设备空间分配一个 inode */
 #define NEWFS_IO_SZ 512
-#define NEWFS_BLK_SZ (NEWFS_IO_SZ << 1)
-#define NEWFS_NODE_PER_FILE 1
-
-#define NEWFS_BLKS_SZ(num) ((num) * NEWFS_BLK_SZ)
-#define NEWFS_DRIVER (super.fd)
-#define NEWFS_INO_OFS(ino) (super.inode_offset + (ino) * sizeof(struct newfs_inode_d))
-#define NEWFS_DATA_OFS(ino) (super.data_offset + (ino) * NEWFS_BLK_SZ)
+#define NEWFS_DEFAULT_BLK_SZ  (NEWFS_IO_SZ << 1)
+#define NEWFS_MAX_BLK_SZ      65536
+#define NEWFS_BLK_SZ          (super.blk_sz)    /* 块大小记录在超级块中，挂载后确定 */
+
+#define NEWFS_BLK_NONE        (-1)
+#define NEWFS_MAX_BLKS        (1 << 30) /* 文件系统最多块数，块号与位图下标保持在 int 范围内 */
+#define NEWFS_INLINE_EXTENTS  4         /* inode_d 内联 extent 个数 */
+#define NEWFS_EXTENT_PER_BLK  ((int)((NEWFS_BLK_SZ - sizeof(struct newfs_ext_hdr_d)) / sizeof(struct newfs_extent)))  /* 每个溢出块的 extent 个数 */
+#define NEWFS_EXT_BLKS(cnt)   ((cnt) <= NEWFS_INLINE_EXTENTS ? 0 : ((cnt) - NEWFS_INLINE_EXTENTS + NEWFS_EXTENT_PER_BLK - 1) / NEWFS_EXTENT_PER_BLK)  /* cnt 个 extent 需要的溢出块数 */
+#define NEWFS_DENTRY_PER_BLK  (NEWFS_BLK_SZ / sizeof(struct newfs_dentry_d))
+#define NEWFS_DIR_BATCH_BLKS  16        /* 目录加载/回写时一次读写的最大块数 */
+#define NEWFS_DATA_BATCH_BLKS 256       /* 文件数据一次直接读写的最大块数 */
+#define NEWFS_DELALLOC_SZ     (64 * 1024) /* 一次写入的空洞不少于此字节数时立即分配，否则延迟到回写时分配 */
+#define NEWFS_RA_MIN_BLKS     4         /* 识别出顺序读后的最小预读窗口（块） */
+#define NEWFS_RA_QUEUE        64        /* 排队的预读请求上限，队列满时新的请求丢弃 */
+#define NEWFS_DIRTY_INODE     0x1       /* inode_d（大小、extent 等）需回写 */
+#define NEWFS_DIRTY_DENTRY    0x2       /* 目录项块需回写 */
+#define NEWFS_DIRTY_DATA      0x4       /* 文件数据块需回写 */
+#define NEWFS_JOURNAL_MIN_SZ  (64 * 1024)           /* 日志区默认大小下限，按设备的 1/256 计算 */
+#define NEWFS_JOURNAL_MAX_SZ  (16 * 1024 * 1024)    /* 日志区默认大小上限 */
+#define NEWFS_JOURNAL_MIN_BLKS 4        /* 日志区最小块数，首块为日志头 */
+#define NEWFS_JOURNAL_MAGIC   0x4a4e4c31
+#define NEWFS_STATE_CLEAN     0x1       /* 正常卸载，挂载时无需重放日志 */
+#define NEWFS_STATE_DIRTY     0x0
+#define NEWFS_FEATURE_64BIT   0x1       /* 偏移与大小为 64 位 */
+#define NEWFS_FEATURE_UNWRITTEN 0x2     /* extent 带未写入标记 */
+#define NEWFS_FEATURE_EXT_CHAIN 0x4     /* extent 溢出块带块头、串成链表 */
+#define NEWFS_FEATURES        (NEWFS_FEATURE_64BIT | NEWFS_FEATURE_UNWRITTEN | NEWFS_FEATURE_EXT_CHAIN)     /* 本版本支持的特性，超级块中出现其他位则拒绝挂载 */
+
+#define NEWFS_BLKS_SZ(num) ((int64_t)(num) * NEWFS_BLK_SZ)
+#define NEWFS_DRIVER (super.driver)
+#define NEWFS_INO_OFS(ino) (super.inode_offset + (int64_t)(ino) * (int64_t)sizeof(struct newfs_inode_d))
+#define NEWFS_DATA_OFS(ino) (super.data_offset + (int64_t)(ino) * NEWFS_BLK_SZ)
 
 #define NEWFS_ERROR_NONE          0
 #define NEWFS_ERROR_ACCESS        EACCES
@@ -38,6 +63,10 @@
 #define NEWFS_ERROR_UNSUPPORTED   ENXIO
 #define NEWFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NEWFS_ERROR_NOTEMPTY      ENOTEMPTY
+#define NEWFS_ERROR_FBIG          EFBIG
+#define NEWFS_ERROR_NOTSUP        EOPNOTSUPP
+#define NEWFS_ERROR_NAMETOOLONG   ENAMETOOLONG
 
 typedef enum {
     NEWFS_DIR, NEWFS_FILE
@@ -45,8 +74,30 @@ typedef enum {
 
 typedef int boolean;
 
+/**
+ * @brief mkfs.newfs 参数
+ */
+struct newfs_mkfs_options {
+	int          inode_ratio;       // 每多少字节设备空间分配一个 inode
+	int          blk_sz;            // 块大小，NEWFS_DEFAULT_BLK_SZ 到 NEWFS_MAX_BLK_SZ 之间的 2 的幂
+	int          journal_blks;      // 日志区块数，0 表示按设备大小计算
+};
+
 struct custom_options {
 	char*        device;
+	char*        backend;           // 存储后端：ddriver | file | mmap | uring
+	int          queue_depth;       // io_uring 队列深度
+	int          cache_mb;          // 块缓存大小（MB），0 表示不缓存
+	int          dirty_mb;          // 脏数据高水位（MB），超过即唤醒回写线程
+	int          dirty_expire_ms;   // 修改最长驻留时间（ms），<= 0 表示不启动回写线程
+	int          max_inodes;        // 内存中最多缓存的 inode 数，<= 0 表示不限制
+	int          lowlevel;          // 使用 FUSE 低层（inode 号）接口
+	int          entry_timeout_ms;  // 低层接口：内核缓存目录项（含不存在的项）的时间
+	int          attr_timeout_ms;   // 低层接口：内核缓存属性的时间
+	int          readahead_kb;      // 顺序读预读窗口上限（KB），<= 0 表示不预读
+#ifdef NEWFS_FAULT_INJECT
+	int          fail_commits;      // 测试用：之后的前 N 次日志提交返回 EIO
+#endif
 };
 
 
@@ -54,6 +105,17 @@ struct custom_options {
 * SECTION: 内存存储结构
 *******************************************************************************/
 
+/**
+ * @brief 一段连续映射：逻辑块 [lblk, lblk + len) -> 数据块 [pblk, pblk + len)
+ * 内存与磁盘格式相同；unwritten 的块已预分配但从未写过，读为零
+ */
+struct newfs_extent {
+    int          lblk;              // 逻辑起始块
+    int          pblk;              // 数据区起始块号
+    unsigned int len       : 31;    // 块数
+    unsigned int unwritten : 1;     // 未写入
+};
+
 struct newfs_dentry;
 struct newfs_inode;
 struct newfs_super;
@@ -65,16 +127,43 @@ struct newfs_super;
  */
 struct newfs_inode {
     int         ino;                // 在 inode 位图中的下标
-    int         size;               // 文件已占用空间
+    int64_t     size;               // 文件已占用空间
     int         link;               // 链接数，选做需要用到
     int         blks;               // 占用数据块个数
+    FILE_TYPE   ftype;              // 文件类型，从目录树摘除后仍可用
     int                     dir_cnt;
 
     struct newfs_dentry*    dentry;     // 指向该 inode 的dentry
     struct newfs_dentry*    dentrys;    // 所有目录项
 
-    char*                block_pointer[NEWFS_DATA_PER_FILE]; // 数据块指针
-    int                     block_pos[NEWFS_DATA_PER_FILE];     // 数据块号
+    struct newfs_extent*    extents;    // 按 lblk 升序的块映射
+    int                     ext_cnt;
+    int                     ext_cap;
+    int*                    ext_blks;   // extent 溢出块链，按链表顺序
+    int                     ext_nblks;  // 溢出块数
+    int                     ext_resv;   // 为溢出块预留的块数，回写时从中分配
+    int                     dl_blks;    // 延迟分配的块数，回写后每块至多新增一个 extent
+
+    char**                  block_pointer;  // 文件数据块缓存，按逻辑块号索引
+    int                     blk_cap;        // block_pointer 容量
+
+    struct newfs_dentry**   dhash;      // 目录项哈希索引
+    int                     dhash_sz;   // 哈希桶数，2 的幂
+    struct newfs_dir_cursor* cursors;   // 该目录上打开的 readdir 游标
+
+    int                     dirty;      // NEWFS_DIRTY_* 标志，0 表示干净
+    int                     dirty_bytes;    // 计入 super.dirty_bytes 的估算值
+    struct newfs_inode*     dirty_prev; // 脏 inode 链表
+    struct newfs_inode*     dirty_next;
+
+    int                     refcnt;     // 打开的句柄数，非 0 时不淘汰，被删除时推迟释放数据块
+    uint64_t                nlookup;    // 低层接口下内核持有的 lookup 计数，非 0 时不淘汰也不释放
+    int                     cached_cnt; // 已加载 inode 的子目录项数，非 0 时不淘汰
+    int                     referenced; // 上次淘汰扫描后被访问过
+    struct newfs_inode*     lru_prev;   // inode 缓存 LRU 链表，根目录不在链上
+    struct newfs_inode*     lru_next;
+
+    pthread_rwlock_t        lock;       // 保护目录项、块映射与子 dentry 的懒加载
 };
 
 /**
@@ -82,13 +171,149 @@ struct newfs_inode {
  * 存储目录项自身信息、指向的节点号、节点内容、父亲目录项、兄弟目录项
  */
 struct newfs_dentry {
-    char        fname[MAX_NAME_LEN];// 指向 ino 文件名
+    char*       fname;              // 指向 ino 文件名，存放在名字区中
     FILE_TYPE   ftype;              // 指向 ino 文件类型
     int         ino;                // 指向的 ino 号
 
     struct newfs_inode*     inode;  // 指向 inode
     struct newfs_dentry*    parent;
     struct newfs_dentry*    brother;
+
+    unsigned int            hash;       // 文件名哈希
+    struct newfs_dentry*    hash_next;  // 父目录哈希索引中的下一项
+};
+
+#define NEWFS_IO_READ   0
+#define NEWFS_IO_WRITE  1
+
+/**
+ * @brief 批量 IO 请求，offset 与 size 按 NEWFS_IO_SZ 对齐
+ */
+struct newfs_io_req {
+    int         op;                 // NEWFS_IO_READ / NEWFS_IO_WRITE
+    int64_t     offset;
+    char*       buf;
+    int         size;
+};
+
+/**
+ * @brief 存储后端
+ * read/write 的 offset 与 size 均按 NEWFS_IO_SZ 对齐
+ * submit 可为空，为空时批量请求逐个调用 read/write
+ * fd_io 为 TRUE 时文件数据块直接按偏移读写 super.fd，不经过 read/write
+ */
+struct newfs_driver_ops {
+    const char* name;
+    int         (*open)(const char* path);
+    int         (*close)();
+    int         (*geometry)(int64_t* sz_disk, int* sz_io);
+    int         (*read)(int64_t offset, char* out_content, int size);
+    int         (*write)(int64_t offset, char* in_content, int size);
+    int         (*sync)();
+    int         (*submit)(struct newfs_io_req* reqs, int cnt);
+    boolean     fd_io;              // super.fd 可按设备偏移读写，文件数据可经 splice 收发
+};
+
+/**
+ * @brief 缓存块
+ * 以设备块号为键，同时挂在哈希链和 LRU 链上
+ */
+struct newfs_buf {
+    int         blk_no;             // 设备块号
+    boolean     dirty;              // 是否需要回写
+    char*       data;               // NEWFS_BLK_SZ 大小的块内容
+
+    struct newfs_buf*       hash_next;
+    struct newfs_buf*       lru_prev;
+    struct newfs_buf*       lru_next;
+};
+
+/**
+ * @brief 块缓存
+ */
+struct newfs_cache {
+    int         capacity;           // 最多缓存块数
+    int         nbufs;              // 已分配缓存块数
+    int         dirty_cnt;          // 脏块数
+
+    int         hash_sz;            // 哈希桶数，2 的幂
+    struct newfs_buf**      htab;
+    struct newfs_buf        lru;        // 哨兵，lru_next 为最近使用
+    struct newfs_buf**      flush_vec;  // 回写时排序用
+
+    long        hits;
+    long        misses;
+};
+
+/**
+ * @brief readdir 游标，opendir 时创建并存放在 fi->fh 中
+ * 目录项被删除时由 newfs_drop_dentry 推进，保证 next 始终有效
+ */
+struct newfs_dir_cursor {
+    struct newfs_inode*     inode;      // 所在目录，目录被删除后置为 NULL
+    struct newfs_dentry*    next;       // 下一个要输出的目录项
+    long                    off;        // next 对应的偏移
+    struct newfs_dir_cursor* cursor_next;
+};
+
+/**
+ * @brief 打开的文件，open / create 时创建并存放在 fi->fh 中，持有 inode 直到 release
+ * 每个句柄单独识别顺序读，预读窗口在顺序命中时翻倍，随机访问时清零
+ */
+struct newfs_fh {
+    struct newfs_inode*     inode;      // 打开的文件，被删除后仍有效
+
+    pthread_mutex_t         ra_lock;    // 保护预读状态，同一句柄上的读可能并发
+    int64_t                 ra_pos;     // 上次读取的结束位置，从这里继续读即为顺序读
+    int                     ra_win;     // 预读窗口（块），0 表示未识别出顺序读
+    int                     ra_next;    // 已发起预读的下一个逻辑块
+};
+
+/**
+ * @brief 预读请求，由预读线程异步执行，持有 inode 直到执行完
+ */
+struct newfs_ra_req {
+    struct newfs_inode*     inode;
+    int                     lblk;       // 起始逻辑块
+    int                     cnt;        // 块数
+};
+
+/**
+ * @brief 元数据日志
+ * 一次回写中的所有元数据修改组成一个事务，先顺序写入日志区并落盘，再写回原位置
+ */
+struct newfs_journal {
+    char*       buf;                // 当前事务：newfs_txn_d 后接若干记录
+    int         len;                // 当前事务已用字节数
+    int         cap;
+    int         nrec;               // 当前事务记录数
+    int         mark_len;           // newfs_journal_mark 记下的位置
+    int         mark_nrec;
+    boolean     is_active;          // 是否处于事务中
+    boolean     direct;             // 数据区的元数据写不记入事务（见 newfs_journal_direct）
+    int         head;               // 下一个事务在日志区内的偏移
+    uint32_t    seq;                // 下一个事务的序号
+};
+
+/**
+ * @brief 写入当前事务的 inode 与写入前的脏标志，事务中止时据此重新标记为脏
+ */
+struct newfs_wb_inode {
+    struct newfs_inode* inode;
+    int                 dirty;
+};
+
+/**
+ * @brief 内存池统计，*_bytes 为向系统申请的整块大小
+ */
+struct newfs_mem_stats {
+    long        inodes;             // 使用中的 inode 数
+    long        dentries;           // 使用中的 dentry 数
+    long        names;              // 使用中的文件名数
+    long        name_bytes;         // 文件名实际字节数
+    long        inode_bytes;
+    long        dentry_bytes;
+    long        arena_bytes;
 };
 
 /**
@@ -96,24 +321,46 @@ struct newfs_dentry {
  */
 struct newfs_super {
     int         fd;                 // 挂载的设备
+    const struct newfs_driver_ops* driver;  // 存储后端
 
     int         sz_io;
-    int         sz_disk;
-    int         sz_usage;
+    int64_t     sz_disk;
+    int64_t     sz_usage;
+    int         blk_sz;             // 块大小
 
     int         max_ino;            // 最多节点数
     int         max_data_blks;      // 最多数据块数
 
     char*    map_inode;          // 指向内存中 inode 位图地址
     int         map_inode_blks;     // inode 位图占用块数
-    int         map_inode_offset;   // inode 位图在磁盘中的偏移量
+    int64_t     map_inode_offset;   // inode 位图在磁盘中的偏移量
 
     char*    map_data;           // 指向内存中 data 位图地址
     int         map_data_blks;      // data 位图占用块数
-    int         map_data_offset;    // data 位图在磁盘中的偏移量
-
-    int         inode_offset;       // 索引节点起始地址
-    int         data_offset;        // 数据块起始地址
+    int64_t     map_data_offset;    // data 位图在磁盘中的偏移量
+
+    int64_t     inode_offset;       // 索引节点起始地址
+    int         inode_blks;         // inode 表占用块数
+    int64_t     data_offset;        // 数据块起始地址
+
+    int         free_inodes;        // 空闲 inode 数
+    int         free_data_blks;     // 空闲数据块数
+    int         resv_data_blks;     // 延迟分配预留的数据块数，位图中仍空闲
+    int         ino_hint;           // inode 位图 next-fit 游标
+    int         data_hint;          // data 位图 next-fit 游标
+
+    struct newfs_inode*  dirty_inodes;    // 待回写的 inode 链表
+    long        dirty_bytes;        // 脏 inode 待回写字节数估算
+    long        dirty_since;        // 脏链表由空变非空的时间（ms）
+    int         map_inode_dlo;      // inode 位图待回写的字节范围 [dlo, dhi]，dlo > dhi 表示干净
+    int         map_inode_dhi;
+    int         map_data_dlo;       // data 位图待回写的字节范围
+    int         map_data_dhi;
+
+    int64_t     journal_offset;     // 日志区在磁盘中的偏移量
+    int         journal_blks;       // 日志区块数
+    struct newfs_journal journal;   // 日志运行状态
+    int         state;              // 挂载期间为 NEWFS_STATE_DIRTY
 
     struct newfs_dentry* root_dentry;     // 根目录 dentry
     boolean        is_mounted;
@@ -126,12 +373,20 @@ struct newfs_super {
 
 struct newfs_inode_d {
     int         ino;                // 在 inode 位图中的下标
-    int         size;               // 文件已占用空间
     int         link;               // 链接数
+    int64_t     size;               // 文件已占用空间
     int         dir_cnt;
     FILE_TYPE   ftype;
     int         blks;               // 占用数据块个数
-    int         block_pos[NEWFS_DATA_PER_FILE];     // 数据块号
+    int         ext_cnt;            // extent 总数
+    int         ext_blk;            // 超出内联个数的 extent 存放的第一个溢出块号
+    struct newfs_extent extents[NEWFS_INLINE_EXTENTS];  // 内联 extent
+};
+
+/** @brief extent 溢出块头部，其后紧跟本块的 extent */
+struct newfs_ext_hdr_d {
+    int         next;               // 链表中下一个溢出块号，NEWFS_BLK_NONE 表示链尾
+    int         cnt;                // 本块中的 extent 个数
 };
 
 struct newfs_dentry_d {
@@ -142,20 +397,55 @@ struct newfs_dentry_d {
 
 struct newfs_super_d {
     uint32_t    magic_num;          // 幻数
-    int         sz_usage;
+    uint32_t    features;           // NEWFS_FEATURE_* 位
+    int64_t     sz_usage;
 
     int         max_ino;            // 最多节点数
     int         max_data_blks;      // 最多数据块数
 
     int         map_inode_blks;     // inode 位图占用块数
-    int         map_inode_offset;   // inode 位图在磁盘中的偏移量
-
     int         map_data_blks;      // data 位图占用块数
-    int         map_data_offset;    // data 位图在磁盘中的偏移量
+    int64_t     map_inode_offset;   // inode 位图在磁盘中的偏移量
+    int64_t     map_data_offset;    // data 位图在磁盘中的偏移量
+
+    int64_t     inode_offset;       // 索引节点起始地址
+    int64_t     data_offset;        // 数据块起始地址
 
-    int         inode_offset;       // 索引节点起始地址
-    int         data_offset;        // 数据块起始地址
+    int64_t     journal_offset;     // 日志区在磁盘中的偏移量
+    int         journal_blks;       // 日志区块数
+    int         state;              // NEWFS_STATE_CLEAN 表示正常卸载
 
+    int64_t     sz_disk;            // 格式化时的文件系统大小
+    int         blk_sz;             // 块大小
+    int         inode_blks;         // inode 表占用块数
+};
+
+/**
+ * @brief 日志区首块，记录第一个有效事务的位置与序号，检查点后更新
+ */
+struct newfs_journal_hdr_d {
+    uint32_t    magic;
+    uint32_t    seq;                // 第一个有效事务的序号
+    int         head;               // 第一个有效事务在日志区内的偏移
+};
+
+/**
+ * @brief 事务头，整个事务按块对齐一次写入，校验和覆盖全部记录，校验通过即视为已提交
+ */
+struct newfs_txn_d {
+    uint32_t    magic;
+    uint32_t    seq;
+    int         nrec;               // 记录数
+    int         len;                // 事务总长度（含事务头，按块对齐）
+    uint32_t    csum;               // 记录区 CRC32
+};
+
+/**
+ * @brief 日志记录：将 len 字节写到设备 offset 处，数据紧随其后并按 4 字节对齐
+ */
+struct newfs_jrec_d {
+    int64_t     offset;
+    int         len;
 };
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -10,17 +10,30 @@ static struct fuse_operations operations = {
 	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
 	.readdir = newfs_readdir,				 /* 填充dentrys */
 	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
+	.write = newfs_write,					 /* 写入文件 */
+	.read = newfs_read,						 /* 读文件 */
+	.write_buf = newfs_write_buf,			 /* 写入文件，整块经 splice 直接写设备 */
+	.read_buf = newfs_read_buf,				 /* 读文件，整块经 splice 直接从设备读 */
 	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
-	.unlink = NULL,							  		 /* 删除文件 */
-	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
+	.truncate = newfs_truncate,				 /* 改变文件大小 */
+	.ftruncate = newfs_ftruncate,			 /* 改变打开文件的大小 */
+	.fallocate = newfs_fallocate,			 /* 预分配空间或打洞 */
+	.fgetattr = newfs_fgetattr,				 /* 获取打开文件的属性 */
+	.unlink = newfs_unlink,					 /* 删除文件 */
+	.rmdir	= newfs_rmdir,					 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
-	.open = NULL,							
-	.opendir = NULL,
-	.access = NULL
+	.open = newfs_open,						 /* 打开文件，句柄存入 fi->fh */
+	.create = newfs_create_open,			 /* 创建并打开文件 */
+	.release = newfs_release,				 /* 关闭文件 */
+	.opendir = newfs_opendir,
+	.releasedir = newfs_releasedir,
+	.flush = newfs_flush,					 /* close 时不回写 */
+	.fsync = newfs_fsync,					 /* 回写并刷到设备 */
+	.fsyncdir = newfs_fsyncdir,
+	.access = NULL,
+	.flag_nullpath_ok = 1,					 /* 带 fi 的操作经句柄取 inode，不需要路径 */
+	.flag_nopath = 1
 };
 
 /******************************************************************************
@@ -31,7 +44,7 @@ static struct fuse_operations operations = {
  * 完成超级块的读取、位图的建立、驱动的初始化
  * 
  * Layout
- * | Super | Inode Map | Data Map | Inode | Data |
+ * | Super | Journal | Inode Map | Data Map | Inode | Data |
  * 
  * @param conn_info 可忽略，一些建立连接相关的信息 
  * @return void*
@@ -42,6 +55,13 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	}
+	if (newfs_flusher_start() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] flusher start error\n", __func__);
+	}
+	if (newfs_ra_start() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] readahead start error\n", __func__);
+	}
+	newfs_data_conn_init(conn_info);
 	return NULL;
 }
 
@@ -52,7 +72,8 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
  * @return void
  */
 void newfs_destroy(void* p) {
-	/* TODO: 在这里进行卸载 */
+	newfs_ra_stop();
+	newfs_flusher_stop();
 	if (newfs_umount() != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] unmount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
@@ -62,19 +83,18 @@ void newfs_destroy(void* p) {
 }
 
 /**
- * @brief 创建目录
- * 
- * @param path 相对于挂载点的路径
- * @param mode 创建模式（只读？只写？），可忽略
- * @return int 0成功，否则失败
+ * @brief newfs_mkdir 的一次尝试，持命名空间读锁
  */
-int newfs_mkdir(const char* path, mode_t mode) {
-	(void)mode;
+static int newfs_do_mkdir(const char* path) {
+	NEWFS_OP_LOCK();
 	boolean is_find, is_root;
-	char *fname;
 	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_dentry* dentry;
+	int ret;
 
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find) {
 		return -NEWFS_ERROR_EXISTS;
 	}
@@ -83,13 +103,28 @@ int newfs_mkdir(const char* path, mode_t mode) {
 		return -NEWFS_ERROR_UNSUPPORTED;
 	}
 
-	fname = newfs_get_fname(path);
-	dentry = new_dentry(fname, NEWFS_DIR);
-	dentry->parent = last_dentry;
-	newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	ret = newfs_create(last_dentry, newfs_get_fname(path), NEWFS_DIR, &dentry);
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_dcache_remove(path);
+	}
+	return ret;
+}
 
-	return NEWFS_ERROR_NONE;
+/**
+ * @brief 创建目录
+ * 
+ * @param path 相对于挂载点的路径
+ * @param mode 创建模式（只读？只写？），可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mkdir(const char* path, mode_t mode) {
+	int ret = newfs_do_mkdir(path);
+
+	(void)mode;
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_do_mkdir(path);
+	}
+	return ret;
 }
 
 /**
@@ -100,32 +135,17 @@ int newfs_mkdir(const char* path, mode_t mode) {
  * @return int 0成功，否则失败
  */
 int newfs_getattr(const char* path, struct stat * newfs_stat) {
+	NEWFS_OP_LOCK();
 	boolean is_find, is_root;
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
 
-	if (dentry->ftype == NEWFS_DIR) {
-		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
-	} else if (dentry->ftype == NEWFS_FILE) {
-		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->size;
-	}
-
-	newfs_stat->st_nlink 	= 1;
-	newfs_stat->st_uid 	 	= getuid();
-	newfs_stat->st_gid 	 	= getgid();
-	newfs_stat->st_atime   	= time(NULL);
-	newfs_stat->st_mtime   	= time(NULL);
-	newfs_stat->st_blksize 	= NEWFS_BLK_SZ;
-
-	if (is_root) {
-		newfs_stat->st_size	= super.sz_usage; 
-		newfs_stat->st_blocks = super.sz_disk / NEWFS_BLK_SZ;
-		newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
-	}
+	newfs_fill_stat(dentry, is_root, newfs_stat);
 	return NEWFS_ERROR_NONE;
 }
 
@@ -140,66 +160,97 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  *				const struct stat *stbuf, off_t off)
  * buf: name会被复制到buf中
  * name: dentry名字
- * stbuf: 文件状态，可忽略
+ * stbuf: 文件状态，inode 已加载时顺带返回
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
+ * 从 opendir 建立的游标处继续，一次调用尽量填满 buf，filler 返回非 0 表示 buf 已满
+ * 
  * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param fi fi->fh 为 newfs_dir_cursor
  * @return int 0成功，否则失败
  */
 int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
-    /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
-	boolean is_find, is_root;
-	int		cur_dir = offset;
-
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	NEWFS_OP_LOCK();
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
 	struct newfs_dentry* sub_dentry;
-	struct newfs_inode*  inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+	struct stat			 sub_stat;
+
+	if (cursor == NULL) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (cursor->inode == NULL) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	newfs_inode_rdlock(cursor->inode);
+	newfs_dir_seek(cursor, offset);
+
+	while ((sub_dentry = cursor->next) != NULL) {
+		newfs_fill_stat(sub_dentry, FALSE, &sub_stat);
+		if (filler(buf, sub_dentry->fname, &sub_stat, cursor->off + 1) != 0) {
+			break;
 		}
-		return NEWFS_ERROR_NONE;
+		cursor->next = sub_dentry->brother;
+		cursor->off++;
 	}
-    return -NEWFS_ERROR_NOTFOUND;
+	newfs_inode_unlock(cursor->inode);
+	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 创建文件
+ * @brief 解析路径并创建文件，调用者持命名空间读锁
  * 
  * @param path 相对于挂载点的路径
- * @param mode 创建文件的模式，可忽略
- * @param dev 设备类型，可忽略
+ * @param mode 创建文件的模式，只区分目录与普通文件
+ * @param dentry 返回新建的目录项
  * @return int 0成功，否则失败
  */
-int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
-	/* TODO: 解析路径，并创建相应的文件 */
+static int newfs_mknod_dentry(const char* path, mode_t mode, struct newfs_dentry** dentry) {
 	boolean is_find, is_root;
-
 	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* dentry;
-	char* fname;
+	int ret;
 
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == TRUE) {
 		return -NEWFS_ERROR_EXISTS;
 	}
 
-	fname = newfs_get_fname(path);
-
-	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NEWFS_FILE);
-	} else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NEWFS_DIR);
+	ret = newfs_create(last_dentry, newfs_get_fname(path),
+					   S_ISDIR(mode) ? NEWFS_DIR : NEWFS_FILE, dentry);
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_dcache_remove(path);
 	}
+	return ret;
+}
 
-	dentry->parent = last_dentry;
-	newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+/**
+ * @brief newfs_mknod 的一次尝试，持命名空间读锁
+ */
+static int newfs_do_mknod(const char* path, mode_t mode) {
+	NEWFS_OP_LOCK();
+	struct newfs_dentry* dentry;
 
-	return NEWFS_ERROR_NONE;
+	return newfs_mknod_dentry(path, mode, &dentry);
+}
+
+/**
+ * @brief 创建文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param mode 创建文件的模式，可忽略
+ * @param dev 设备类型，可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
+	int ret = newfs_do_mknod(path, mode);
+
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_do_mknod(path, mode);
+	}
+	return ret;
 }
 
 /**
@@ -216,6 +267,38 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
+/**
+ * @brief 取文件 inode，调用者持命名空间读锁
+ * 已打开时直接取句柄中的 inode（path 可能为 NULL），否则解析路径
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息，可以为 NULL
+ * @param inode 返回的文件 inode
+ * @return int 0成功，否则失败
+ */
+static int newfs_file_inode(const char* path, struct fuse_file_info* fi,
+							struct newfs_inode** inode) {
+	boolean is_find, is_root;
+	struct newfs_dentry* dentry;
+
+	if (fi != NULL && fi->fh != 0) {
+		*inode = ((struct newfs_fh*)(uintptr_t)fi->fh)->inode;
+		return NEWFS_ERROR_NONE;
+	}
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dentry->ftype == NEWFS_DIR) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	*inode = newfs_lookup_load(dentry);
+	return *inode != NULL ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+}
+
 /**
  * @brief 写入文件
  * 
@@ -223,13 +306,15 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  * @param buf 写入的内容
  * @param size 写入的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh 为打开句柄
  * @return int 写入大小
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+	src.buf[0].mem = (void*)buf;
+	return newfs_write_buf(path, &src, offset, fi);
 }
 
 /**
@@ -239,13 +324,87 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh 为打开句柄
  * @return int 读取大小
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, fi, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	if (fi != NULL) {
+		newfs_ra_read((struct newfs_fh*)(uintptr_t)fi->fh, offset, size);
+	}
+	return newfs_data_read(inode, buf, size, offset);
+}
+
+/**
+ * @brief newfs_write_buf 的一次尝试，持命名空间读锁
+ */
+static int newfs_do_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+							  struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, fi, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	return newfs_data_write_buf(inode, buf, offset);
+}
+
+/**
+ * @brief 写入文件，buf 可以是内存或管道
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 文件信息，fi->fh 为打开句柄
+ * @return int 写入大小
+ */
+int newfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+					struct fuse_file_info* fi) {
+	size_t idx = buf->idx;
+	size_t off = buf->off;
+	int ret	   = newfs_do_write_buf(path, buf, offset, fi);
+
+	// buf 可能是管道，只有未被消费时才能重试
+	if (buf->idx == idx && buf->off == off && newfs_retry_nospace(ret)) {
+		ret = newfs_do_write_buf(path, buf, offset, fi);
+	}
+	return ret;
+}
+
+/**
+ * @brief 读取文件，整块以设备 fd 段返回，由 FUSE 经 splice 交给内核并释放 *bufp
+ * FUSE 在返回后才发送回复，fd 段的块由本线程的 pin 保持到下一个操作或句柄关闭，
+ * 没有打开句柄时全部复制为内存段
+ * 
+ * @param path 相对于挂载点的路径
+ * @param bufp 返回的内容
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @param fi 文件信息，fi->fh 为打开句柄
+ * @return int 0成功，否则失败
+ */
+int newfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+				   struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, fi, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	if (fi != NULL) {
+		newfs_ra_read((struct newfs_fh*)(uintptr_t)fi->fh, offset, size);
+	}
+	return newfs_data_read_buf(inode, bufp, size, offset,
+							   fi != NULL ? (struct newfs_fh*)(uintptr_t)fi->fh : NULL);
 }
 
 /**
@@ -255,8 +414,20 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
  * @return int 0成功，否则失败
  */
 int newfs_unlink(const char* path) {
-	/* 选做 */
-	return 0;
+	NEWFS_OP_LOCK_EXCL();
+	boolean is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dentry->ftype == NEWFS_DIR) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	return newfs_remove_dentry(dentry);
 }
 
 /**
@@ -272,8 +443,23 @@ int newfs_unlink(const char* path) {
  * @return int 0成功，否则失败
  */
 int newfs_rmdir(const char* path) {
-	/* 选做 */
-	return 0;
+	NEWFS_OP_LOCK_EXCL();
+	boolean is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (is_root) {
+		return -NEWFS_ERROR_ACCESS;
+	}
+	if (dentry->ftype != NEWFS_DIR) {
+		return -ENOTDIR;
+	}
+	return newfs_remove_dentry(dentry);
 }
 
 /**
@@ -289,28 +475,181 @@ int newfs_rename(const char* from, const char* to) {
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 打开文件：解析一次路径，持有 inode 的句柄保存在 fi->fh 中，
+ * 之后的读写、截断与属性查询不再解析路径
  * 
  * @param path 相对于挂载点的路径
- * @param fi 文件信息
+ * @param fi 文件信息，fi->fh 保存句柄
  * @return int 0成功，否则失败
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	struct newfs_fh*	fh;
+	int ret = newfs_file_inode(path, NULL, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	fh = newfs_fh_open(inode);
+	if (fh == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 打开目录文件
+ * @brief newfs_create_open 的一次尝试，持命名空间读锁
+ * 
+ * @param created 返回文件是否已建好，建好后打开失败不再重试
+ */
+static int newfs_do_create_open(const char* path, mode_t mode, struct fuse_file_info* fi,
+								boolean* created) {
+	NEWFS_OP_LOCK();
+	struct newfs_dentry* dentry;
+	struct newfs_fh*	 fh;
+	int ret = newfs_mknod_dentry(path, mode, &dentry);
+
+	*created = ret == NEWFS_ERROR_NONE;
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	fh = newfs_fh_open(dentry->inode);
+	if (fh == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建并打开文件
  * 
  * @param path 相对于挂载点的路径
+ * @param mode 创建文件的模式
+ * @param fi 文件信息，fi->fh 保存句柄
+ * @return int 0成功，否则失败
+ */
+int newfs_create_open(const char* path, mode_t mode, struct fuse_file_info* fi) {
+	boolean created;
+	int		ret = newfs_do_create_open(path, mode, fi, &created);
+
+	if (!created && newfs_retry_nospace(ret)) {
+		ret = newfs_do_create_open(path, mode, fi, &created);
+	}
+	return ret;
+}
+
+/**
+ * @brief 关闭文件，释放句柄；文件已被删除且这是最后一个句柄时释放其数据块
+ * 
+ * @param path 相对于挂载点的路径，可能为 NULL
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_fh* fh = (struct newfs_fh*)(uintptr_t)fi->fh;
+
+	if (fh != NULL) {
+		newfs_fh_close(fh);
+		fi->fh = 0;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 打开目录文件，建立 readdir 游标并挂到目录 inode 上
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息，fi->fh 保存游标
+ * @return int 0成功，否则失败
+ */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	NEWFS_OP_LOCK();
+	boolean is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dir_cursor* cursor;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dentry->ftype != NEWFS_DIR) {
+		return -ENOTDIR;
+	}
+
+	cursor = newfs_dir_open(dentry->inode);
+	if (cursor == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件，释放游标
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+
+	if (cursor == NULL) {
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_dir_close(cursor);
+	fi->fh = 0;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭文件，不做回写
+ * 数据留给后台回写线程与 fsync，close 不阻塞在设备写上，延迟分配也不因关闭而提前
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 同步文件，回写全部脏 inode 与位图并刷到设备
+ * 位图与父目录可能同时被修改，因此不单独同步一个文件；回写自行加锁，这里不持锁
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非 0 时只要求同步数据，这里同样处理
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret = newfs_sync_fs();
+
+	newfs_icache_reclaim(FALSE);		// 回写后的 inode 变为可淘汰
+	return ret;
+}
+
+/**
+ * @brief 同步目录
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret = newfs_sync_fs();
+
+	newfs_icache_reclaim(FALSE);		// 回写后的 inode 变为可淘汰
+	return ret;
 }
 
 /**
@@ -321,8 +660,91 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, NULL, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	return newfs_data_truncate(inode, offset);
+}
+
+/**
+ * @brief 改变打开文件的大小
+ * 
+ * @param path 相对于挂载点的路径，可能为 NULL
+ * @param offset 改变后文件大小
+ * @param fi 文件信息，fi->fh 为打开句柄
+ * @return int 0成功，否则失败
+ */
+int newfs_ftruncate(const char* path, off_t offset, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, fi, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	return newfs_data_truncate(inode, offset);
+}
+
+/**
+ * @brief newfs_fallocate 的一次尝试，持命名空间读锁
+ */
+static int newfs_do_fallocate(const char* path, int mode, off_t offset, off_t length,
+							  struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_file_inode(path, fi, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	return newfs_data_fallocate(inode, mode, offset, length);
+}
+
+/**
+ * @brief 为打开的文件预分配空间或打洞
+ * 
+ * @param path 相对于挂载点的路径，可能为 NULL
+ * @param mode FALLOC_FL_* 的组合，支持 KEEP_SIZE 与 PUNCH_HOLE
+ * @param offset 起始偏移
+ * @param length 长度
+ * @param fi 文件信息，fi->fh 为打开句柄
+ * @return int 0成功，否则失败
+ */
+int newfs_fallocate(const char* path, int mode, off_t offset, off_t length,
+					struct fuse_file_info* fi) {
+	int ret = newfs_do_fallocate(path, mode, offset, length, fi);
+
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_do_fallocate(path, mode, offset, length, fi);
+	}
+	return ret;
+}
+
+/**
+ * @brief 获取打开文件的属性，文件已被删除时链接数为 0
+ * 
+ * @param path 相对于挂载点的路径，可能为 NULL
+ * @param newfs_stat 返回状态
+ * @param fi 文件信息，fi->fh 为打开句柄
+ * @return int 0成功，否则失败
+ */
+int newfs_fgetattr(const char* path, struct stat* newfs_stat, struct fuse_file_info* fi) {
+	struct newfs_fh* fh = (struct newfs_fh*)(uintptr_t)fi->fh;
+
+	if (fh == NULL) {
+		return newfs_getattr(path, newfs_stat);
+	}
+	NEWFS_OP_LOCK();
+	if (fh->inode->dentry == NULL) {
+		newfs_fill_stat_orphan(fh->inode, newfs_stat);
+	} else {
+		newfs_fill_stat(fh->inode->dentry, FALSE, newfs_stat);
+	}
+	return NEWFS_ERROR_NONE;
 }
 
 
@@ -351,11 +773,27 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/root/ddriver");
+	newfs_options.backend = NULL;
+	newfs_options.cache_mb = 16;
+	newfs_options.queue_depth = 64;
+	newfs_options.dirty_mb = 4;
+	newfs_options.dirty_expire_ms = 5000;
+	newfs_options.readahead_kb = 1024;
+	newfs_options.max_inodes = 65536;
+	newfs_options.lowlevel = FALSE;
+	newfs_options.entry_timeout_ms = 1000;
+	newfs_options.attr_timeout_ms = 1000;
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
 	
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	if (newfs_options.lowlevel) {
+		ret = newfs_ll_main(&args);
+	} else {
+		// 删除打开的文件时直接调用 unlink，由句柄保持文件可读写，不改名为 .fuse_hidden
+		fuse_opt_add_arg(&args, "-ohard_remove");
+		ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	}
 	fuse_opt_free_args(&args);
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,668 @@
+#include "../include/newfs.h"
+#include <stdint.h>
+#include <limits.h>
+#include <endian.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/******************************************************************************
+* SECTION: 位图分配器
+* 位图按字节存储，第 i 位位于 map[i / 8] 的第 i % 8 位（低位在前），
+* 小端下等价于按 64 位字存储，因此可以整字扫描，用 ctz 找空闲位、popcount 计数
+*******************************************************************************/
+#define NEWFS_WORD_BITS		64
+
+static inline uint64_t newfs_bitmap_word(const char* map, int w) {
+	uint64_t word;
+	memcpy(&word, map + w * sizeof(uint64_t), sizeof(uint64_t));
+	return le64toh(word);
+}
+
+/**
+ * @brief 第 w 个字中超出 nbits 的位视为已占用
+ */
+static inline uint64_t newfs_bitmap_used(const char* map, int w, int nbits) {
+	uint64_t word = newfs_bitmap_word(map, w);
+	int		 tail = nbits - w * NEWFS_WORD_BITS;
+	if (tail < NEWFS_WORD_BITS) {
+		word |= ~0ULL << tail;
+	}
+	return word;
+}
+
+/**
+ * @brief 在 [from, to) 字范围内找第一个空闲位
+ * 
+ * @return int 位下标，没有返回 -1
+ */
+static int newfs_bitmap_scan(const char* map, int nbits, int from, int to) {
+	uint64_t word;
+	int		 w = from;
+
+	while (w < to) {
+#ifdef __SSE2__
+		// 16 字节全 1 的区域整段跳过
+		if (w + 2 <= to && (w + 2) * NEWFS_WORD_BITS <= nbits) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(map + w * sizeof(uint64_t)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(-1))) == 0xFFFF) {
+				w += 2;
+				continue;
+			}
+		}
+#endif
+		word = newfs_bitmap_used(map, w, nbits);
+		if (word != ~0ULL) {
+			return w * NEWFS_WORD_BITS + __builtin_ctzll(~word);
+		}
+		w++;
+	}
+	return -1;
+}
+
+/**
+ * @brief 统计位图中的空闲位数
+ * 
+ * @param map 位图
+ * @param nbits 有效位数
+ * @return int 
+ */
+int newfs_bitmap_count_free(const char* map, int nbits) {
+	int words = ROUND_UP(nbits, NEWFS_WORD_BITS) / NEWFS_WORD_BITS;
+	int used  = 0;
+
+	for (int w = 0; w < words; w++) {
+		used += __builtin_popcountll(newfs_bitmap_used(map, w, nbits));
+	}
+	return words * NEWFS_WORD_BITS - used;
+}
+
+/**
+ * @brief 查找空闲位，从 hint 所在字开始向后扫描，到末尾后回绕（next-fit）
+ * 
+ * @param map 位图，大小需按 8 字节对齐
+ * @param nbits 有效位数
+ * @param hint 游标
+ * @return int 空闲位下标，没有返回 -1
+ */
+int newfs_bitmap_find(const char* map, int nbits, int hint) {
+	int words = ROUND_UP(nbits, NEWFS_WORD_BITS) / NEWFS_WORD_BITS;
+	int start = (hint < nbits ? hint : 0) / NEWFS_WORD_BITS;
+	int bit;
+
+	bit = newfs_bitmap_scan(map, nbits, start, words);
+	if (bit < 0) {
+		bit = newfs_bitmap_scan(map, nbits, 0, start);
+	}
+	return bit;
+}
+
+/**
+ * @brief 从 bit 开始连续空闲的位数，最多数到 max
+ */
+static int newfs_bitmap_free_len(const char* map, int nbits, int bit, int max) {
+	int len = 0;
+
+	while (len < max && bit + len < nbits) {
+		if ((bit + len) % NEWFS_WORD_BITS == 0 && max - len >= NEWFS_WORD_BITS
+			&& newfs_bitmap_used(map, (bit + len) / NEWFS_WORD_BITS, nbits) == 0) {
+			len += NEWFS_WORD_BITS;
+			continue;
+		}
+		if (newfs_bitmap_test(map, bit + len)) {
+			break;
+		}
+		len++;
+	}
+	return len;
+}
+
+/**
+ * @brief 查找至少 want 位的连续空闲段，从 hint 向后扫描，到末尾后回绕
+ * 
+ * @param map 位图，大小需按 8 字节对齐
+ * @param nbits 有效位数
+ * @param hint 游标
+ * @param want 需要的位数
+ * @return int 空闲段起始下标，没有足够长的段返回 -1
+ */
+int newfs_bitmap_find_run(const char* map, int nbits, int hint, int want) {
+	int start = hint < nbits ? hint : 0;
+	int lo;
+	int hi;
+	int bit;
+	int len;
+
+	for (int pass = 0; pass < 2; pass++) {
+		lo	= pass == 0 ? start : 0;
+		hi	= pass == 0 ? nbits : start;
+		bit = lo;
+		while (bit < hi) {
+			if (bit % NEWFS_WORD_BITS == 0
+				&& newfs_bitmap_used(map, bit / NEWFS_WORD_BITS, nbits) == ~0ULL) {
+				bit += NEWFS_WORD_BITS;
+				continue;
+			}
+			if (newfs_bitmap_test(map, bit)) {
+				bit++;
+				continue;
+			}
+			len = newfs_bitmap_free_len(map, nbits, bit, want);
+			if (len >= want) {
+				return bit;
+			}
+			bit += len;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief 分配一位
+ * 
+ * @param map 位图，大小需按 8 字节对齐
+ * @param nbits 有效位数
+ * @param hint 游标，分配成功后指向下一位
+ * @return int 分配到的位下标，没有空闲位返回 -1
+ */
+int newfs_bitmap_alloc(char* map, int nbits, int* hint) {
+	int bit = newfs_bitmap_find(map, nbits, *hint);
+
+	if (bit < 0) {
+		return -1;
+	}
+
+	newfs_bitmap_set(map, bit);
+	*hint = bit + 1;
+	return bit;
+}
+
+/**
+ * @brief 置位
+ */
+void newfs_bitmap_set(char* map, int bit) {
+	map[bit / UINT8_BITS] |= (0x1 << (bit % UINT8_BITS));
+}
+
+/**
+ * @brief 清位
+ */
+void newfs_bitmap_clear(char* map, int bit) {
+	map[bit / UINT8_BITS] &= ~(0x1 << (bit % UINT8_BITS));
+}
+
+/**
+ * @brief 测试某位是否已占用
+ */
+boolean newfs_bitmap_test(const char* map, int bit) {
+	return (map[bit / UINT8_BITS] >> (bit % UINT8_BITS)) & 0x1;
+}
+
+/******************************************************************************
+* SECTION: inode / 数据块分配，维护空闲计数，空间不足时 O(1) 返回
+* inode 位图与数据位图各有一把锁，保护位图、空闲计数、游标与脏范围；
+* 回写位图时持命名空间写锁，不与分配并发。
+* 延迟分配的文件块只在 resv_data_blks 中预留，位图中仍空闲，普通分配只能使用
+* 未被预留的部分，回写时为预留的块分配物理块，不会因空间不足失败
+*******************************************************************************/
+static pthread_mutex_t ino_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t data_lock = PTHREAD_MUTEX_INITIALIZER;
+struct newfs_defer_blk {
+	int				blk;
+	unsigned long	gen;			// 释放它的事务提交时的 pin 代数，0 为尚未提交
+};
+static struct {
+	struct newfs_defer_blk* blks;	// 已释放、尚不能复用的数据块，位图中仍占用
+	int		cnt;
+	int		cap;
+	int		snap;					// 前 snap 个归入正在提交的事务
+	int		lo;						// 这些块所在的范围（位）
+	int		hi;
+	int*	inos;					// 已释放、尚不能复用的 inode 号，位图中仍占用
+	int		ino_cnt;
+	int		ino_cap;
+	int		ino_snap;
+	int		ino_lo;
+	int		ino_hi;
+} defer;
+
+/**
+ * @brief 挂载后根据位图初始化空闲计数与游标
+ */
+void newfs_alloc_init() {
+	super.free_inodes	  = newfs_bitmap_count_free(super.map_inode, super.max_ino);
+	super.free_data_blks  = newfs_bitmap_count_free(super.map_data, super.max_data_blks);
+	super.resv_data_blks  = 0;
+	super.ino_hint		  = 0;
+	super.data_hint		  = 0;
+	defer.cnt			  = 0;
+	defer.snap			  = 0;
+	defer.ino_cnt		  = 0;
+	defer.ino_snap		  = 0;
+	defer.lo			  = INT_MAX;
+	defer.hi			  = -1;
+	defer.ino_lo		  = INT_MAX;
+	defer.ino_hi		  = -1;
+}
+
+/**
+ * @brief 记录位图中被修改的字节范围，回写时只写这一段
+ * 
+ * @param map super.map_inode 或 super.map_data
+ * @param bit 起始位
+ * @param cnt 位数
+ */
+void newfs_map_dirty(char* map, int bit, int cnt) {
+	int* lo = map == super.map_inode ? &super.map_inode_dlo : &super.map_data_dlo;
+	int* hi = map == super.map_inode ? &super.map_inode_dhi : &super.map_data_dhi;
+
+	if (cnt <= 0) {
+		return;
+	}
+	if (bit / UINT8_BITS < *lo) {
+		*lo = bit / UINT8_BITS;
+	}
+	if ((bit + cnt - 1) / UINT8_BITS > *hi) {
+		*hi = (bit + cnt - 1) / UINT8_BITS;
+	}
+}
+
+/**
+ * @brief 事务中止时把已写入事务的位图范围重新标记为脏，随下一次回写写出
+ * 
+ * @param ino_lo inode 位图脏范围（字节）
+ * @param ino_hi 
+ * @param data_lo 数据位图脏范围（字节）
+ * @param data_hi 
+ */
+void newfs_map_redirty(int ino_lo, int ino_hi, int data_lo, int data_hi) {
+	if (ino_lo <= ino_hi) {
+		pthread_mutex_lock(&ino_lock);
+		newfs_map_dirty(super.map_inode, ino_lo * UINT8_BITS, (ino_hi - ino_lo + 1) * UINT8_BITS);
+		pthread_mutex_unlock(&ino_lock);
+	}
+	if (data_lo <= data_hi) {
+		pthread_mutex_lock(&data_lock);
+		newfs_map_dirty(super.map_data, data_lo * UINT8_BITS, (data_hi - data_lo + 1) * UINT8_BITS);
+		pthread_mutex_unlock(&data_lock);
+	}
+}
+
+/**
+ * @brief 清除位图的脏范围
+ */
+void newfs_map_clean() {
+	super.map_inode_dlo = INT_MAX;
+	super.map_inode_dhi = -1;
+	super.map_data_dlo  = INT_MAX;
+	super.map_data_dhi  = -1;
+}
+
+/**
+ * @brief 分配一个 inode 号
+ * 
+ * @return int inode 号，空间不足返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_alloc_ino() {
+	int ino = -NEWFS_ERROR_NOSPACE;
+
+	pthread_mutex_lock(&ino_lock);
+	if (super.free_inodes > 0) {
+		ino = newfs_bitmap_alloc(super.map_inode, super.max_ino, &super.ino_hint);
+	}
+	if (ino >= 0) {
+		super.free_inodes--;
+		newfs_map_dirty(super.map_inode, ino, 1);
+	} else {
+		ino = -NEWFS_ERROR_NOSPACE;
+	}
+	pthread_mutex_unlock(&ino_lock);
+	return ino;
+}
+
+/**
+ * @brief 释放 inode 号
+ * 与数据块一样在位图中保持占用，等释放它的事务提交后由 newfs_free_defer_end 归还；
+ * 内存不足以记录时退回立即释放
+ */
+void newfs_free_ino(int ino) {
+	int* tmp;
+
+	pthread_mutex_lock(&ino_lock);
+	if (!newfs_bitmap_test(super.map_inode, ino)) {
+		pthread_mutex_unlock(&ino_lock);
+		return;
+	}
+	if (defer.ino_cnt == defer.ino_cap) {
+		tmp = (int*)realloc(defer.inos, (defer.ino_cap == 0 ? 64 : defer.ino_cap * 2) * sizeof(int));
+		if (tmp != NULL) {
+			defer.inos	  = tmp;
+			defer.ino_cap = defer.ino_cap == 0 ? 64 : defer.ino_cap * 2;
+		}
+	}
+	newfs_map_dirty(super.map_inode, ino, 1);
+	if (defer.ino_cnt < defer.ino_cap) {
+		defer.inos[defer.ino_cnt++] = ino;
+		defer.ino_lo = ino < defer.ino_lo ? ino : defer.ino_lo;
+		defer.ino_hi = ino > defer.ino_hi ? ino : defer.ino_hi;
+		pthread_mutex_unlock(&ino_lock);
+		return;
+	}
+	newfs_bitmap_clear(super.map_inode, ino);
+	super.free_inodes++;
+	pthread_mutex_unlock(&ino_lock);
+}
+
+/**
+ * @brief 分配一个数据块
+ * 
+ * @return int 数据块号，空间不足返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_alloc_data_blk() {
+	int blk = -NEWFS_ERROR_NOSPACE;
+
+	pthread_mutex_lock(&data_lock);
+	if (super.free_data_blks - super.resv_data_blks > 0) {
+		blk = newfs_bitmap_alloc(super.map_data, super.max_data_blks, &super.data_hint);
+	}
+	if (blk >= 0) {
+		super.free_data_blks--;
+		newfs_map_dirty(super.map_data, blk, 1);
+	} else {
+		blk = -NEWFS_ERROR_NOSPACE;
+	}
+	pthread_mutex_unlock(&data_lock);
+	return blk;
+}
+
+/**
+ * @brief 分配一段连续的数据块，最多 want 块
+ * goal 空闲且从 goal 起有 want 块时紧接已有 extent 分配；否则找第一段不少于 want 块的
+ * 空闲区，整个文件落在一段连续空间中；都没有时退回 goal 或 next-fit 游标处第一个
+ * 空闲块，然后向后尽量延伸
+ * 
+ * @param goal 期望的起始块号，NEWFS_BLK_NONE 表示不指定
+ * @param want 期望块数
+ * @param resv 这些块已由 newfs_reserve_data_blks 预留，可以使用预留的空间；
+ *             预留由调用者在建立映射后用 newfs_unreserve_data_blks 归还
+ * @param got 实际分配的块数
+ * @return int 起始块号，空间不足返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_alloc_data_run(int goal, int want, boolean resv, int* got) {
+	int avail;
+	int start;
+	int len = 0;
+
+	pthread_mutex_lock(&data_lock);
+	avail = resv ? super.free_data_blks : super.free_data_blks - super.resv_data_blks;
+	if (avail <= 0) {
+		pthread_mutex_unlock(&data_lock);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	want  = want < avail ? want : avail;
+	start = -1;
+	if (goal >= 0 && goal < super.max_data_blks
+		&& newfs_bitmap_free_len(super.map_data, super.max_data_blks, goal, want) == want) {
+		start = goal;
+	}
+	if (start < 0 && want > 1) {
+		start = newfs_bitmap_find_run(super.map_data, super.max_data_blks, super.data_hint, want);
+	}
+	if (start < 0 && goal >= 0 && goal < super.max_data_blks
+		&& !newfs_bitmap_test(super.map_data, goal)) {
+		start = goal;
+	}
+	if (start < 0) {
+		start = newfs_bitmap_find(super.map_data, super.max_data_blks, super.data_hint);
+	}
+	if (start < 0) {
+		pthread_mutex_unlock(&data_lock);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	while (len < want && start + len < super.max_data_blks
+		   && !newfs_bitmap_test(super.map_data, start + len)) {
+		newfs_bitmap_set(super.map_data, start + len);
+		len++;
+	}
+	newfs_map_dirty(super.map_data, start, len);
+	super.free_data_blks -= len;
+	super.data_hint		  = start + len;
+	pthread_mutex_unlock(&data_lock);
+	*got				  = len;
+	return start;
+}
+
+/**
+ * @brief 为延迟分配预留 cnt 个数据块
+ * 
+ * @param cnt 
+ * @return int 未预留的空闲块不足时返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_reserve_data_blks(int cnt) {
+	int ret = NEWFS_ERROR_NONE;
+
+	pthread_mutex_lock(&data_lock);
+	if (super.free_data_blks - super.resv_data_blks < cnt) {
+		ret = -NEWFS_ERROR_NOSPACE;
+	} else {
+		super.resv_data_blks += cnt;
+	}
+	pthread_mutex_unlock(&data_lock);
+	return ret;
+}
+
+/**
+ * @brief 归还预留：延迟分配的块已分配物理块或被截断
+ * 
+ * @param cnt 
+ */
+void newfs_unreserve_data_blks(int cnt) {
+	if (cnt <= 0) {
+		return;
+	}
+	pthread_mutex_lock(&data_lock);
+	super.resv_data_blks -= cnt;
+	pthread_mutex_unlock(&data_lock);
+}
+
+/**
+ * @brief 释放数据块
+ * 块在位图中保持占用，等释放它的事务提交、且读回复不再引用后由 newfs_free_defer_end 归还；
+ * 内存不足以记录时退回立即释放
+ */
+void newfs_free_data_blk(int blk) {
+	struct newfs_defer_blk* tmp;
+
+	pthread_mutex_lock(&data_lock);
+	if (!newfs_bitmap_test(super.map_data, blk)) {
+		pthread_mutex_unlock(&data_lock);
+		return;
+	}
+	if (defer.cnt == defer.cap) {
+		tmp = (struct newfs_defer_blk*)realloc(defer.blks, (defer.cap == 0 ? 64 : defer.cap * 2)
+														   * sizeof(struct newfs_defer_blk));
+		if (tmp != NULL) {
+			defer.blks = tmp;
+			defer.cap  = defer.cap == 0 ? 64 : defer.cap * 2;
+		}
+	}
+	newfs_map_dirty(super.map_data, blk, 1);
+	if (defer.cnt < defer.cap) {
+		defer.blks[defer.cnt].blk = blk;
+		defer.blks[defer.cnt].gen = 0;
+		defer.cnt++;
+		defer.lo = blk < defer.lo ? blk : defer.lo;
+		defer.hi = blk > defer.hi ? blk : defer.hi;
+		pthread_mutex_unlock(&data_lock);
+		return;
+	}
+	newfs_bitmap_clear(super.map_data, blk);
+	super.free_data_blks++;
+	pthread_mutex_unlock(&data_lock);
+}
+
+/******************************************************************************
+* SECTION: 延迟复用
+* 截断、打洞、删除释放的块在释放它们的事务提交前，磁盘上仍属于原文件。文件数据
+* 不经过日志直接写设备，若这类块立即被其他文件分配并写入，提交前崩溃时原文件会读到
+* 别的文件的数据；元数据块（目录项块、extent 溢出块）被复用时，提交时写回的旧元数据
+* 还会覆盖新写入的数据。因此释放的块先在位图中保持占用：回写构造事务时，此前释放的块
+* 归入本事务，写入事务的位图中为空闲，内存中仍占用，提交完成后才清位可供分配。
+* 已返回给 FUSE、尚未发送的读回复中的 fd 段可能还指向这些块，提交时记下 pin 代数，
+* 此前登记的 pin 未全部放下时留到之后的事务再归还（见 newfs_data.c 中 fd 段的块）。
+* inode 号同理：回写拆成多个事务时，删除的 inode 号若随前一个事务的位图归还并被复用，
+* 父目录的修改提交前崩溃，旧目录项会指向新文件，因此也留到最后一个事务
+*******************************************************************************/
+
+/**
+ * @brief 回写持命名空间写锁、写位图之前调用：此前释放的块与 inode 号归入本事务并暂时
+ * 清位，随后写入事务的位图中它们为空闲。前面拆出的事务已写过位图、清掉了脏范围，
+ * 这里重新标记
+ */
+void newfs_free_defer_begin() {
+	pthread_mutex_lock(&ino_lock);
+	defer.ino_snap = defer.ino_cnt;
+	for (int i = 0; i < defer.ino_snap; i++) {
+		newfs_bitmap_clear(super.map_inode, defer.inos[i]);
+		newfs_map_dirty(super.map_inode, defer.inos[i], 1);
+	}
+	pthread_mutex_unlock(&ino_lock);
+	pthread_mutex_lock(&data_lock);
+	defer.snap = defer.cnt;
+	for (int i = 0; i < defer.snap; i++) {
+		newfs_bitmap_clear(super.map_data, defer.blks[i].blk);
+		newfs_map_dirty(super.map_data, defer.blks[i].blk, 1);
+	}
+	pthread_mutex_unlock(&data_lock);
+}
+
+/**
+ * @brief 位图写入事务后调用：本事务释放的块与 inode 号重新置位，提交前不可分配
+ */
+void newfs_free_defer_hold() {
+	pthread_mutex_lock(&ino_lock);
+	for (int i = 0; i < defer.ino_snap; i++) {
+		newfs_bitmap_set(super.map_inode, defer.inos[i]);
+	}
+	pthread_mutex_unlock(&ino_lock);
+	pthread_mutex_lock(&data_lock);
+	for (int i = 0; i < defer.snap; i++) {
+		newfs_bitmap_set(super.map_data, defer.blks[i].blk);
+	}
+	pthread_mutex_unlock(&data_lock);
+}
+
+/**
+ * @brief 事务结束：提交成功时归还本事务释放的 inode 号，以及不再被读回复引用的块，
+ * 其余块留到之后的事务；中止时都留给下一个事务
+ * 
+ * @param committed 事务是否已提交
+ */
+void newfs_free_defer_end(boolean committed) {
+	unsigned long gen;
+	unsigned long oldest;
+	int			  kept = 0;
+
+	pthread_mutex_lock(&ino_lock);
+	for (int i = 0; i < defer.ino_snap; i++) {
+		if (committed) {
+			newfs_bitmap_clear(super.map_inode, defer.inos[i]);
+			super.free_inodes++;
+		} else {
+			newfs_map_dirty(super.map_inode, defer.inos[i], 1);
+		}
+	}
+	if (committed) {
+		memmove(defer.inos, defer.inos + defer.ino_snap,
+				(defer.ino_cnt - defer.ino_snap) * sizeof(int));
+		defer.ino_cnt -= defer.ino_snap;
+		defer.ino_lo   = INT_MAX;
+		defer.ino_hi   = -1;
+		for (int i = 0; i < defer.ino_cnt; i++) {
+			defer.ino_lo = defer.inos[i] < defer.ino_lo ? defer.inos[i] : defer.ino_lo;
+			defer.ino_hi = defer.inos[i] > defer.ino_hi ? defer.inos[i] : defer.ino_hi;
+		}
+	}
+	defer.ino_snap = 0;
+	pthread_mutex_unlock(&ino_lock);
+
+	pthread_mutex_lock(&data_lock);
+	if (committed && defer.snap > 0) {
+		gen	   = newfs_data_pin_gen();
+		oldest = newfs_data_pin_oldest();
+		for (int i = 0; i < defer.snap; i++) {
+			if (defer.blks[i].gen == 0) {
+				defer.blks[i].gen = gen;
+			}
+			if (defer.blks[i].gen > oldest) {
+				defer.blks[kept++] = defer.blks[i];
+				continue;
+			}
+			newfs_bitmap_clear(super.map_data, defer.blks[i].blk);
+			super.free_data_blks++;
+		}
+		memmove(defer.blks + kept, defer.blks + defer.snap,
+				(defer.cnt - defer.snap) * sizeof(struct newfs_defer_blk));
+		defer.cnt -= defer.snap - kept;
+		defer.lo   = INT_MAX;
+		defer.hi   = -1;
+		for (int i = 0; i < defer.cnt; i++) {
+			defer.lo = defer.blks[i].blk < defer.lo ? defer.blks[i].blk : defer.lo;
+			defer.hi = defer.blks[i].blk > defer.hi ? defer.blks[i].blk : defer.hi;
+		}
+	} else if (!committed) {
+		for (int i = 0; i < defer.snap; i++) {
+			newfs_map_dirty(super.map_data, defer.blks[i].blk, 1);
+		}
+	}
+	defer.snap = 0;
+	pthread_mutex_unlock(&data_lock);
+}
+
+/**
+ * @brief 字节范围 [dlo, dhi] 并上位范围 [lo, hi] 后的字节数
+ */
+static int newfs_map_span(int dlo, int dhi, int lo, int hi) {
+	if (lo <= hi) {
+		dlo = lo / UINT8_BITS < dlo ? lo / UINT8_BITS : dlo;
+		dhi = hi / UINT8_BITS > dhi ? hi / UINT8_BITS : dhi;
+	}
+	return dlo <= dhi ? dhi - dlo + 1 : 0;
+}
+
+/**
+ * @brief 回写的最后一个事务中位图记录的字节数：各位图的脏范围并上延迟复用的块与
+ * inode 号所在的范围（newfs_free_defer_begin 会把它们标脏）
+ * 
+ * @return int 
+ */
+int newfs_map_txn_bytes() {
+	int bytes;
+
+	pthread_mutex_lock(&ino_lock);
+	bytes = newfs_map_span(super.map_inode_dlo, super.map_inode_dhi, defer.ino_lo, defer.ino_hi);
+	pthread_mutex_unlock(&ino_lock);
+	pthread_mutex_lock(&data_lock);
+	bytes += newfs_map_span(super.map_data_dlo, super.map_data_dhi, defer.lo, defer.hi);
+	pthread_mutex_unlock(&data_lock);
+	return bytes;
+}
+
+/**
+ * @brief 回写后是否可能腾出空间：有等待事务提交才能归还的块或 inode 号，或有预留
+ * （延迟分配与溢出块按上限预留，分配后多余的部分归还）
+ * 
+ * @return boolean
+ */
+boolean newfs_space_pending() {
+	boolean pending;
+
+	pthread_mutex_lock(&ino_lock);
+	pending = defer.ino_cnt > 0;
+	pthread_mutex_unlock(&ino_lock);
+	pthread_mutex_lock(&data_lock);
+	pending = pending || defer.cnt > 0 || super.resv_data_blks > 0;
+	pthread_mutex_unlock(&data_lock);
+	return pending;
+}
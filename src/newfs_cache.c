@@ -0,0 +1,514 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 块缓存
+* 以设备块号（NEWFS_BLK_SZ）为键，哈希表定位，双向链表维护 LRU 顺序
+* 写入只标记脏块，在 sync、umount 或缓存不足时按块号顺序回写
+* 整个缓存由一把锁保护，未命中的设备读也在锁内完成
+*******************************************************************************/
+static struct newfs_cache cache;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 从 LRU 链表中摘除
+ * 
+ * @param buf 
+ */
+static void newfs_cache_lru_del(struct newfs_buf* buf) {
+	buf->lru_prev->lru_next = buf->lru_next;
+	buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+/**
+ * @brief 插入 LRU 链表头部（最近使用）
+ * 
+ * @param buf 
+ */
+static void newfs_cache_lru_add(struct newfs_buf* buf) {
+	buf->lru_next			= cache.lru.lru_next;
+	buf->lru_prev			= &cache.lru;
+	cache.lru.lru_next->lru_prev = buf;
+	cache.lru.lru_next		= buf;
+}
+
+static struct newfs_buf** newfs_cache_slot(int blk_no) {
+	return &cache.htab[(unsigned int)blk_no & (cache.hash_sz - 1)];
+}
+
+static void newfs_cache_hash_del(struct newfs_buf* buf) {
+	struct newfs_buf** pos = newfs_cache_slot(buf->blk_no);
+	while (*pos != buf) {
+		pos = &(*pos)->hash_next;
+	}
+	*pos = buf->hash_next;
+}
+
+static int newfs_cache_cmp(const void* a, const void* b) {
+	int l = (*(struct newfs_buf* const*)a)->blk_no;
+	int r = (*(struct newfs_buf* const*)b)->blk_no;
+	return (l > r) - (l < r);
+}
+
+/**
+ * @brief 初始化块缓存
+ * 
+ * @param cache_blks 缓存块数，0 表示不启用缓存
+ * @return int 
+ */
+int newfs_cache_init(int cache_blks) {
+	memset(&cache, 0, sizeof(cache));
+	cache.lru.lru_next = &cache.lru;
+	cache.lru.lru_prev = &cache.lru;
+	if (cache_blks <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+
+	cache.hash_sz = 1;
+	while (cache.hash_sz < cache_blks) {
+		cache.hash_sz <<= 1;
+	}
+	cache.htab = (struct newfs_buf**)calloc(cache.hash_sz, sizeof(struct newfs_buf*));
+	cache.flush_vec = (struct newfs_buf**)malloc(cache_blks * sizeof(struct newfs_buf*));
+	if (cache.htab == NULL || cache.flush_vec == NULL) {
+		free(cache.htab);
+		free(cache.flush_vec);
+		cache.htab = NULL;
+		cache.flush_vec = NULL;
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	cache.capacity = cache_blks;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 缓存是否启用
+ * 
+ * @return boolean 
+ */
+boolean newfs_cache_enabled() {
+	return cache.capacity > 0;
+}
+
+/**
+ * @brief 脏块个数
+ * 
+ * @return int 
+ */
+int newfs_cache_dirty_blks() {
+	return __atomic_load_n(&cache.dirty_cnt, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 将所有脏块按块号升序写回设备，调用者持有缓存锁
+ * 块号连续的脏块合并为一个请求，所有请求作为一批提交给后端
+ * 
+ * @return int 
+ */
+static int newfs_cache_do_flush() {
+	struct newfs_buf*	 buf;
+	struct newfs_io_req* reqs;
+	int   cnt  = 0;
+	int   nreq = 0;
+	int   run_len;
+	int   ret;
+	char* run_buf;
+
+	if (cache.dirty_cnt == 0) {
+		return NEWFS_ERROR_NONE;
+	}
+
+	for (buf = cache.lru.lru_next; buf != &cache.lru; buf = buf->lru_next) {
+		if (buf->dirty) {
+			cache.flush_vec[cnt++] = buf;
+		}
+	}
+	qsort(cache.flush_vec, cnt, sizeof(struct newfs_buf*), newfs_cache_cmp);
+
+	reqs	= (struct newfs_io_req*)malloc(cnt * sizeof(struct newfs_io_req));
+	run_buf = (char*)malloc(NEWFS_BLKS_SZ(cnt));
+	if (reqs == NULL || run_buf == NULL) {
+		free(reqs);
+		free(run_buf);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	for (int i = 0; i < cnt; i += run_len) {
+		run_len = 1;
+		while (i + run_len < cnt
+			   && cache.flush_vec[i + run_len]->blk_no == cache.flush_vec[i]->blk_no + run_len) {
+			run_len++;
+		}
+
+		reqs[nreq].op	  = NEWFS_IO_WRITE;
+		reqs[nreq].offset = NEWFS_BLKS_SZ(cache.flush_vec[i]->blk_no);
+		reqs[nreq].size	  = NEWFS_BLKS_SZ(run_len);
+		if (run_len == 1) {
+			reqs[nreq].buf = cache.flush_vec[i]->data;
+		} else {
+			reqs[nreq].buf = run_buf + NEWFS_BLKS_SZ(i);
+			for (int j = 0; j < run_len; j++) {
+				memcpy(reqs[nreq].buf + NEWFS_BLKS_SZ(j), cache.flush_vec[i + j]->data,
+					   NEWFS_BLK_SZ);
+			}
+		}
+		nreq++;
+	}
+
+	ret = newfs_dev_submit(reqs, nreq);
+	if (ret == NEWFS_ERROR_NONE) {
+		for (int i = 0; i < cnt; i++) {
+			cache.flush_vec[i]->dirty = FALSE;
+		}
+		__atomic_store_n(&cache.dirty_cnt, 0, __ATOMIC_RELAXED);
+	}
+
+	free(reqs);
+	free(run_buf);
+	return ret;
+}
+
+/**
+ * @brief 将所有脏块写回设备
+ * 
+ * @return int 
+ */
+int newfs_cache_flush() {
+	int ret;
+
+	pthread_mutex_lock(&cache_lock);
+	ret = newfs_cache_do_flush();
+	pthread_mutex_unlock(&cache_lock);
+	return ret;
+}
+
+/**
+ * @brief 获取一个空闲缓存块：未满时新建，否则淘汰 LRU 尾部的干净块
+ * 若尾部为脏块则先整体回写
+ * 
+ * @return struct newfs_buf* 
+ */
+static struct newfs_buf* newfs_cache_get_free() {
+	struct newfs_buf* buf;
+
+	if (cache.nbufs < cache.capacity) {
+		buf = (struct newfs_buf*)malloc(sizeof(struct newfs_buf));
+		if (buf == NULL) {
+			return NULL;
+		}
+		buf->data = (char*)malloc(NEWFS_BLK_SZ);
+		if (buf->data == NULL) {
+			free(buf);
+			return NULL;
+		}
+		cache.nbufs++;
+		return buf;
+	}
+
+	buf = cache.lru.lru_prev;
+	if (buf->dirty && newfs_cache_do_flush() != NEWFS_ERROR_NONE) {
+		return NULL;
+	}
+	newfs_cache_lru_del(buf);
+	newfs_cache_hash_del(buf);
+	return buf;
+}
+
+/**
+ * @brief 查找缓存块，不改变 LRU 顺序
+ * 
+ * @param blk_no 
+ * @return struct newfs_buf* 
+ */
+static struct newfs_buf* newfs_cache_find(int blk_no) {
+	struct newfs_buf* buf = *newfs_cache_slot(blk_no);
+	while (buf != NULL && buf->blk_no != blk_no) {
+		buf = buf->hash_next;
+	}
+	return buf;
+}
+
+/**
+ * @brief 预取一组块到缓存，未缓存的块作为一批读请求提交
+ * 块号连续的未缓存块合并为一个请求，读入后再拆分到各缓存块
+ * 一次最多预取缓存容量的一半，避免新读入的块被自身淘汰
+ * 
+ * @param blk_nos 设备块号数组
+ * @param cnt 个数
+ * @return int 
+ */
+int newfs_cache_prefetch(int* blk_nos, int cnt) {
+	struct newfs_io_req* reqs;
+	struct newfs_buf**	 bufs;
+	struct newfs_buf**	 slot;
+	char* run_buf;
+	int   nbuf = 0;
+	int   nreq = 0;
+	int   run_len;
+	int   ret;
+
+	if (!newfs_cache_enabled() || cnt <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (cnt > cache.capacity / 2) {
+		cnt = cache.capacity / 2;
+	}
+
+	reqs	= (struct newfs_io_req*)malloc(cnt * sizeof(struct newfs_io_req));
+	bufs	= (struct newfs_buf**)malloc(cnt * sizeof(struct newfs_buf*));
+	run_buf = (char*)malloc(NEWFS_BLKS_SZ(cnt));
+	if (reqs == NULL || bufs == NULL || run_buf == NULL) {
+		free(reqs);
+		free(bufs);
+		free(run_buf);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	for (int i = 0; i < cnt; i++) {
+		if (newfs_cache_find(blk_nos[i]) != NULL) {
+			continue;
+		}
+		bufs[nbuf] = newfs_cache_get_free();
+		if (bufs[nbuf] == NULL) {
+			break;
+		}
+		bufs[nbuf]->blk_no	= blk_nos[i];
+		bufs[nbuf]->dirty	= FALSE;
+		slot				= newfs_cache_slot(blk_nos[i]);
+		bufs[nbuf]->hash_next = *slot;
+		*slot				= bufs[nbuf];
+		newfs_cache_lru_add(bufs[nbuf]);
+		nbuf++;
+	}
+
+	for (int i = 0; i < nbuf; i += run_len) {
+		run_len = 1;
+		while (i + run_len < nbuf && bufs[i + run_len]->blk_no == bufs[i]->blk_no + run_len) {
+			run_len++;
+		}
+		reqs[nreq].op		= NEWFS_IO_READ;
+		reqs[nreq].offset	= NEWFS_BLKS_SZ(bufs[i]->blk_no);
+		reqs[nreq].buf		= run_len == 1 ? bufs[i]->data : run_buf + NEWFS_BLKS_SZ(i);
+		reqs[nreq].size		= NEWFS_BLKS_SZ(run_len);
+		nreq++;
+	}
+
+	ret = nreq > 0 ? newfs_dev_submit(reqs, nreq) : NEWFS_ERROR_NONE;
+	for (int i = 0; i < nreq; i++) {
+		if (reqs[i].size == NEWFS_BLK_SZ) {
+			continue;
+		}
+		int first = (reqs[i].buf - run_buf) / NEWFS_BLK_SZ;
+		for (int j = 0; j < reqs[i].size / NEWFS_BLK_SZ; j++) {
+			memcpy(bufs[first + j]->data, reqs[i].buf + NEWFS_BLKS_SZ(j), NEWFS_BLK_SZ);
+		}
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		/* 读失败的块不能留在缓存中 */
+		for (int i = 0; i < nbuf; i++) {
+			newfs_cache_lru_del(bufs[i]);
+			newfs_cache_hash_del(bufs[i]);
+			free(bufs[i]->data);
+			free(bufs[i]);
+			cache.nbufs--;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	free(reqs);
+	free(bufs);
+	free(run_buf);
+	return ret;
+}
+
+/**
+ * @brief 预取一段连续的块
+ * 
+ * @param blk_no 起始设备块号
+ * @param cnt 块数
+ * @return int 
+ */
+int newfs_cache_prefetch_range(int blk_no, int cnt) {
+	int* blk_nos;
+	int  ret;
+
+	if (!newfs_cache_enabled() || cnt <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (cnt > cache.capacity / 2) {
+		cnt = cache.capacity / 2;
+	}
+	blk_nos = (int*)malloc(cnt * sizeof(int));
+	if (blk_nos == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	for (int i = 0; i < cnt; i++) {
+		blk_nos[i] = blk_no + i;
+	}
+	ret = newfs_cache_prefetch(blk_nos, cnt);
+	free(blk_nos);
+	return ret;
+}
+
+/**
+ * @brief 查找块，未命中时分配缓存块
+ * 
+ * @param blk_no 设备块号
+ * @param fill 未命中时是否从设备读入内容
+ * @return struct newfs_buf* 
+ */
+static struct newfs_buf* newfs_cache_get(int blk_no, boolean fill) {
+	struct newfs_buf** slot = newfs_cache_slot(blk_no);
+	struct newfs_buf*  buf  = newfs_cache_find(blk_no);
+
+	if (buf != NULL) {
+		cache.hits++;
+		newfs_cache_lru_del(buf);
+		newfs_cache_lru_add(buf);
+		return buf;
+	}
+
+	cache.misses++;
+	buf = newfs_cache_get_free();
+	if (buf == NULL) {
+		return NULL;
+	}
+	if (fill && newfs_dev_read(NEWFS_BLKS_SZ(blk_no), buf->data, NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+		free(buf->data);
+		free(buf);
+		cache.nbufs--;
+		return NULL;
+	}
+	buf->blk_no		= blk_no;
+	buf->dirty		= FALSE;
+	buf->hash_next	= *slot;
+	*slot			= buf;
+	newfs_cache_lru_add(buf);
+	return buf;
+}
+
+/**
+ * @brief 经缓存读
+ * 
+ * @param offset 起始地址
+ * @param out_content 指针地址
+ * @param size 大小
+ * @return int 
+ */
+int newfs_cache_read(int64_t offset, char *out_content, int size) {
+	struct newfs_buf* buf;
+	int blk_no = offset / NEWFS_BLK_SZ;
+	int bias   = offset % NEWFS_BLK_SZ;
+	int len;
+
+	// 跨多个块的读先整段预取，未命中的连续块合并为一次设备读
+	if (bias + size > NEWFS_BLK_SZ) {
+		newfs_cache_prefetch_range(blk_no, ROUND_UP(bias + size, NEWFS_BLK_SZ) / NEWFS_BLK_SZ);
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	while (size > 0) {
+		len = NEWFS_BLK_SZ - bias < size ? NEWFS_BLK_SZ - bias : size;
+		buf = newfs_cache_get(blk_no, TRUE);
+		if (buf == NULL) {
+			pthread_mutex_unlock(&cache_lock);
+			return -NEWFS_ERROR_IO;
+		}
+		memcpy(out_content, buf->data + bias, len);
+		out_content += len;
+		size		-= len;
+		bias		 = 0;
+		blk_no++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经缓存写，仅标记脏块，整块覆盖时不读设备
+ * 
+ * @param offset 起始地址
+ * @param in_content 指针地址
+ * @param size 大小
+ * @return int 
+ */
+int newfs_cache_write(int64_t offset, char *in_content, int size) {
+	struct newfs_buf* buf;
+	int blk_no = offset / NEWFS_BLK_SZ;
+	int bias   = offset % NEWFS_BLK_SZ;
+	int len;
+
+	pthread_mutex_lock(&cache_lock);
+	while (size > 0) {
+		len = NEWFS_BLK_SZ - bias < size ? NEWFS_BLK_SZ - bias : size;
+		buf = newfs_cache_get(blk_no, len != NEWFS_BLK_SZ);
+		if (buf == NULL) {
+			pthread_mutex_unlock(&cache_lock);
+			return -NEWFS_ERROR_IO;
+		}
+		memcpy(buf->data + bias, in_content, len);
+		if (!buf->dirty) {
+			buf->dirty = TRUE;
+			__atomic_add_fetch(&cache.dirty_cnt, 1, __ATOMIC_RELAXED);
+		}
+		in_content  += len;
+		size		-= len;
+		bias		 = 0;
+		blk_no++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 丢弃一段块的缓存副本，脏块不回写
+ * 文件数据绕过缓存直接写设备前调用，避免之后读到或刷出旧内容
+ * 
+ * @param blk_no 起始设备块号
+ * @param cnt 块数
+ */
+void newfs_cache_invalidate(int blk_no, int cnt) {
+	struct newfs_buf* buf;
+
+	if (!newfs_cache_enabled()) {
+		return;
+	}
+	pthread_mutex_lock(&cache_lock);
+	for (int i = 0; i < cnt; i++) {
+		buf = newfs_cache_find(blk_no + i);
+		if (buf == NULL) {
+			continue;
+		}
+		if (buf->dirty) {
+			__atomic_sub_fetch(&cache.dirty_cnt, 1, __ATOMIC_RELAXED);
+		}
+		newfs_cache_lru_del(buf);
+		newfs_cache_hash_del(buf);
+		free(buf->data);
+		free(buf);
+		cache.nbufs--;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * @brief 回写所有脏块并释放缓存
+ * 
+ * @return int 
+ */
+int newfs_cache_destroy() {
+	struct newfs_buf* buf;
+	struct newfs_buf* next;
+	int ret = newfs_cache_flush();
+
+	NEWFS_DBG("[%s] hits: %ld, misses: %ld\n", __func__, cache.hits, cache.misses);
+	for (buf = cache.lru.lru_next; buf != &cache.lru; buf = next) {
+		next = buf->lru_next;
+		free(buf->data);
+		free(buf);
+	}
+	free(cache.htab);
+	free(cache.flush_vec);
+	memset(&cache, 0, sizeof(cache));
+	return ret;
+}
@@ -0,0 +1,864 @@
+#include "../include/newfs.h"
+#include <linux/falloc.h>
+#include <limits.h>
+
+/******************************************************************************
+* SECTION: 文件数据
+* block_pointer[] 只保存部分写入的块：首次部分写入时读入整块（文件大小之后的部分清零），
+* 修改在内存中累积，回写时按物理连续段直接写设备后释放，非 NULL 即为脏块。
+* 写入空洞的块默认延迟分配：只预留空间并建立全零的内存缓存，回写时文件大小已定，
+* 整个文件一次分配、尽量连续，连续创建的小文件也落在相邻位置顺序写出。
+* 一次写入的空洞不少于 NEWFS_DELALLOC_SZ 时立即预分配（连同已有的延迟块），大文件仍直接写设备。
+* 空洞与 fallocate 预分配的未写入块读为零，不读设备；未写入块建立内存缓存或被整块写入时
+* 转为已写，因此有内存缓存的块要么已写、要么延迟分配。
+* 整块对齐的写入不经过内存，直接写到设备上的数据块：后端可按 fd 读写时由
+* fuse_buf_copy 写入 super.fd，请求数据在管道中时内核以 splice 搬运。
+* 读取时脏块从内存复制，其余整块作为 fd 段交给 FUSE 从设备 splice（见 fd 段的块），
+* 不完整的块直接从设备读取。文件数据不经过块缓存，流式读写不会挤出缓存中的元数据块；
+* 直接写设备前丢弃缓存中的旧副本（块可能刚从元数据释放）
+*******************************************************************************/
+#define NEWFS_FILE_MAX_SZ	((int64_t)NEWFS_MAX_BLKS * NEWFS_BLK_SZ)
+
+/**
+ * @brief 逻辑块 lblk 的内存缓存
+ *
+ * @return char* 没有返回 NULL
+ */
+static inline char* newfs_data_cached(struct newfs_inode* inode, int lblk) {
+	return lblk < inode->blk_cap ? inode->block_pointer[lblk] : NULL;
+}
+
+/**
+ * @brief 从逻辑块 lblk 开始映射状态相同（同一 extent 或同一段空洞）的块数，
+ * 不超过 nblks 和 NEWFS_DATA_BATCH_BLKS
+ *
+ * @param inode 文件 inode
+ * @param lblk 起始逻辑块
+ * @param nblks 最多块数
+ * @param by_cache 为 TRUE 时还要求各块是否有内存缓存与首块相同
+ * @return int
+ */
+static int newfs_data_run(struct newfs_inode* inode, int lblk, int nblks, boolean by_cache) {
+	boolean cached = newfs_data_cached(inode, lblk) != NULL;
+	boolean unwritten;
+	int		len;
+	int		run	   = 1;
+
+	newfs_bmap_len(inode, lblk, &len, &unwritten);
+	while (run < nblks && run < len && run < NEWFS_DATA_BATCH_BLKS
+		   && (!by_cache || (newfs_data_cached(inode, lblk + run) != NULL) == cached)) {
+		run++;
+	}
+	return run;
+}
+
+/**
+ * @brief 逻辑块 lblk 在设备上的内容是否有效：已写且不在内存中
+ *
+ * @return int 数据块号，读为零或在内存中时返回 NEWFS_BLK_NONE
+ */
+static int newfs_data_ondisk(struct newfs_inode* inode, int lblk) {
+	boolean unwritten;
+	int		len;
+	int		pblk = newfs_bmap_len(inode, lblk, &len, &unwritten);
+
+	return unwritten || newfs_data_cached(inode, lblk) != NULL ? NEWFS_BLK_NONE : pblk;
+}
+
+/**
+ * @brief pos 处是否为可直接从设备读取的整块：后端支持 fd，块对齐、完整、已写且不在内存中
+ */
+static inline boolean newfs_data_direct(struct newfs_inode* inode, int64_t pos, int64_t end) {
+	return NEWFS_DRIVER->fd_io && pos % NEWFS_BLK_SZ == 0 && end - pos >= NEWFS_BLK_SZ
+		   && newfs_data_ondisk(inode, pos / NEWFS_BLK_SZ) != NEWFS_BLK_NONE;
+}
+
+/**
+ * @brief 从内存直接写一段物理连续的数据块，先丢弃块缓存中的副本
+ *
+ * @param pblk 起始数据块号
+ * @param cnt 块数
+ * @param buf
+ * @return int
+ */
+static int newfs_data_put_mem(int pblk, int cnt, char* buf) {
+	newfs_cache_invalidate(NEWFS_DATA_OFS(pblk) / NEWFS_BLK_SZ, cnt);
+	return newfs_dev_write(NEWFS_DATA_OFS(pblk), buf, NEWFS_BLKS_SZ(cnt));
+}
+
+/**
+ * @brief 将 src 当前位置起的 cnt 块直接写到一段物理连续的数据块，src 随之前移
+ * 后端支持 fd 时由 fuse_buf_copy 写入 super.fd，src 为管道时即 splice；
+ * 否则经中转缓冲区写入
+ *
+ * @param pblk 起始数据块号
+ * @param cnt 块数
+ * @param src
+ * @return int
+ */
+static int newfs_data_put(int pblk, int cnt, struct fuse_bufvec* src) {
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(NEWFS_BLKS_SZ(cnt));
+	ssize_t n;
+	int		ret;
+
+	if (NEWFS_DRIVER->fd_io) {
+		newfs_cache_invalidate(NEWFS_DATA_OFS(pblk) / NEWFS_BLK_SZ, cnt);
+		dst.buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK
+												 | FUSE_BUF_FD_RETRY);
+		dst.buf[0].fd	 = super.fd;
+		dst.buf[0].pos	 = NEWFS_DATA_OFS(pblk);
+		n = fuse_buf_copy(&dst, src, (enum fuse_buf_copy_flags)0);
+		return n == NEWFS_BLKS_SZ(cnt) ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+	}
+
+	dst.buf[0].mem = malloc(NEWFS_BLKS_SZ(cnt));
+	if (dst.buf[0].mem == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	n	= fuse_buf_copy(&dst, src, (enum fuse_buf_copy_flags)0);
+	ret = n == NEWFS_BLKS_SZ(cnt) ? newfs_data_put_mem(pblk, cnt, (char*)dst.buf[0].mem)
+								  : -NEWFS_ERROR_IO;
+	free(dst.buf[0].mem);
+	return ret;
+}
+
+/**
+ * @brief 取逻辑块 lblk 的内存缓存，没有时建立：已写的块读入整块，文件大小之后的部分清零；
+ * 未写入的块建立全零缓存并转为已写；空洞改为延迟分配，预留空间并计入脏数据量
+ *
+ * @param inode 文件 inode
+ * @param lblk 逻辑块号
+ * @return char* 失败返回 NULL
+ */
+static char* newfs_data_buffer(struct newfs_inode* inode, int lblk) {
+	char*	buf	  = newfs_data_cached(inode, lblk);
+	int64_t valid = inode->size - NEWFS_BLKS_SZ(lblk);
+	boolean unwritten;
+	int		pblk;
+	int		len;
+
+	if (buf != NULL) {
+		return buf;
+	}
+	pblk = newfs_bmap_len(inode, lblk, &len, &unwritten);
+	if (pblk == NEWFS_BLK_NONE && newfs_inode_reserve(inode, lblk, 1) != NEWFS_ERROR_NONE) {
+		return NULL;
+	}
+	buf = (char*)calloc(1, NEWFS_BLK_SZ);
+	if (buf == NULL) {
+		goto error;
+	}
+	if (pblk == NEWFS_BLK_NONE) {
+		newfs_mark_dirty(inode, NEWFS_DIRTY_DATA);
+		newfs_dirty_add(inode, NEWFS_BLK_SZ);
+	} else if (unwritten) {
+		if (newfs_inode_convert(inode, lblk, 1) != NEWFS_ERROR_NONE) {
+			goto error;
+		}
+	} else if (valid > 0) {
+		valid = valid < NEWFS_BLK_SZ ? valid : NEWFS_BLK_SZ;
+		if (newfs_dev_read(NEWFS_DATA_OFS(pblk), buf, NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+			goto error;
+		}
+		memset(buf + valid, 0, NEWFS_BLK_SZ - valid);
+	}
+	inode->block_pointer[lblk] = buf;
+	return buf;
+
+error:
+	free(buf);
+	if (pblk == NEWFS_BLK_NONE) {
+		newfs_inode_unreserve(inode, 1);
+	}
+	return NULL;
+}
+
+/**
+ * @brief 文件大小从 from 增大前，把 from 所在的不完整已写块读入内存缓存，使 from 之后
+ * 读为零；其余新增部分是空洞、未写入块或全零的延迟分配块，本来就读为零
+ *
+ * @param inode 文件 inode
+ * @param from 当前文件大小
+ * @return int
+ */
+static int newfs_data_zero(struct newfs_inode* inode, int64_t from) {
+	if (from % NEWFS_BLK_SZ == 0 || newfs_data_ondisk(inode, from / NEWFS_BLK_SZ) == NEWFS_BLK_NONE) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (newfs_data_buffer(inode, from / NEWFS_BLK_SZ) == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_mark_dirty(inode, NEWFS_DIRTY_DATA);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 逻辑块 [lblk, lblk + cnt) 中空洞（既未映射也不在内存中）的块数
+ */
+static int newfs_data_holes(struct newfs_inode* inode, int lblk, int cnt) {
+	boolean unwritten;
+	int		holes = 0;
+	int		end	  = lblk + cnt;
+	int		len;
+
+	while (lblk < end) {
+		if (newfs_bmap_len(inode, lblk, &len, &unwritten) == NEWFS_BLK_NONE) {
+			for (int i = lblk; i < lblk + len && i < end; i++) {
+				holes += newfs_data_cached(inode, i) == NULL;
+			}
+		}
+		lblk += len;
+	}
+	return holes;
+}
+
+/**
+ * @brief 将文件 [pos, pos + len) 的内容复制到 dst，调用者保证不超过文件大小
+ * 内存中的块直接复制，空洞与未写入的块填零，其余按物理连续段直接从设备读取
+ *
+ * @param inode 文件 inode
+ * @param dst
+ * @param pos 文件内偏移
+ * @param len
+ * @return int
+ */
+static int newfs_data_copy(struct newfs_inode* inode, char* dst, int64_t pos, int64_t len) {
+	int64_t end = pos + len;
+	int64_t n;
+	char*	buf;
+	int		lblk;
+	int		bias;
+	int		pblk;
+	int		run;
+
+	while (pos < end) {
+		lblk = pos / NEWFS_BLK_SZ;
+		bias = pos % NEWFS_BLK_SZ;
+		buf	 = newfs_data_cached(inode, lblk);
+		if (buf != NULL) {
+			n = NEWFS_BLK_SZ - bias < end - pos ? NEWFS_BLK_SZ - bias : end - pos;
+			memcpy(dst, buf + bias, n);
+		} else {
+			run	 = newfs_data_run(inode, lblk, (end - 1) / NEWFS_BLK_SZ - lblk + 1, TRUE);
+			n	 = NEWFS_BLKS_SZ(run) - bias < end - pos ? NEWFS_BLKS_SZ(run) - bias : end - pos;
+			pblk = newfs_data_ondisk(inode, lblk);
+			if (pblk == NEWFS_BLK_NONE) {
+				memset(dst, 0, n);
+			} else if (newfs_dev_pread(NEWFS_DATA_OFS(pblk) + bias, dst, n) != NEWFS_ERROR_NONE) {
+				return -NEWFS_ERROR_IO;
+			}
+		}
+		dst += n;
+		pos += n;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/******************************************************************************
+* SECTION: fd 段的块
+* 读回复中的 fd 段在 read_buf 返回后才由 FUSE 从设备读取，期间不持任何锁。
+* 每个线程同时只处理一个请求：返回 fd 段前在本线程登记 pin（打开句柄与当前代数），
+* 本线程进入下一个操作、低层接口发送回复后、句柄关闭（内核在该句柄上的读均已回复）
+* 或线程退出时放下。释放的块在事务提交后记下提交时的代数，此前登记的 pin 全部放下后
+* 才归还分配器（newfs_free_defer_end），fd 段指向的块因此不会在回复前被分给其他文件
+*******************************************************************************/
+struct newfs_pin {
+	struct newfs_fh*  fh;		// 登记时的打开句柄，NULL 为未登记
+	unsigned long	  gen;		// 登记时的代数
+	struct newfs_pin* next;
+};
+
+static pthread_mutex_t	 pin_lock = PTHREAD_MUTEX_INITIALIZER;	// 保护 pins 链表
+static struct newfs_pin* pins	  = NULL;
+static unsigned long	 pin_gen  = 1;
+static pthread_key_t	 pin_key;
+static pthread_once_t	 pin_once = PTHREAD_ONCE_INIT;
+static __thread struct newfs_pin* pin_self = NULL;
+
+/**
+ * @brief 线程退出时摘除本线程的 pin
+ *
+ * @param arg
+ */
+static void newfs_pin_exit(void* arg) {
+	struct newfs_pin*  pin = (struct newfs_pin*)arg;
+	struct newfs_pin** pos;
+
+	pthread_mutex_lock(&pin_lock);
+	for (pos = &pins; *pos != NULL; pos = &(*pos)->next) {
+		if (*pos == pin) {
+			*pos = pin->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pin_lock);
+	free(pin);
+}
+
+static void newfs_pin_key_init() {
+	pthread_key_create(&pin_key, newfs_pin_exit);
+}
+
+/**
+ * @brief 本线程以句柄 fh 登记 pin，调用者持 inode 读锁，此后释放的块等到 pin 放下才会复用
+ *
+ * @param fh 打开的句柄
+ * @return boolean 内存不足时返回 FALSE，不能返回 fd 段
+ */
+static boolean newfs_data_pin(struct newfs_fh* fh) {
+	struct newfs_pin* pin = pin_self;
+
+	if (pin == NULL) {
+		pthread_once(&pin_once, newfs_pin_key_init);
+		pin = (struct newfs_pin*)calloc(1, sizeof(struct newfs_pin));
+		if (pin == NULL) {
+			return FALSE;
+		}
+		pthread_mutex_lock(&pin_lock);
+		pin->next = pins;
+		pins	  = pin;
+		pthread_mutex_unlock(&pin_lock);
+		pthread_setspecific(pin_key, pin);
+		pin_self = pin;
+	}
+	__atomic_store_n(&pin->gen, __atomic_load_n(&pin_gen, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	__atomic_store_n(&pin->fh, fh, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+/**
+ * @brief 放下本线程的 pin：上一个请求的回复已发送，在每个操作入口调用
+ */
+void newfs_data_unpin() {
+	if (pin_self != NULL && __atomic_load_n(&pin_self->fh, __ATOMIC_RELAXED) != NULL) {
+		__atomic_store_n(&pin_self->fh, NULL, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * @brief 句柄关闭时放下以它登记的 pin，这些线程可能一直空闲，不会进入下一个操作
+ *
+ * @param fh
+ */
+static void newfs_data_unpin_fh(struct newfs_fh* fh) {
+	struct newfs_fh* expect;
+
+	pthread_mutex_lock(&pin_lock);
+	for (struct newfs_pin* pin = pins; pin != NULL; pin = pin->next) {
+		expect = fh;
+		__atomic_compare_exchange_n(&pin->fh, &expect, NULL, FALSE,
+									__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&pin_lock);
+}
+
+/**
+ * @brief 推进代数，返回新代数：此前登记的 pin 代数都小于它
+ *
+ * @return unsigned long
+ */
+unsigned long newfs_data_pin_gen() {
+	return __atomic_add_fetch(&pin_gen, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * @brief 仍登记着的 pin 中最小的代数，代数不大于它的块可以复用
+ *
+ * @return unsigned long 没有 pin 时返回 ULONG_MAX
+ */
+unsigned long newfs_data_pin_oldest() {
+	unsigned long oldest = ULONG_MAX;
+	unsigned long gen;
+
+	pthread_mutex_lock(&pin_lock);
+	for (struct newfs_pin* pin = pins; pin != NULL; pin = pin->next) {
+		if (__atomic_load_n(&pin->fh, __ATOMIC_ACQUIRE) == NULL) {
+			continue;
+		}
+		gen	   = __atomic_load_n(&pin->gen, __ATOMIC_RELAXED);
+		oldest = gen < oldest ? gen : oldest;
+	}
+	pthread_mutex_unlock(&pin_lock);
+	return oldest;
+}
+
+/**
+ * @brief 读文件数据到内存
+ *
+ * @param inode 文件 inode
+ * @param buf
+ * @param size
+ * @param off 文件内偏移
+ * @return int 读取字节数，失败返回负的错误码
+ */
+int newfs_data_read(struct newfs_inode* inode, char* buf, size_t size, off_t off) {
+	int ret = NEWFS_ERROR_NONE;
+
+	newfs_inode_rdlock(inode);
+	if (off >= inode->size) {
+		size = 0;
+	} else if ((int64_t)size > inode->size - off) {
+		size = inode->size - off;
+	}
+	if (size > 0) {
+		ret = newfs_data_copy(inode, buf, off, size);
+	}
+	newfs_inode_unlock(inode);
+	return ret != NEWFS_ERROR_NONE ? ret : (int)size;
+}
+
+/**
+ * @brief 读文件数据到 fuse_bufvec，不超过文件大小
+ * fh 非 NULL 时，可直接从设备读取的整块按物理连续段作为 fd 段，由 FUSE 从 super.fd
+ * splice 给内核，其余部分合并为内存段。fd 段在返回后才被读取，本线程以 fh 登记 pin，
+ * 这些块在放下前不会被截断或打洞释放后分给其他文件（见 fd 段的块）；返回前解锁。
+ * fh 为 NULL 时全部复制为内存段。
+ * 内存段与 bufvec 由调用者用 newfs_data_buf_free 释放（与 fuse_free_buf 一致）
+ *
+ * @param inode 文件 inode
+ * @param bufp 返回的 bufvec
+ * @param size
+ * @param off 文件内偏移
+ * @param fh 读取所用的打开句柄，NULL 时不返回 fd 段
+ * @return int
+ */
+int newfs_data_read_buf(struct newfs_inode* inode, struct fuse_bufvec** bufp,
+						size_t size, off_t off, struct newfs_fh* fh) {
+	struct fuse_bufvec* bufv;
+	struct fuse_buf*	seg;
+	int64_t pos = off;
+	int64_t end;
+	int64_t from;
+	int		run;
+	int		ret = NEWFS_ERROR_NONE;
+	boolean pin;
+
+	newfs_inode_rdlock(inode);
+	pin = fh != NULL && NEWFS_DRIVER->fd_io && newfs_data_pin(fh);
+	if (off >= inode->size) {
+		size = 0;
+	} else if ((int64_t)size > inode->size - off) {
+		size = inode->size - off;
+	}
+	end = off + size;
+
+	// 除首尾外每段至少一整块
+	bufv = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec)
+									   + (size / NEWFS_BLK_SZ + 2) * sizeof(struct fuse_buf));
+	if (bufv == NULL) {
+		newfs_inode_unlock(inode);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	while (pos < end) {
+		seg = &bufv->buf[bufv->count++];
+		if (pin && newfs_data_direct(inode, pos, end)) {
+			run		   = newfs_data_run(inode, pos / NEWFS_BLK_SZ,
+										(end - pos) / NEWFS_BLK_SZ, TRUE);
+			seg->size  = NEWFS_BLKS_SZ(run);
+			seg->flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK
+											   | FUSE_BUF_FD_RETRY);
+			seg->fd	   = super.fd;
+			seg->pos   = NEWFS_DATA_OFS(newfs_bmap(inode, pos / NEWFS_BLK_SZ));
+			pos		  += seg->size;
+			continue;
+		}
+		// 到下一个可直接读取的整块为止
+		from = pos;
+		do {
+			pos = ROUND_DOWN(pos, NEWFS_BLK_SZ) + NEWFS_BLK_SZ;
+		} while (pos < end && !(pin && newfs_data_direct(inode, pos, end)));
+		pos		  = pos < end ? pos : end;
+		seg->size = pos - from;
+		seg->fd	  = -1;
+		seg->mem  = malloc(seg->size);
+		if (seg->mem == NULL) {
+			ret = -NEWFS_ERROR_NOSPACE;
+			break;
+		}
+		ret = newfs_data_copy(inode, (char*)seg->mem, from, seg->size);
+		if (ret != NEWFS_ERROR_NONE) {
+			break;
+		}
+	}
+	newfs_inode_unlock(inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		newfs_data_buf_free(bufv);
+		return ret;
+	}
+	if (bufv->count == 0) {
+		bufv->count		  = 1;
+		bufv->buf[0].fd	  = -1;
+	}
+	*bufp = bufv;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放 newfs_data_read_buf 返回的 bufvec
+ *
+ * @param bufv
+ */
+void newfs_data_buf_free(struct fuse_bufvec* bufv) {
+	for (size_t i = 0; i < bufv->count; i++) {
+		if (!(bufv->buf[i].flags & FUSE_BUF_IS_FD)) {
+			free(bufv->buf[i].mem);
+		}
+	}
+	free(bufv);
+}
+
+/**
+ * @brief 写文件数据
+ * 落在已分配块上的整块对齐部分按物理连续段直接写设备（未写入的块随之转为已写），
+ * 首尾不完整的块与空洞在内存缓存中读改写；空洞较多时先预分配
+ *
+ * @param inode 文件 inode
+ * @param src 写入内容，可以是内存或管道
+ * @param off 文件内偏移
+ * @return int 写入字节数，失败返回负的错误码
+ */
+int newfs_data_write_buf(struct newfs_inode* inode, struct fuse_bufvec* src, off_t off) {
+	struct fuse_bufvec dst;
+	int64_t size = fuse_buf_size(src);
+	int64_t end	 = off + size;
+	int64_t pos	 = off;
+	int64_t len;
+	int64_t nblks;
+	boolean unwritten;
+	char*	buf;
+	int		lblk;
+	int		pblk;
+	int		run;
+	int		ret	 = NEWFS_ERROR_NONE;
+
+	if (size == 0) {
+		return 0;
+	}
+	if (off < 0) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (end > NEWFS_FILE_MAX_SZ) {
+		return -NEWFS_ERROR_FBIG;
+	}
+
+	newfs_inode_wrlock(inode);
+	if (off > inode->size) {
+		ret = newfs_data_zero(inode, inode->size);
+	}
+	// 连同紧挨在前面的延迟分配块一起预分配，尽量连续；失败时退回逐块延迟分配，
+	// 空间不足由其报告
+	lblk  = off / NEWFS_BLK_SZ;
+	nblks = (end + NEWFS_BLK_SZ - 1) / NEWFS_BLK_SZ;
+	if (ret == NEWFS_ERROR_NONE
+		&& NEWFS_BLKS_SZ(newfs_data_holes(inode, lblk, nblks - lblk)) >= NEWFS_DELALLOC_SZ) {
+		while (lblk > 0 && newfs_data_cached(inode, lblk - 1) != NULL
+			   && newfs_bmap(inode, lblk - 1) == NEWFS_BLK_NONE) {
+			lblk--;
+		}
+		newfs_inode_prealloc(inode, lblk, nblks - lblk);
+	}
+	while (ret == NEWFS_ERROR_NONE && pos < end) {
+		lblk = pos / NEWFS_BLK_SZ;
+		pblk = newfs_bmap_len(inode, lblk, &run, &unwritten);
+		if (pos % NEWFS_BLK_SZ == 0 && end - pos >= NEWFS_BLK_SZ && pblk != NEWFS_BLK_NONE) {
+			// 已分配的整块覆盖，内存中的旧内容作废
+			run = run < (end - pos) / NEWFS_BLK_SZ ? run : (end - pos) / NEWFS_BLK_SZ;
+			run = run < NEWFS_DATA_BATCH_BLKS ? run : NEWFS_DATA_BATCH_BLKS;
+			for (int i = lblk; i < lblk + run && i < inode->blk_cap; i++) {
+				free(inode->block_pointer[i]);
+				inode->block_pointer[i] = NULL;
+			}
+			ret = newfs_data_put(pblk, run, src);
+			if (ret == NEWFS_ERROR_NONE && unwritten) {
+				ret = newfs_inode_convert(inode, lblk, run);
+			}
+			if (ret == NEWFS_ERROR_NONE) {
+				pos += NEWFS_BLKS_SZ(run);
+			}
+			continue;
+		}
+		len = NEWFS_BLK_SZ - pos % NEWFS_BLK_SZ;
+		len = len < end - pos ? len : end - pos;
+		buf = newfs_data_buffer(inode, lblk);
+		if (buf == NULL) {
+			ret = -NEWFS_ERROR_NOSPACE;
+			break;
+		}
+		dst = FUSE_BUFVEC_INIT(len);
+		dst.buf[0].mem = buf + pos % NEWFS_BLK_SZ;
+		if (fuse_buf_copy(&dst, src, (enum fuse_buf_copy_flags)0) != len) {
+			ret = -NEWFS_ERROR_IO;
+			break;
+		}
+		newfs_mark_dirty(inode, NEWFS_DIRTY_DATA);
+		pos += len;
+	}
+	if (pos > inode->size) {
+		inode->size = pos;
+		newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	}
+	newfs_inode_unlock(inode);
+	return pos > off ? (int)(pos - off) : ret;
+}
+
+/**
+ * @brief 修改文件大小
+ * 不增大时释放新大小之后的块（包括 KEEP_SIZE 预分配的块），最后一个不完整块若在内存中
+ * 则将新大小之后的部分清零；增大时新增部分为空洞，不分配块
+ *
+ * @param inode 文件 inode
+ * @param size 新大小
+ * @return int
+ */
+int newfs_data_truncate(struct newfs_inode* inode, off_t size) {
+	int64_t nblks = (size + NEWFS_BLK_SZ - 1) / NEWFS_BLK_SZ;
+	char*	buf;
+	int		ret	  = NEWFS_ERROR_NONE;
+
+	if (size < 0) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (size > NEWFS_FILE_MAX_SZ) {
+		return -NEWFS_ERROR_FBIG;
+	}
+
+	newfs_inode_wrlock(inode);
+	if (size <= inode->size) {
+		newfs_inode_shrink(inode, nblks);
+		buf = newfs_data_cached(inode, size / NEWFS_BLK_SZ);
+		if (buf != NULL && size % NEWFS_BLK_SZ != 0) {
+			memset(buf + size % NEWFS_BLK_SZ, 0, NEWFS_BLK_SZ - size % NEWFS_BLK_SZ);
+		}
+	} else if (size > inode->size) {
+		ret = newfs_data_zero(inode, inode->size);
+	}
+	if (ret == NEWFS_ERROR_NONE && size != inode->size) {
+		inode->size = size;
+		inode->blks = nblks > inode->blks ? nblks : inode->blks;
+		newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	}
+	newfs_inode_unlock(inode);
+	return ret;
+}
+
+/**
+ * @brief 清零文件 [pos, pos + len) 的内容，范围在同一块内；读为零的块无需处理
+ *
+ * @param inode 文件 inode
+ * @param pos 文件内偏移
+ * @param len
+ * @return int
+ */
+static int newfs_data_clear(struct newfs_inode* inode, int64_t pos, int64_t len) {
+	int	  lblk = pos / NEWFS_BLK_SZ;
+	char* buf  = newfs_data_cached(inode, lblk);
+
+	if (buf == NULL && newfs_data_ondisk(inode, lblk) == NEWFS_BLK_NONE) {
+		return NEWFS_ERROR_NONE;
+	}
+	buf = newfs_data_buffer(inode, lblk);
+	if (buf == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	memset(buf + pos % NEWFS_BLK_SZ, 0, len);
+	newfs_mark_dirty(inode, NEWFS_DIRTY_DATA);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在文件中打洞：[from, to) 内的整块解除映射并释放，首尾不完整的部分清零
+ *
+ * @param inode 文件 inode
+ * @param from
+ * @param to
+ * @return int
+ */
+static int newfs_data_punch(struct newfs_inode* inode, int64_t from, int64_t to) {
+	int first = (from + NEWFS_BLK_SZ - 1) / NEWFS_BLK_SZ;
+	int last;
+	int ret	  = NEWFS_ERROR_NONE;
+
+	to	 = to < NEWFS_BLKS_SZ(inode->blks) ? to : NEWFS_BLKS_SZ(inode->blks);
+	last = to / NEWFS_BLK_SZ;
+	if (from >= to) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (first < last) {
+		ret = newfs_inode_punch(inode, first, last - first);
+	}
+	if (ret == NEWFS_ERROR_NONE && from % NEWFS_BLK_SZ != 0) {
+		ret = newfs_data_clear(inode, from,
+							   (NEWFS_BLKS_SZ(first) < to ? NEWFS_BLKS_SZ(first) : to) - from);
+	}
+	if (ret == NEWFS_ERROR_NONE && to % NEWFS_BLK_SZ != 0 && last >= first) {
+		ret = newfs_data_clear(inode, NEWFS_BLKS_SZ(last), to - NEWFS_BLKS_SZ(last));
+	}
+	return ret;
+}
+
+/**
+ * @brief 为文件预分配空间或打洞（fallocate）
+ * 预分配为 [off, off + len) 中的空洞分配尽量连续的块，标记为未写入，读为零，不在设备上
+ * 写零；带 FALLOC_FL_KEEP_SIZE 时不改变文件大小。FALLOC_FL_PUNCH_HOLE 须与 KEEP_SIZE
+ * 一起使用，其余模式不支持
+ *
+ * @param inode 文件 inode
+ * @param mode FALLOC_FL_* 的组合
+ * @param off 文件内偏移
+ * @param len 长度
+ * @return int
+ */
+int newfs_data_fallocate(struct newfs_inode* inode, int mode, off_t off, off_t len) {
+	int64_t end = off + len;
+	int		ret;
+
+	if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0
+		|| ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))) {
+		return -NEWFS_ERROR_NOTSUP;
+	}
+	if (off < 0 || len <= 0) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (off > NEWFS_FILE_MAX_SZ || len > NEWFS_FILE_MAX_SZ - off) {
+		return -NEWFS_ERROR_FBIG;
+	}
+
+	newfs_inode_wrlock(inode);
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		ret = newfs_data_punch(inode, off, end);
+	} else {
+		ret = newfs_inode_prealloc(inode, off / NEWFS_BLK_SZ,
+								   (end + NEWFS_BLK_SZ - 1) / NEWFS_BLK_SZ - off / NEWFS_BLK_SZ);
+		if (ret == NEWFS_ERROR_NONE && !(mode & FALLOC_FL_KEEP_SIZE) && end > inode->size) {
+			ret = newfs_data_zero(inode, inode->size);
+			if (ret == NEWFS_ERROR_NONE) {
+				inode->size = end;
+				newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+			}
+		}
+	}
+	newfs_inode_unlock(inode);
+	return ret;
+}
+
+/**
+ * @brief 将内存中的脏块按物理连续段写回设备并释放，调用者持有 inode 写锁
+ * 延迟分配的块已由 newfs_sync_data 分配物理块
+ *
+ * @param inode 文件 inode
+ * @return int
+ */
+int newfs_data_sync(struct newfs_inode* inode) {
+	char* blk_buf = NULL;
+	int	  run;
+	int	  ret	  = NEWFS_ERROR_NONE;
+
+	for (int lblk = 0; lblk < inode->blks && lblk < inode->blk_cap; lblk += run) {
+		if (inode->block_pointer[lblk] == NULL) {
+			run = 1;
+			continue;
+		}
+		run = newfs_data_run(inode, lblk, inode->blks - lblk, TRUE);
+		if (run == 1) {
+			ret = newfs_data_put_mem(newfs_bmap(inode, lblk), 1, inode->block_pointer[lblk]);
+		} else {
+			if (blk_buf == NULL) {
+				blk_buf = (char*)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_BATCH_BLKS));
+				if (blk_buf == NULL) {
+					return -NEWFS_ERROR_NOSPACE;
+				}
+			}
+			for (int i = 0; i < run; i++) {
+				memcpy(blk_buf + NEWFS_BLKS_SZ(i), inode->block_pointer[lblk + i], NEWFS_BLK_SZ);
+			}
+			ret = newfs_data_put_mem(newfs_bmap(inode, lblk), run, blk_buf);
+		}
+		if (ret != NEWFS_ERROR_NONE) {
+			break;
+		}
+		for (int i = lblk; i < lblk + run; i++) {
+			free(inode->block_pointer[i]);
+			inode->block_pointer[i] = NULL;
+		}
+	}
+	free(blk_buf);
+	return ret;
+}
+
+/**
+ * @brief 预读逻辑块 [lblk, lblk + cnt)，超出文件的部分、内存中的块与读为零的块跳过，
+ * 调用者持 inode 读锁
+ * 整块由 FUSE 从 super.fd splice，预读进内核页缓存（POSIX_FADV_WILLNEED，内核异步读入）。
+ * 文件数据不经过块缓存，预读只在后端支持 fd 时启动（newfs_ra_start）
+ *
+ * @param inode 文件 inode
+ * @param lblk 起始逻辑块
+ * @param cnt 块数
+ */
+void newfs_data_prefetch(struct newfs_inode* inode, int lblk, int cnt) {
+	int end = lblk + cnt < inode->blks ? lblk + cnt : inode->blks;
+	int pblk;
+	int run;
+
+	for (; lblk < end; lblk += run) {
+		run	 = newfs_data_run(inode, lblk, end - lblk, TRUE);
+		pblk = newfs_data_ondisk(inode, lblk);
+		if (pblk == NEWFS_BLK_NONE) {
+			continue;
+		}
+		posix_fadvise(super.fd, NEWFS_DATA_OFS(pblk), NEWFS_BLKS_SZ(run), POSIX_FADV_WILLNEED);
+	}
+}
+
+/**
+ * @brief 协商数据通路：允许大于一页的写请求；后端支持 fd 时请求内核经管道收发数据，
+ * 读回复中的 fd 段由内核 splice，写请求以管道交给 write_buf 再 splice 到设备
+ *
+ * @param conn
+ */
+void newfs_data_conn_init(struct fuse_conn_info* conn) {
+	conn->want |= conn->capable & FUSE_CAP_BIG_WRITES;
+	if (NEWFS_DRIVER->fd_io) {
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE
+									   | FUSE_CAP_SPLICE_MOVE);
+	}
+}
+
+/******************************************************************************
+* SECTION: 打开的文件
+* open / create 解析一次路径并持有 inode，之后的读写经 fi->fh 中的句柄直接取得 inode；
+* 文件被删除后 inode 留在内存中，句柄仍可读写，最后一次 release 时释放
+*******************************************************************************/
+/**
+ * @brief 为文件 inode 建立打开句柄，调用者持命名空间读锁
+ *
+ * @param inode 文件 inode
+ * @return struct newfs_fh* 内存不足返回 NULL
+ */
+struct newfs_fh* newfs_fh_open(struct newfs_inode* inode) {
+	struct newfs_fh* fh = (struct newfs_fh*)malloc(sizeof(struct newfs_fh));
+
+	if (fh == NULL) {
+		return NULL;
+	}
+	fh->inode	= inode;
+	fh->ra_pos	= 0;
+	fh->ra_win	= 0;
+	fh->ra_next = 0;
+	pthread_mutex_init(&fh->ra_lock, NULL);
+	newfs_inode_hold(inode);
+	return fh;
+}
+
+/**
+ * @brief 关闭句柄，放下以它登记的 pin 与 inode，调用者持命名空间读锁
+ *
+ * @param fh
+ */
+void newfs_fh_close(struct newfs_fh* fh) {
+	newfs_data_unpin_fh(fh);
+	newfs_inode_put(fh->inode);
+	pthread_mutex_destroy(&fh->ra_lock);
+	free(fh);
+}
@@ -0,0 +1,270 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 路径缓存
+* 以完整路径为键缓存 newfs_lookup 的结果，包括“父目录存在但文件不存在”的负缓存
+* 创建时删除对应路径的项，删除时通过代数整体失效
+* 桶按哈希分段加锁；代数只在持命名空间写锁时改变，缓存的 dentry 在读锁期间有效。
+* 负缓存项在持父目录读锁时插入，与同一目录下的创建互斥，不会插入过期的负缓存
+*******************************************************************************/
+#define NEWFS_DCACHE_BUCKETS	16384
+#define NEWFS_DCACHE_MAX		65536
+#define NEWFS_DCACHE_LOCKS		64
+
+struct newfs_dcache_entry {
+	char*					path;
+	int						len;
+	unsigned int			hash;
+	unsigned int			gen;
+	struct newfs_dentry*	dentry;		// 命中为目标 dentry，负缓存为父目录 dentry
+	boolean					is_find;
+	boolean					is_root;
+	struct newfs_dcache_entry* next;
+};
+
+static struct newfs_dcache_entry* buckets[NEWFS_DCACHE_BUCKETS];
+static unsigned int gen   = 0;
+static int			count = 0;
+static pthread_mutex_t locks[NEWFS_DCACHE_LOCKS];
+static pthread_once_t  locks_once = PTHREAD_ONCE_INIT;
+
+static void newfs_dcache_free_entry(struct newfs_dcache_entry* entry) {
+	free(entry->path);
+	free(entry);
+	__atomic_sub_fetch(&count, 1, __ATOMIC_RELAXED);
+}
+
+static void newfs_dcache_init_locks() {
+	for (int i = 0; i < NEWFS_DCACHE_LOCKS; i++) {
+		pthread_mutex_init(&locks[i], NULL);
+	}
+}
+
+/**
+ * @brief 哈希值所在桶对应的锁
+ * 
+ * @param hash 
+ * @return pthread_mutex_t* 
+ */
+static pthread_mutex_t* newfs_dcache_lock(unsigned int hash) {
+	pthread_once(&locks_once, newfs_dcache_init_locks);
+	return &locks[hash % NEWFS_DCACHE_BUCKETS % NEWFS_DCACHE_LOCKS];
+}
+
+/**
+ * @brief 查找路径缓存，顺带清理链上过期的项
+ * 
+ * @param path 完整路径
+ * @param is_find 是否找到
+ * @param is_root 是否为根目录
+ * @return struct newfs_dentry* 未缓存返回 NULL
+ */
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find, boolean* is_root) {
+	int len = strlen(path);
+	unsigned int hash = newfs_name_hash(path, len);
+	struct newfs_dcache_entry** pos = &buckets[hash % NEWFS_DCACHE_BUCKETS];
+	struct newfs_dcache_entry*  entry;
+	struct newfs_dentry*		dentry = NULL;
+	pthread_mutex_t*			lock   = newfs_dcache_lock(hash);
+
+	pthread_mutex_lock(lock);
+	while ((entry = *pos) != NULL) {
+		if (entry->gen != gen) {
+			*pos = entry->next;
+			newfs_dcache_free_entry(entry);
+			continue;
+		}
+		if (entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0) {
+			*is_find = entry->is_find;
+			*is_root = entry->is_root;
+			dentry	 = entry->dentry;
+			break;
+		}
+		pos = &entry->next;
+	}
+	pthread_mutex_unlock(lock);
+	return dentry;
+}
+
+/**
+ * @brief 加入路径缓存，项数超过上限时整体清空
+ * 多个线程可能同时未命中并插入同一路径，已有同路径的项时就地更新，保证每个路径只有一项
+ * 
+ * @param path 完整路径
+ * @param dentry newfs_lookup 的返回值
+ * @param is_find 
+ * @param is_root 
+ */
+void newfs_dcache_insert(const char* path, struct newfs_dentry* dentry,
+						 boolean is_find, boolean is_root) {
+	int len = strlen(path);
+	unsigned int hash = newfs_name_hash(path, len);
+	struct newfs_dcache_entry** bucket = &buckets[hash % NEWFS_DCACHE_BUCKETS];
+	struct newfs_dcache_entry*  entry;
+	pthread_mutex_t*			lock = newfs_dcache_lock(hash);
+
+	if (__atomic_load_n(&count, __ATOMIC_RELAXED) >= NEWFS_DCACHE_MAX) {
+		newfs_dcache_clear();
+	}
+	pthread_mutex_lock(lock);
+	for (entry = *bucket; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0) {
+			break;
+		}
+	}
+	if (entry == NULL) {
+		entry = (struct newfs_dcache_entry*)malloc(sizeof(struct newfs_dcache_entry));
+		if (entry == NULL) {
+			pthread_mutex_unlock(lock);
+			return;
+		}
+		entry->path = (char*)malloc(len + 1);
+		if (entry->path == NULL) {
+			free(entry);
+			pthread_mutex_unlock(lock);
+			return;
+		}
+		memcpy(entry->path, path, len + 1);
+		entry->len	= len;
+		entry->hash	= hash;
+		entry->next	= *bucket;
+		*bucket		= entry;
+		__atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+	}
+	entry->gen		= gen;
+	entry->dentry	= dentry;
+	entry->is_find	= is_find;
+	entry->is_root	= is_root;
+	pthread_mutex_unlock(lock);
+}
+
+/**
+ * @brief 删除某个路径的缓存项，创建文件或目录后调用
+ * 
+ * @param path 完整路径
+ */
+void newfs_dcache_remove(const char* path) {
+	int len = strlen(path);
+	unsigned int hash = newfs_name_hash(path, len);
+	struct newfs_dcache_entry** pos = &buckets[hash % NEWFS_DCACHE_BUCKETS];
+	struct newfs_dcache_entry*  entry;
+	pthread_mutex_t*			lock = newfs_dcache_lock(hash);
+
+	pthread_mutex_lock(lock);
+	while ((entry = *pos) != NULL) {
+		if (entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0) {
+			*pos = entry->next;
+			newfs_dcache_free_entry(entry);
+			break;
+		}
+		pos = &entry->next;
+	}
+	pthread_mutex_unlock(lock);
+}
+
+/**
+ * @brief 由 dentry 拼出完整路径
+ * 
+ * @param dentry 
+ * @return char* 需要调用者释放，内存不足返回 NULL
+ */
+static char* newfs_dcache_path(struct newfs_dentry* dentry) {
+	struct newfs_dentry* cursor;
+	char* path;
+	int   len = 0;
+	int   pos;
+
+	for (cursor = dentry; cursor->parent != NULL; cursor = cursor->parent) {
+		len += strlen(cursor->fname) + 1;
+	}
+	path = (char*)malloc(len + 1);
+	if (path == NULL) {
+		return NULL;
+	}
+	path[len] = '\0';
+	pos = len;
+	for (cursor = dentry; cursor->parent != NULL; cursor = cursor->parent) {
+		int flen = strlen(cursor->fname);
+		pos -= flen;
+		memcpy(path + pos, cursor->fname, flen);
+		path[--pos] = '/';
+	}
+	return path;
+}
+
+/**
+ * @brief 删除文件或空目录后使其缓存项失效，调用者持命名空间写锁，dentry 尚未释放
+ * 文件只有自身路径一项；空目录下只可能有以它为父目录的负缓存项，
+ * 名字未知，按 dentry 遍历整个缓存删除。其他路径的缓存项不受影响
+ * 
+ * @param dentry 被删除的 dentry
+ */
+void newfs_dcache_drop(struct newfs_dentry* dentry) {
+	struct newfs_dcache_entry** pos;
+	struct newfs_dcache_entry*  entry;
+	char* path;
+
+	if (__atomic_load_n(&count, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+	if (dentry->ftype != NEWFS_DIR) {
+		path = newfs_dcache_path(dentry);
+		if (path != NULL) {
+			newfs_dcache_remove(path);
+			free(path);
+			return;
+		}
+		// 拼不出路径时退回按 dentry 遍历
+	}
+
+	pthread_once(&locks_once, newfs_dcache_init_locks);
+	for (int i = 0; i < NEWFS_DCACHE_BUCKETS; i++) {
+		pthread_mutex_t* lock = &locks[i % NEWFS_DCACHE_LOCKS];
+
+		if (buckets[i] == NULL) {
+			continue;
+		}
+		pthread_mutex_lock(lock);
+		pos = &buckets[i];
+		while ((entry = *pos) != NULL) {
+			if (entry->dentry == dentry) {
+				*pos = entry->next;
+				newfs_dcache_free_entry(entry);
+				continue;
+			}
+			pos = &entry->next;
+		}
+		pthread_mutex_unlock(lock);
+	}
+}
+
+/**
+ * @brief 使所有缓存项失效，重命名或 dentry 被释放时调用，调用者持命名空间写锁
+ * 过期项在之后的查找中顺带回收
+ */
+void newfs_dcache_invalidate() {
+	gen++;
+}
+
+/**
+ * @brief 释放所有缓存项
+ */
+void newfs_dcache_clear() {
+	struct newfs_dcache_entry* entry;
+	struct newfs_dcache_entry* next;
+
+	pthread_once(&locks_once, newfs_dcache_init_locks);
+	for (int i = 0; i < NEWFS_DCACHE_LOCKS; i++) {
+		pthread_mutex_lock(&locks[i]);
+	}
+	for (int i = 0; i < NEWFS_DCACHE_BUCKETS; i++) {
+		for (entry = buckets[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			newfs_dcache_free_entry(entry);
+		}
+		buckets[i] = NULL;
+	}
+	for (int i = NEWFS_DCACHE_LOCKS - 1; i >= 0; i--) {
+		pthread_mutex_unlock(&locks[i]);
+	}
+}
@@ -1,10 +1,17 @@
 #include "../include/newfs.h"
 
+/* 大设备的 inode 位图可达数十 MB，只打印开头部分 */
+#define NEWFS_DUMP_MAP_BYTES 128
+
 void newfs_dump_map() {
     int byte_cursor = 0;
     int bit_cursor = 0;
+    int64_t map_bytes = NEWFS_BLKS_SZ(super.map_inode_blks);
 
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(super.map_inode_blks); 
+    if (map_bytes > NEWFS_DUMP_MAP_BYTES) {
+        map_bytes = NEWFS_DUMP_MAP_BYTES;
+    }
+    for (byte_cursor = 0; byte_cursor < map_bytes; 
          byte_cursor+=4)
     {
         for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
@@ -0,0 +1,206 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 目录哈希索引
+* 每个已加载的目录 inode 维护一张以文件名为键的链式哈希表，
+* 与 dentrys 兄弟链表同步增删，查找时按完整长度比较文件名
+*******************************************************************************/
+#define NEWFS_DIR_HASH_MIN	8
+
+/**
+ * @brief FNV-1a 哈希
+ * 
+ * @param name 文件名
+ * @param len 长度
+ * @return unsigned int 
+ */
+unsigned int newfs_name_hash(const char* name, int len) {
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * @brief 按新容量重建哈希表
+ */
+static int newfs_dir_index_resize(struct newfs_inode* inode, int size) {
+	struct newfs_dentry** htab = (struct newfs_dentry**)calloc(size, sizeof(struct newfs_dentry*));
+	struct newfs_dentry*  dentry;
+	struct newfs_dentry*  next;
+
+	if (htab == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	for (int i = 0; i < inode->dhash_sz; i++) {
+		for (dentry = inode->dhash[i]; dentry != NULL; dentry = next) {
+			next = dentry->hash_next;
+			dentry->hash_next = htab[dentry->hash & (size - 1)];
+			htab[dentry->hash & (size - 1)] = dentry;
+		}
+	}
+	free(inode->dhash);
+	inode->dhash	= htab;
+	inode->dhash_sz = size;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 按预计目录项数初始化哈希表，加载目录时调用以避免反复扩容
+ * 
+ * @param inode 目录 inode
+ * @param cnt 预计目录项数
+ * @return int 
+ */
+int newfs_dir_index_init(struct newfs_inode* inode, int cnt) {
+	int size = NEWFS_DIR_HASH_MIN;
+	while (size < cnt) {
+		size <<= 1;
+	}
+	if (size <= inode->dhash_sz) {
+		return NEWFS_ERROR_NONE;
+	}
+	return newfs_dir_index_resize(inode, size);
+}
+
+/**
+ * @brief 加入哈希表，装载因子超过 1 时容量翻倍
+ * 
+ * @param inode 目录 inode
+ * @param dentry 
+ * @return int 
+ */
+int newfs_dir_index_insert(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+	struct newfs_dentry** slot;
+
+	if (inode->dir_cnt >= inode->dhash_sz
+		&& newfs_dir_index_resize(inode, inode->dhash_sz ? inode->dhash_sz << 1
+														  : NEWFS_DIR_HASH_MIN) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	dentry->hash	  = newfs_name_hash(dentry->fname, strlen(dentry->fname));
+	slot			  = &inode->dhash[dentry->hash & (inode->dhash_sz - 1)];
+	dentry->hash_next = *slot;
+	*slot			  = dentry;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从哈希表中移除
+ * 
+ * @param inode 目录 inode
+ * @param dentry 
+ */
+void newfs_dir_index_remove(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+	struct newfs_dentry** pos;
+
+	if (inode->dhash == NULL) {
+		return;
+	}
+	pos = &inode->dhash[dentry->hash & (inode->dhash_sz - 1)];
+	while (*pos != NULL && *pos != dentry) {
+		pos = &(*pos)->hash_next;
+	}
+	if (*pos != NULL) {
+		*pos = dentry->hash_next;
+	}
+	dentry->hash_next = NULL;
+}
+
+/**
+ * @brief 在目录中按文件名查找
+ * 
+ * @param inode 目录 inode
+ * @param name 文件名，不要求以 0 结尾
+ * @param len 文件名长度
+ * @return struct newfs_dentry* 未找到返回 NULL
+ */
+struct newfs_dentry* newfs_dir_find(struct newfs_inode* inode, const char* name, int len) {
+	struct newfs_dentry* dentry;
+	unsigned int hash;
+
+	if (inode->dhash == NULL || len >= MAX_NAME_LEN) {
+		return NULL;
+	}
+	hash = newfs_name_hash(name, len);
+	for (dentry = inode->dhash[hash & (inode->dhash_sz - 1)]; dentry != NULL;
+		 dentry = dentry->hash_next) {
+		if (dentry->hash == hash && memcmp(dentry->fname, name, len) == 0
+			&& dentry->fname[len] == '\0') {
+			return dentry;
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+* SECTION: readdir 游标
+* 打开目录时建立并挂到目录 inode 上，持有 inode 直到关闭；
+* 目录项被删除时由 newfs_drop_dentry 推进，目录被删除时 inode 置为 NULL
+*******************************************************************************/
+/**
+ * @brief 在目录上建立游标，调用者持命名空间读锁
+ * 
+ * @param inode 目录 inode
+ * @return struct newfs_dir_cursor* 内存不足返回 NULL
+ */
+struct newfs_dir_cursor* newfs_dir_open(struct newfs_inode* inode) {
+	struct newfs_dir_cursor* cursor;
+
+	cursor = (struct newfs_dir_cursor*)malloc(sizeof(struct newfs_dir_cursor));
+	if (cursor == NULL) {
+		return NULL;
+	}
+	newfs_inode_wrlock(inode);
+	cursor->inode		= inode;
+	cursor->next		= inode->dentrys;
+	cursor->off			= 0;
+	cursor->cursor_next = inode->cursors;
+	inode->cursors		= cursor;
+	newfs_inode_hold(inode);
+	newfs_inode_unlock(inode);
+	return cursor;
+}
+
+/**
+ * @brief 偏移与游标不一致（seekdir / rewinddir）时从头定位，调用者持目录读锁
+ * 
+ * @param cursor 
+ * @param off 第几个目录项
+ */
+void newfs_dir_seek(struct newfs_dir_cursor* cursor, long off) {
+	if (off == cursor->off) {
+		return;
+	}
+	cursor->next = cursor->inode->dentrys;
+	cursor->off  = 0;
+	while (cursor->next != NULL && cursor->off < off) {
+		cursor->next = cursor->next->brother;
+		cursor->off++;
+	}
+}
+
+/**
+ * @brief 从目录上摘下并释放游标
+ * 
+ * @param cursor 
+ */
+void newfs_dir_close(struct newfs_dir_cursor* cursor) {
+	struct newfs_dir_cursor** pos;
+
+	if (cursor->inode != NULL) {
+		newfs_inode_wrlock(cursor->inode);
+		pos = &cursor->inode->cursors;
+		while (*pos != NULL && *pos != cursor) {
+			pos = &(*pos)->cursor_next;
+		}
+		if (*pos != NULL) {
+			*pos = cursor->cursor_next;
+		}
+		newfs_inode_put(cursor->inode);
+		newfs_inode_unlock(cursor->inode);
+	}
+	free(cursor);
+}
@@ -0,0 +1,351 @@
+#include "../include/newfs.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <limits.h>
+
+/******************************************************************************
+* SECTION: 存储后端
+* 所有后端只接收按 NEWFS_IO_SZ 对齐的 offset 与 size，由 newfs_dev_read/write 调用
+*******************************************************************************/
+static char*	map_base = NULL;	/* mmap 后端的映射地址 */
+static size_t	map_sz   = 0;
+
+#define NEWFS_MAP_STRIPE_SHIFT	16		/* 每 64KiB 映射区共用一把锁 */
+#define NEWFS_MAP_STRIPES		256
+static pthread_rwlock_t map_locks[NEWFS_MAP_STRIPES];	/* 映射区内的 memcpy 不是原子的，同一区间读写互斥 */
+
+#ifdef NEWFS_WITH_DDRIVER
+/******************************************************************************
+* SECTION: ddriver 后端
+* 定位与读写分两次调用，整个请求持锁完成
+*******************************************************************************/
+static pthread_mutex_t ddriver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int newfs_ddriver_open(const char* path) {
+	int fd = ddriver_open((char*)path);
+	if (fd < 0) {
+		return fd;
+	}
+	super.fd = fd;
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ddriver_close() {
+	return ddriver_close(super.fd);
+}
+
+static int newfs_ddriver_geometry(int64_t* sz_disk, int* sz_io) {
+	int sz;
+
+	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &sz);
+	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, sz_io);
+	*sz_disk = sz;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief ddriver 每次只能读写一个 IO 单元，连续的单元只定位一次
+ */
+static int newfs_ddriver_read(int64_t offset, char* out_content, int size) {
+	int ret = NEWFS_ERROR_NONE;
+
+	pthread_mutex_lock(&ddriver_lock);
+	if (ddriver_seek(super.fd, offset, SEEK_SET) < 0) {
+		ret = -NEWFS_ERROR_SEEK;
+	}
+	while (ret == NEWFS_ERROR_NONE && size != 0) {
+		if (ddriver_read(super.fd, out_content, NEWFS_IO_SZ) < 0) {
+			ret = -NEWFS_ERROR_IO;
+		}
+		out_content += NEWFS_IO_SZ;
+		size		-= NEWFS_IO_SZ;
+	}
+	pthread_mutex_unlock(&ddriver_lock);
+	return ret;
+}
+
+static int newfs_ddriver_write(int64_t offset, char* in_content, int size) {
+	int ret = NEWFS_ERROR_NONE;
+
+	pthread_mutex_lock(&ddriver_lock);
+	if (ddriver_seek(super.fd, offset, SEEK_SET) < 0) {
+		ret = -NEWFS_ERROR_SEEK;
+	}
+	while (ret == NEWFS_ERROR_NONE && size != 0) {
+		if (ddriver_write(super.fd, in_content, NEWFS_IO_SZ) < 0) {
+			ret = -NEWFS_ERROR_IO;
+		}
+		in_content  += NEWFS_IO_SZ;
+		size		-= NEWFS_IO_SZ;
+	}
+	pthread_mutex_unlock(&ddriver_lock);
+	return ret;
+}
+
+static int newfs_ddriver_sync() {
+	return NEWFS_ERROR_NONE;
+}
+#endif /* NEWFS_WITH_DDRIVER */
+
+/******************************************************************************
+* SECTION: 镜像文件 / 块设备后端，pread/pwrite 定位读写
+*******************************************************************************/
+static int newfs_file_open(const char* path) {
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		return -errno;
+	}
+	super.fd = fd;
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_close() {
+	return close(super.fd) < 0 ? -errno : NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 普通文件取文件大小，块设备通过 BLKGETSIZE64 获取
+ */
+static int newfs_file_geometry(int64_t* sz_disk, int* sz_io) {
+	struct stat st;
+	uint64_t	sz;
+
+	if (fstat(super.fd, &st) < 0) {
+		return -errno;
+	}
+	sz = st.st_size;
+	if (S_ISBLK(st.st_mode) && ioctl(super.fd, BLKGETSIZE64, &sz) < 0) {
+		return -errno;
+	}
+	*sz_disk = (int64_t)ROUND_DOWN(sz, NEWFS_IO_SZ);
+	*sz_io   = NEWFS_IO_SZ;
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_read(int64_t offset, char* out_content, int size) {
+	ssize_t n;
+	while (size > 0) {
+		n = pread(super.fd, out_content, size, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -NEWFS_ERROR_IO;
+		}
+		out_content += n;
+		offset		+= n;
+		size		-= n;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_write(int64_t offset, char* in_content, int size) {
+	ssize_t n;
+	while (size > 0) {
+		n = pwrite(super.fd, in_content, size, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -NEWFS_ERROR_IO;
+		}
+		in_content  += n;
+		offset		+= n;
+		size		-= n;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_sync() {
+	return fdatasync(super.fd) < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+/******************************************************************************
+* SECTION: mmap 后端，读写即内存拷贝，sync 为 msync
+* 按地址分段加读写锁，只有落在同一段上的读写互斥，不同区间的请求并行拷贝
+*******************************************************************************/
+/**
+ * @brief [offset, offset + size) 覆盖的锁，按锁号从小到大为 [0, *wrap] 与 [*lo, *hi]
+ * 段号取模后回绕时分成两段，*wrap 为 -1 表示没有回绕；跨越的段数不少于锁数时覆盖全部锁
+ * 
+ * @param offset 
+ * @param size 
+ * @param lo 
+ * @param hi 
+ * @param wrap 
+ */
+static void newfs_mmap_stripes(int64_t offset, int size, int* lo, int* hi, int* wrap) {
+	int64_t first = offset >> NEWFS_MAP_STRIPE_SHIFT;
+	int64_t last  = (offset + size - 1) >> NEWFS_MAP_STRIPE_SHIFT;
+
+	*wrap = -1;
+	if (last - first + 1 >= NEWFS_MAP_STRIPES) {
+		*lo = 0;
+		*hi = NEWFS_MAP_STRIPES - 1;
+		return;
+	}
+	*lo = first % NEWFS_MAP_STRIPES;
+	*hi = last % NEWFS_MAP_STRIPES;
+	if (*hi < *lo) {
+		*wrap = *hi;
+		*hi	  = NEWFS_MAP_STRIPES - 1;
+	}
+}
+
+/**
+ * @brief 锁住 [offset, offset + size) 覆盖的各段，按锁号从小到大加锁
+ * 
+ * @param offset 
+ * @param size 
+ * @param is_write 写加写锁，读加读锁
+ */
+static void newfs_mmap_lock(int64_t offset, int size, boolean is_write) {
+	int lo, hi, wrap;
+
+	newfs_mmap_stripes(offset, size, &lo, &hi, &wrap);
+	for (int i = 0; i <= hi; i++) {
+		if (i > wrap && i < lo) {
+			continue;
+		}
+		if (is_write) {
+			pthread_rwlock_wrlock(&map_locks[i]);
+		} else {
+			pthread_rwlock_rdlock(&map_locks[i]);
+		}
+	}
+}
+
+static void newfs_mmap_unlock(int64_t offset, int size) {
+	int lo, hi, wrap;
+
+	newfs_mmap_stripes(offset, size, &lo, &hi, &wrap);
+	for (int i = 0; i <= hi; i++) {
+		if (i > wrap && i < lo) {
+			continue;
+		}
+		pthread_rwlock_unlock(&map_locks[i]);
+	}
+}
+
+static int newfs_mmap_open(const char* path) {
+	int64_t sz_disk;
+	int		sz_io;
+	int		ret = newfs_file_open(path);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	ret = newfs_file_geometry(&sz_disk, &sz_io);
+	if (ret != NEWFS_ERROR_NONE) {
+		close(super.fd);
+		return ret;
+	}
+	for (int i = 0; i < NEWFS_MAP_STRIPES; i++) {
+		pthread_rwlock_init(&map_locks[i], NULL);
+	}
+	map_sz   = sz_disk;
+	map_base = (char*)mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, super.fd, 0);
+	if (map_base == MAP_FAILED) {
+		ret = -errno;
+		map_base = NULL;
+		close(super.fd);
+		return ret;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_close() {
+	munmap(map_base, map_sz);
+	map_base = NULL;
+	map_sz   = 0;
+	return newfs_file_close();
+}
+
+static int newfs_mmap_read(int64_t offset, char* out_content, int size) {
+	if ((size_t)offset + size > map_sz) {
+		return -NEWFS_ERROR_IO;
+	}
+	newfs_mmap_lock(offset, size, FALSE);
+	memcpy(out_content, map_base + offset, size);
+	newfs_mmap_unlock(offset, size);
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_write(int64_t offset, char* in_content, int size) {
+	if ((size_t)offset + size > map_sz) {
+		return -NEWFS_ERROR_IO;
+	}
+	newfs_mmap_lock(offset, size, TRUE);
+	memcpy(map_base + offset, in_content, size);
+	newfs_mmap_unlock(offset, size);
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_sync() {
+	return msync(map_base, map_sz, MS_SYNC) < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+static const struct newfs_driver_ops drivers[] = {
+#ifdef NEWFS_WITH_DDRIVER
+	{
+		.name		= "ddriver",
+		.open		= newfs_ddriver_open,
+		.close		= newfs_ddriver_close,
+		.geometry	= newfs_ddriver_geometry,
+		.read		= newfs_ddriver_read,
+		.write		= newfs_ddriver_write,
+		.sync		= newfs_ddriver_sync,
+	},
+#endif
+	{
+		.name		= "file",
+		.open		= newfs_file_open,
+		.close		= newfs_file_close,
+		.geometry	= newfs_file_geometry,
+		.read		= newfs_file_read,
+		.write		= newfs_file_write,
+		.sync		= newfs_file_sync,
+		.fd_io		= TRUE,
+	},
+	{
+		.name		= "mmap",
+		.open		= newfs_mmap_open,
+		.close		= newfs_mmap_close,
+		.geometry	= newfs_file_geometry,
+		.read		= newfs_mmap_read,
+		.write		= newfs_mmap_write,
+		.sync		= newfs_mmap_sync,
+		.fd_io		= TRUE,
+	},
+	{
+		.name		= "uring",
+		.open		= newfs_uring_open,
+		.close		= newfs_uring_close,
+		.geometry	= newfs_file_geometry,
+		.read		= newfs_file_read,
+		.write		= newfs_file_write,
+		.sync		= newfs_file_sync,
+		.submit		= newfs_uring_submit,
+		.fd_io		= TRUE,
+	},
+};
+
+/**
+ * @brief 按名字查找存储后端，name 为 NULL 时返回默认后端
+ * 
+ * @param name ddriver | file | mmap | uring
+ * @return const struct newfs_driver_ops* 未找到返回 NULL
+ */
+const struct newfs_driver_ops* newfs_driver_find(const char* name) {
+	if (name == NULL) {
+		return &drivers[0];
+	}
+	for (size_t i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++) {
+		if (strcmp(drivers[i].name, name) == 0) {
+			return &drivers[i];
+		}
+	}
+	return NULL;
+}
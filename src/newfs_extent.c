@@ -0,0 +1,867 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: extent 块映射
+* 每个 inode 的数据块映射由按逻辑块号升序的 extent 数组描述：
+* 前 NEWFS_INLINE_EXTENTS 个存放在 inode_d 中，其余依次存放在溢出块链中，个数不设上限。
+* 文件的逻辑块有四种状态：已写（extent）、未写入（unwritten extent，预分配后尚未写过，
+* 读为零）、延迟分配（没有 extent，内存中有缓存，已预留空间）、空洞（都没有，读为零）
+*******************************************************************************/
+
+/**
+ * @brief 二分查找包含 lblk 的 extent
+ * 
+ * @param inode 
+ * @param lblk 逻辑块号
+ * @return int 下标；不在任何 extent 中时返回 -(插入位置) - 1
+ */
+static int newfs_extent_index(struct newfs_inode* inode, int lblk) {
+	int lo = 0;
+	int hi = inode->ext_cnt - 1;
+	int mid;
+	struct newfs_extent* ext;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		ext = &inode->extents[mid];
+		if (lblk < ext->lblk) {
+			hi = mid - 1;
+		} else if (lblk >= ext->lblk + (int)ext->len) {
+			lo = mid + 1;
+		} else {
+			return mid;
+		}
+	}
+	return -lo - 1;
+}
+
+/**
+ * @brief 逻辑块号映射为数据区块号
+ * 
+ * @param inode 
+ * @param lblk 逻辑块号
+ * @return int 数据块号，未映射返回 NEWFS_BLK_NONE
+ */
+int newfs_bmap(struct newfs_inode* inode, int lblk) {
+	int idx = newfs_extent_index(inode, lblk);
+
+	return idx >= 0 ? inode->extents[idx].pblk + (lblk - inode->extents[idx].lblk)
+					: NEWFS_BLK_NONE;
+}
+
+/**
+ * @brief 逻辑块号映射为数据区块号，同时给出状态相同的连续块数
+ * 
+ * @param inode 
+ * @param lblk 逻辑块号
+ * @param len 从 lblk 起同一 extent（或同一段未映射区间）内的块数
+ * @param unwritten 是否为未写入的预分配块
+ * @return int 数据块号，未映射返回 NEWFS_BLK_NONE
+ */
+int newfs_bmap_len(struct newfs_inode* inode, int lblk, int* len, boolean* unwritten) {
+	int idx = newfs_extent_index(inode, lblk);
+	struct newfs_extent* ext;
+
+	if (idx < 0) {
+		idx		   = -idx - 1;
+		*len	   = idx < inode->ext_cnt ? inode->extents[idx].lblk - lblk : NEWFS_MAX_BLKS - lblk;
+		*unwritten = FALSE;
+		return NEWFS_BLK_NONE;
+	}
+	ext		   = &inode->extents[idx];
+	*len	   = ext->lblk + ext->len - lblk;
+	*unwritten = ext->unwritten;
+	return ext->pblk + (lblk - ext->lblk);
+}
+
+/**
+ * @brief 保证 extent 数组还能再放 n 项
+ * 
+ * @return int 内存不足返回 -NEWFS_ERROR_NOSPACE
+ */
+static int newfs_extent_slots(struct newfs_inode* inode, int n) {
+	struct newfs_extent* tmp;
+	int cap;
+
+	if (inode->ext_cnt + n > inode->ext_cap) {
+		cap = inode->ext_cap == 0 ? NEWFS_INLINE_EXTENTS : inode->ext_cap;
+		while (cap < inode->ext_cnt + n) {
+			cap *= 2;
+		}
+		tmp = (struct newfs_extent*)realloc(inode->extents, cap * sizeof(struct newfs_extent));
+		if (tmp == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		inode->extents = tmp;
+		inode->ext_cap = cap;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 保证溢出块的预留足以容纳 cnt 个 extent
+ * 溢出块在回写时才分配，写入时按 extent 个数的上限预留，回写不会因空间已被
+ * 其他文件的延迟分配预留而失败
+ * 
+ * @param inode 
+ * @param cnt extent 个数的上限
+ * @return int 空间不足返回 -NEWFS_ERROR_NOSPACE
+ */
+static int newfs_extent_reserve(struct newfs_inode* inode, int cnt) {
+	int want = NEWFS_EXT_BLKS(cnt) - inode->ext_nblks - inode->ext_resv;
+
+	if (want <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	if (newfs_reserve_data_blks(want) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	inode->ext_resv += want;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 归还超出当前上限的溢出块预留
+ * 
+ * @param inode 
+ */
+static void newfs_extent_trim_resv(struct newfs_inode* inode) {
+	int keep = NEWFS_EXT_BLKS(inode->ext_cnt + inode->dl_blks) - inode->ext_nblks;
+
+	keep = keep > 0 ? keep : 0;
+	if (inode->ext_resv > keep) {
+		newfs_unreserve_data_blks(inode->ext_resv - keep);
+		inode->ext_resv = keep;
+	}
+}
+
+/**
+ * @brief 第 i 与第 i + 1 个 extent 逻辑、物理都连续且状态相同时合并
+ * 
+ * @return boolean 是否合并
+ */
+static boolean newfs_extent_merge(struct newfs_inode* inode, int i) {
+	struct newfs_extent* a;
+	struct newfs_extent* b;
+
+	if (i < 0 || i + 1 >= inode->ext_cnt) {
+		return FALSE;
+	}
+	a = &inode->extents[i];
+	b = &inode->extents[i + 1];
+	if (a->lblk + (int)a->len != b->lblk || a->pblk + (int)a->len != b->pblk
+		|| a->unwritten != b->unwritten) {
+		return FALSE;
+	}
+	a->len += b->len;
+	memmove(b, b + 1, (inode->ext_cnt - i - 2) * sizeof(struct newfs_extent));
+	inode->ext_cnt--;
+	return TRUE;
+}
+
+/**
+ * @brief 在未映射的 [lblk, lblk + len) 处插入映射，与前后相邻的 extent 连续时直接合并
+ * 
+ * @param inode 
+ * @param lblk 逻辑起始块
+ * @param pblk 物理起始块
+ * @param len 块数
+ * @param unwritten 是否为未写入的预分配块
+ * @return int 
+ */
+static int newfs_extent_insert(struct newfs_inode* inode, int lblk, int pblk, int len,
+							   boolean unwritten) {
+	int idx = -newfs_extent_index(inode, lblk) - 1;
+	struct newfs_extent* ext;
+
+	if (idx > 0) {
+		ext = &inode->extents[idx - 1];
+		if (ext->lblk + (int)ext->len == lblk && ext->pblk + (int)ext->len == pblk
+			&& ext->unwritten == unwritten) {
+			ext->len += len;
+			newfs_extent_merge(inode, idx - 1);
+			return NEWFS_ERROR_NONE;
+		}
+	}
+	if (idx < inode->ext_cnt) {
+		ext = &inode->extents[idx];
+		if (lblk + len == ext->lblk && pblk + len == ext->pblk && ext->unwritten == unwritten) {
+			ext->lblk  = lblk;
+			ext->pblk  = pblk;
+			ext->len  += len;
+			return NEWFS_ERROR_NONE;
+		}
+	}
+	if (newfs_extent_slots(inode, 1) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	ext = &inode->extents[idx];
+	memmove(ext + 1, ext, (inode->ext_cnt - idx) * sizeof(struct newfs_extent));
+	ext->lblk	   = lblk;
+	ext->pblk	   = pblk;
+	ext->len	   = len;
+	ext->unwritten = unwritten;
+	inode->ext_cnt++;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 解除 [from, to) 的映射并释放数据块，必要时截断或切开 extent
+ * 
+ * @param inode 
+ * @param from 
+ * @param to 
+ * @return int 需要切开而内存或空间不足时返回 -NEWFS_ERROR_NOSPACE，此时不做任何修改
+ */
+static int newfs_extent_remove(struct newfs_inode* inode, int from, int to) {
+	struct newfs_extent* ext;
+	int idx = newfs_extent_index(inode, from);
+	int i;
+	int j;
+	int a;
+	int b;
+	int lo;
+	int hi;
+
+	idx = idx >= 0 ? idx : -idx - 1;
+	if (idx < inode->ext_cnt && inode->extents[idx].lblk < from
+		&& inode->extents[idx].lblk + (int)inode->extents[idx].len > to) {
+		// 从一个 extent 中间挖掉一段，切成两个
+		if (newfs_extent_slots(inode, 1) != NEWFS_ERROR_NONE
+			|| newfs_extent_reserve(inode, inode->ext_cnt + 1 + inode->dl_blks) != NEWFS_ERROR_NONE) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		ext = &inode->extents[idx];
+		for (int k = from; k < to; k++) {
+			newfs_free_data_blk(ext->pblk + (k - ext->lblk));
+		}
+		memmove(ext + 2, ext + 1, (inode->ext_cnt - idx - 1) * sizeof(struct newfs_extent));
+		ext[1].lblk		 = to;
+		ext[1].pblk		 = ext->pblk + (to - ext->lblk);
+		ext[1].len		 = ext->lblk + ext->len - to;
+		ext[1].unwritten = ext->unwritten;
+		ext->len		 = from - ext->lblk;
+		inode->ext_cnt++;
+		newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+		return NEWFS_ERROR_NONE;
+	}
+
+	for (i = j = idx; i < inode->ext_cnt; i++) {
+		ext = &inode->extents[i];
+		a	= ext->lblk;
+		b	= a + ext->len;
+		if (a < to) {
+			lo = a > from ? a : from;
+			hi = b < to ? b : to;
+			for (int k = lo; k < hi; k++) {
+				newfs_free_data_blk(ext->pblk + (k - a));
+			}
+			if (lo > a) {
+				ext->len = lo - a;			// 保留头部
+			} else if (hi < b) {
+				ext->lblk  = hi;			// 保留尾部
+				ext->pblk += hi - a;
+				ext->len   = b - hi;
+			} else {
+				continue;
+			}
+		}
+		inode->extents[j++] = *ext;
+	}
+	inode->ext_cnt = j;
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 逻辑块 lblk 是否有内存缓存
+ */
+static inline boolean newfs_inode_buffered(struct newfs_inode* inode, int lblk) {
+	return lblk < inode->blk_cap && inode->block_pointer[lblk] != NULL;
+}
+
+/**
+ * @brief [from, to) 中延迟分配的块数（没有映射但有内存缓存）
+ */
+static int newfs_inode_delayed(struct newfs_inode* inode, int from, int to) {
+	boolean unwritten;
+	int		cnt = 0;
+	int		len;
+
+	to = to < inode->blk_cap ? to : inode->blk_cap;
+	while (from < to) {
+		if (newfs_bmap_len(inode, from, &len, &unwritten) == NEWFS_BLK_NONE) {
+			for (int i = from; i < from + len && i < to; i++) {
+				cnt += inode->block_pointer[i] != NULL;
+			}
+		}
+		from += len;
+	}
+	return cnt;
+}
+
+/**
+ * @brief 文件的 block_pointer 扩大到至少 nblks 项
+ * 
+ * @param inode 
+ * @param nblks 
+ * @return int 
+ */
+static int newfs_inode_grow(struct newfs_inode* inode, int nblks) {
+	char** tmp;
+	int	   cap;
+
+	if (inode->ftype != NEWFS_FILE || nblks <= inode->blk_cap) {
+		return NEWFS_ERROR_NONE;
+	}
+	cap = inode->blk_cap == 0 ? 1 : inode->blk_cap;
+	while (cap < nblks) {
+		cap *= 2;
+	}
+	tmp = (char**)realloc(inode->block_pointer, cap * sizeof(char*));
+	if (tmp == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	memset(tmp + inode->blk_cap, 0, (cap - inode->blk_cap) * sizeof(char*));
+	inode->block_pointer = tmp;
+	inode->blk_cap		 = cap;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为 [lblk, lblk + cnt) 中没有映射的块分配物理块
+ * 延迟分配的块由回写写出内存缓存，建立为已写；holes 为 TRUE 时空洞也分配，先为其预留，
+ * 与相邻的延迟分配块整段申请，文件的空洞建立为未写入（读为零），目录块总是整块写出，
+ * 建立为已写。每段紧接前一个逻辑块的物理块分配，尽量连续
+ * 
+ * @param inode 
+ * @param lblk 
+ * @param cnt 
+ * @param holes 是否为空洞分配
+ * @return int 
+ */
+static int newfs_inode_alloc(struct newfs_inode* inode, int lblk, int cnt, boolean holes) {
+	boolean unwritten;
+	boolean buffered;
+	int end = lblk + cnt;
+	int goal;
+	int pblk;
+	int got;
+	int len;
+	int run;
+	int nh = 0;
+	int hk = 0;
+	int k  = 0;
+	int n;
+	int ret = NEWFS_ERROR_NONE;
+
+	while (lblk < end) {
+		pblk = newfs_bmap_len(inode, lblk, &len, &unwritten);
+		len	 = len < end - lblk ? len : end - lblk;
+		if (pblk != NEWFS_BLK_NONE) {
+			lblk += len;
+			continue;
+		}
+		if (holes) {
+			run = len;
+			for (nh = 0, n = lblk; n < lblk + run; n++) {
+				nh += !newfs_inode_buffered(inode, n);
+			}
+		} else if (newfs_inode_buffered(inode, lblk)) {
+			for (run = 1; run < len && newfs_inode_buffered(inode, lblk + run); run++)
+				;
+		} else {
+			lblk++;
+			continue;
+		}
+		if (nh > 0 && (ret = newfs_reserve_data_blks(nh)) != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+		goal = lblk > 0 ? newfs_bmap(inode, lblk - 1) : NEWFS_BLK_NONE;
+		goal = goal != NEWFS_BLK_NONE ? goal + 1 : NEWFS_BLK_NONE;
+		pblk = newfs_alloc_data_run(goal, run, TRUE, &got);
+		if (pblk < 0) {
+			newfs_unreserve_data_blks(nh);
+			return pblk;
+		}
+		for (k = hk = 0; k < got && ret == NEWFS_ERROR_NONE; k += n) {
+			buffered = newfs_inode_buffered(inode, lblk + k);
+			for (n = 1; k + n < got && newfs_inode_buffered(inode, lblk + k + n) == buffered; n++)
+				;
+			// 回写时为延迟分配的块建立映射，新增的 extent 已计入 dl_blks 的预留
+			ret = holes ? newfs_extent_reserve(inode, inode->ext_cnt + 1 + inode->dl_blks)
+						: NEWFS_ERROR_NONE;
+			if (ret == NEWFS_ERROR_NONE) {
+				ret = newfs_extent_insert(inode, lblk + k, pblk + k, n,
+										  !buffered && inode->ftype == NEWFS_FILE);
+			}
+			if (ret != NEWFS_ERROR_NONE) {
+				break;
+			}
+			hk += buffered ? 0 : n;
+		}
+		// 已建立映射的块用掉各自的预留，没用上的空洞预留归还
+		for (int i = k; i < got; i++) {
+			newfs_free_data_blk(pblk + i);
+		}
+		newfs_unreserve_data_blks(k + nh - hk);
+		inode->dl_blks -= k - hk;
+		nh = 0;
+		if (k > 0) {
+			lblk += k;
+			inode->blks = lblk > inode->blks ? lblk : inode->blks;
+			newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+		}
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为 inode 在末尾追加 cnt 个数据块，立即分配物理块，用于目录
+ * 
+ * @param inode 
+ * @param cnt 块数
+ * @return int 
+ */
+int newfs_inode_extend(struct newfs_inode* inode, int cnt) {
+	return newfs_inode_alloc(inode, inode->blks, cnt, TRUE);
+}
+
+/**
+ * @brief 文件的空洞 [lblk, lblk + cnt) 改为延迟分配：只预留空间，不分配物理块
+ * 调用者为这些块建立内存缓存，回写时由 newfs_inode_map_delayed 分配
+ * 
+ * @param inode 文件 inode
+ * @param lblk 起始逻辑块
+ * @param cnt 块数
+ * @return int 空间不足返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_inode_reserve(struct newfs_inode* inode, int lblk, int cnt) {
+	int ret = newfs_inode_grow(inode, lblk + cnt);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	ret = newfs_extent_reserve(inode, inode->ext_cnt + inode->dl_blks + cnt);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	ret = newfs_reserve_data_blks(cnt);
+	if (ret != NEWFS_ERROR_NONE) {
+		newfs_extent_trim_resv(inode);
+		return ret;
+	}
+	inode->dl_blks += cnt;
+	if (lblk + cnt > inode->blks) {
+		inode->blks = lblk + cnt;
+	}
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 归还 newfs_inode_reserve 的预留，这些块不再延迟分配
+ * 
+ * @param inode 文件 inode
+ * @param cnt 块数
+ */
+void newfs_inode_unreserve(struct newfs_inode* inode, int cnt) {
+	newfs_unreserve_data_blks(cnt);
+	inode->dl_blks -= cnt;
+}
+
+/**
+ * @brief 为文件的 [lblk, lblk + cnt) 预分配物理块：空洞建立为未写入，延迟分配的块一并分配
+ * 
+ * @param inode 文件 inode
+ * @param lblk 起始逻辑块
+ * @param cnt 块数
+ * @return int 
+ */
+int newfs_inode_prealloc(struct newfs_inode* inode, int lblk, int cnt) {
+	int ret = newfs_inode_grow(inode, lblk + cnt);
+
+	return ret != NEWFS_ERROR_NONE ? ret : newfs_inode_alloc(inode, lblk, cnt, TRUE);
+}
+
+/**
+ * @brief 回写时为文件全部延迟分配的块分配物理块，此时文件大小已定，整段一次申请
+ * 
+ * @param inode 文件 inode
+ * @return int 
+ */
+int newfs_inode_map_delayed(struct newfs_inode* inode) {
+	return newfs_inode_alloc(inode, 0, inode->blks, FALSE);
+}
+
+/**
+ * @brief 在设备上把一段数据块写零
+ * 
+ * @param pblk 起始数据块号
+ * @param cnt 块数
+ * @return int 
+ */
+static int newfs_extent_zero(int pblk, int cnt) {
+	int	  batch = cnt < NEWFS_DATA_BATCH_BLKS ? cnt : NEWFS_DATA_BATCH_BLKS;
+	char* zero;
+	int	  n;
+	int	  ret	= NEWFS_ERROR_NONE;
+
+	if (cnt <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	zero = (char*)calloc(1, NEWFS_BLKS_SZ(batch));
+	if (zero == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_cache_invalidate(NEWFS_DATA_OFS(pblk) / NEWFS_BLK_SZ, cnt);
+	for (; cnt > 0 && ret == NEWFS_ERROR_NONE; pblk += n, cnt -= n) {
+		n	= cnt < batch ? cnt : batch;
+		ret = newfs_dev_write(NEWFS_DATA_OFS(pblk), zero, NEWFS_BLKS_SZ(n));
+	}
+	free(zero);
+	return ret;
+}
+
+/**
+ * @brief 将同一个未写入 extent 中的 [lblk, lblk + cnt) 标记为已写，调用者已写入或将在
+ * 回写时写入这些块；extent 需要切开而内存或溢出块空间不足时，把其余部分在设备上写零后
+ * 整个标记为已写
+ * 
+ * @param inode 文件 inode
+ * @param lblk 
+ * @param cnt 
+ * @return int 
+ */
+int newfs_inode_convert(struct newfs_inode* inode, int lblk, int cnt) {
+	struct newfs_extent* ext;
+	int idx = newfs_extent_index(inode, lblk);
+	int a;
+	int p;
+	int left;
+	int right;
+	int add;
+	int ret;
+
+	if (idx < 0 || !inode->extents[idx].unwritten) {
+		return NEWFS_ERROR_NONE;
+	}
+	ext	  = &inode->extents[idx];
+	a	  = ext->lblk;
+	p	  = ext->pblk;
+	left  = lblk - a;
+	right = a + ext->len - (lblk + cnt);
+	add	  = (left > 0) + (right > 0);
+	if (add > 0 && (newfs_extent_slots(inode, add) != NEWFS_ERROR_NONE
+					|| newfs_extent_reserve(inode, inode->ext_cnt + add + inode->dl_blks) != NEWFS_ERROR_NONE)) {
+		ret = newfs_extent_zero(p, left);
+		if (ret == NEWFS_ERROR_NONE) {
+			ret = newfs_extent_zero(p + left + cnt, right);
+		}
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+		inode->extents[idx].unwritten = FALSE;
+	} else {
+		ext = &inode->extents[idx];
+		memmove(ext + 1 + add, ext + 1, (inode->ext_cnt - idx - 1) * sizeof(struct newfs_extent));
+		inode->ext_cnt += add;
+		if (left > 0) {
+			ext->len = left;
+			ext++;
+			idx++;
+		}
+		ext->lblk	   = lblk;
+		ext->pblk	   = p + left;
+		ext->len	   = cnt;
+		ext->unwritten = FALSE;
+		if (right > 0) {
+			ext[1].lblk		 = lblk + cnt;
+			ext[1].pblk		 = p + left + cnt;
+			ext[1].len		 = right;
+			ext[1].unwritten = TRUE;
+		}
+	}
+	newfs_extent_merge(inode, idx);
+	newfs_extent_merge(inode, idx - 1);
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在文件中打洞：解除 [lblk, lblk + cnt) 的映射，释放数据块、延迟分配的预留与内存缓存
+ * 
+ * @param inode 文件 inode
+ * @param lblk 
+ * @param cnt 
+ * @return int extent 需要切开而内存或空间不足时返回 -NEWFS_ERROR_NOSPACE，此时不做任何修改
+ */
+int newfs_inode_punch(struct newfs_inode* inode, int lblk, int cnt) {
+	int delayed = newfs_inode_delayed(inode, lblk, lblk + cnt);
+	int ret		= newfs_extent_remove(inode, lblk, lblk + cnt);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	newfs_inode_unreserve(inode, delayed);
+	newfs_extent_trim_resv(inode);
+	for (int i = lblk; i < lblk + cnt && i < inode->blk_cap; i++) {
+		free(inode->block_pointer[i]);
+		inode->block_pointer[i] = NULL;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放逻辑块 nblks 及之后的数据块，截断末尾的 extent
+ * 文件同时丢弃这些块的内存缓存与延迟分配的预留
+ * 
+ * @param inode 
+ * @param nblks 保留的块数
+ */
+void newfs_inode_shrink(struct newfs_inode* inode, int nblks) {
+	if (nblks >= inode->blks) {
+		return;
+	}
+	// 只截断末尾，不会切开 extent
+	newfs_inode_punch(inode, nblks, inode->blks - nblks);
+	inode->blks = nblks;
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+}
+
+/**
+ * @brief 从 inode_d 及溢出块链中读出 extent
+ * 
+ * @param inode 
+ * @param inode_d 
+ * @return int 
+ */
+int newfs_extent_load(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+	struct newfs_ext_hdr_d* hdr;
+	int cnt = inode_d->ext_cnt;
+	int inline_cnt = cnt < NEWFS_INLINE_EXTENTS ? cnt : NEWFS_INLINE_EXTENTS;
+	int pos = inline_cnt;
+	int blk = inode_d->ext_blk;
+	char* blk_buf;
+
+	if (cnt < 0) {
+		return -NEWFS_ERROR_IO;
+	}
+	inode->ext_cnt	 = cnt;
+	inode->ext_cap	 = cnt > NEWFS_INLINE_EXTENTS ? cnt : NEWFS_INLINE_EXTENTS;
+	inode->extents	 = (struct newfs_extent*)malloc(inode->ext_cap * sizeof(struct newfs_extent));
+	inode->ext_nblks = NEWFS_EXT_BLKS(cnt);
+	inode->ext_blks	 = (int*)malloc((inode->ext_nblks > 0 ? inode->ext_nblks : 1) * sizeof(int));
+	if (inode->extents == NULL || inode->ext_blks == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	memcpy(inode->extents, inode_d->extents, inline_cnt * sizeof(struct newfs_extent));
+	if (inode->ext_nblks == 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	blk_buf = (char*)malloc(NEWFS_BLK_SZ);
+	if (blk_buf == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	hdr = (struct newfs_ext_hdr_d*)blk_buf;
+	for (int i = 0; i < inode->ext_nblks; i++) {
+		if (blk < 0 || blk >= super.max_data_blks
+			|| newfs_driver_read(NEWFS_DATA_OFS(blk), blk_buf, NEWFS_BLK_SZ) != NEWFS_ERROR_NONE
+			|| hdr->cnt <= 0 || hdr->cnt > NEWFS_EXTENT_PER_BLK || hdr->cnt > cnt - pos) {
+			NEWFS_DBG("[%s] inode %d: bad extent block %d\n", __func__, inode->ino, blk);
+			free(blk_buf);
+			return -NEWFS_ERROR_IO;
+		}
+		inode->ext_blks[i] = blk;
+		memcpy(inode->extents + pos, blk_buf + sizeof(struct newfs_ext_hdr_d),
+			   hdr->cnt * sizeof(struct newfs_extent));
+		pos += hdr->cnt;
+		blk	 = hdr->next;
+	}
+	free(blk_buf);
+	// 链上的 extent 总数须与 inode_d 中记录的一致，否则数组尾部未初始化
+	if (pos != cnt || blk != NEWFS_BLK_NONE) {
+		NEWFS_DBG("[%s] inode %d: extent chain holds %d of %d\n", __func__, inode->ino, pos, cnt);
+		return -NEWFS_ERROR_IO;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 溢出块链调整为 nblks 块：不足时优先从预留中分配，多余的释放
+ * 
+ * @param inode 
+ * @param nblks 
+ * @return int 
+ */
+static int newfs_extent_resize_blks(struct newfs_inode* inode, int nblks) {
+	int* tmp;
+	int	 blk;
+	int	 got;
+
+	if (nblks > inode->ext_nblks) {
+		tmp = (int*)realloc(inode->ext_blks, nblks * sizeof(int));
+		if (tmp == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		inode->ext_blks = tmp;
+	}
+	while (inode->ext_nblks < nblks) {
+		if (inode->ext_resv > 0) {
+			blk = newfs_alloc_data_run(NEWFS_BLK_NONE, 1, TRUE, &got);
+			if (blk >= 0) {
+				newfs_unreserve_data_blks(1);
+				inode->ext_resv--;
+			}
+		} else {
+			blk = newfs_alloc_data_blk();
+		}
+		if (blk < 0) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		inode->ext_blks[inode->ext_nblks++] = blk;
+	}
+	while (inode->ext_nblks > nblks) {
+		newfs_free_data_blk(inode->ext_blks[--inode->ext_nblks]);
+	}
+	newfs_extent_trim_resv(inode);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将 extent 写入 inode_d，超出部分写入溢出块链（按需分配或释放）
+ * 
+ * @param inode 
+ * @param inode_d 
+ * @return int 
+ */
+int newfs_extent_store(struct newfs_inode* inode, struct newfs_inode_d* inode_d) {
+	struct newfs_ext_hdr_d* hdr;
+	int cnt = inode->ext_cnt;
+	int inline_cnt = cnt < NEWFS_INLINE_EXTENTS ? cnt : NEWFS_INLINE_EXTENTS;
+	int pos = inline_cnt;
+	char* blk_buf;
+
+	if (newfs_extent_resize_blks(inode, NEWFS_EXT_BLKS(cnt)) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	memset(inode_d->extents, 0, sizeof(inode_d->extents));
+	memcpy(inode_d->extents, inode->extents, inline_cnt * sizeof(struct newfs_extent));
+	inode_d->ext_cnt = cnt;
+	inode_d->ext_blk = inode->ext_nblks > 0 ? inode->ext_blks[0] : NEWFS_BLK_NONE;
+
+	if (inode->ext_nblks == 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	blk_buf = (char*)malloc(NEWFS_BLK_SZ);
+	if (blk_buf == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	hdr = (struct newfs_ext_hdr_d*)blk_buf;
+	for (int i = 0; i < inode->ext_nblks; i++) {
+		hdr->next = i + 1 < inode->ext_nblks ? inode->ext_blks[i + 1] : NEWFS_BLK_NONE;
+		hdr->cnt  = cnt - pos < NEWFS_EXTENT_PER_BLK ? cnt - pos : NEWFS_EXTENT_PER_BLK;
+		memcpy(blk_buf + sizeof(struct newfs_ext_hdr_d), inode->extents + pos,
+			   hdr->cnt * sizeof(struct newfs_extent));
+		if (newfs_meta_write(NEWFS_DATA_OFS(inode->ext_blks[i]), blk_buf,
+							 sizeof(struct newfs_ext_hdr_d) + hdr->cnt * sizeof(struct newfs_extent))
+			!= NEWFS_ERROR_NONE) {
+			free(blk_buf);
+			return -NEWFS_ERROR_IO;
+		}
+		pos += hdr->cnt;
+	}
+	free(blk_buf);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放 inode 占用的全部数据块及 extent 溢出块
+ * 
+ * @param inode 
+ */
+void newfs_inode_free_blks(struct newfs_inode* inode) {
+	struct newfs_extent* ext;
+
+	newfs_unreserve_data_blks(newfs_inode_delayed(inode, 0, inode->blks) + inode->ext_resv);
+	inode->ext_resv = 0;
+	inode->dl_blks	= 0;
+	for (int i = 0; i < inode->ext_cnt; i++) {
+		ext = &inode->extents[i];
+		for (int j = 0; j < (int)ext->len; j++) {
+			newfs_free_data_blk(ext->pblk + j);
+		}
+	}
+	while (inode->ext_nblks > 0) {
+		newfs_free_data_blk(inode->ext_blks[--inode->ext_nblks]);
+	}
+	inode->ext_cnt = 0;
+	inode->blks	   = 0;
+}
+
+/**
+ * @brief 把目录的数据块与 extent 溢出块搬到新分配的块上，原来的块经延迟复用释放
+ * 回写时元数据超过整个日志区的 inode 用它：新块的内容不经日志直接写出
+ * （见 newfs_journal_direct），事务中只剩 inode 与位图；提交前崩溃时磁盘上的 inode
+ * 仍指向原来的块，它们在提交前不会被复用
+ * 
+ * @param inode 
+ * @return int 空间不足返回 -NEWFS_ERROR_NOSPACE，此时 inode 不变
+ */
+int newfs_inode_relocate(struct newfs_inode* inode) {
+	struct newfs_extent* runs;
+	int cnt	  = inode->ftype == NEWFS_DIR ? inode->blks : 0;
+	int nruns = 0;
+	int goal  = NEWFS_BLK_NONE;
+	int lblk  = 0;
+	int pblk;
+	int got;
+
+	runs = (struct newfs_extent*)malloc((cnt > 0 ? cnt : 1) * sizeof(struct newfs_extent));
+	if (runs == NULL || newfs_extent_slots(inode, cnt - inode->ext_cnt) != NEWFS_ERROR_NONE) {
+		free(runs);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	while (lblk < cnt) {
+		pblk = newfs_alloc_data_run(goal, cnt - lblk, FALSE, &got);
+		if (pblk < 0) {
+			for (int i = 0; i < nruns; i++) {
+				for (int j = 0; j < (int)runs[i].len; j++) {
+					newfs_free_data_blk(runs[i].pblk + j);
+				}
+			}
+			free(runs);
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		runs[nruns].lblk	  = lblk;
+		runs[nruns].pblk	  = pblk;
+		runs[nruns].len		  = got;
+		runs[nruns].unwritten = FALSE;
+		nruns++;
+		lblk += got;
+		goal  = pblk + got;
+	}
+
+	if (cnt > 0) {
+		for (int i = 0; i < inode->ext_cnt; i++) {
+			for (int j = 0; j < (int)inode->extents[i].len; j++) {
+				newfs_free_data_blk(inode->extents[i].pblk + j);
+			}
+		}
+		memcpy(inode->extents, runs, nruns * sizeof(struct newfs_extent));
+		inode->ext_cnt = nruns;
+	}
+	free(runs);
+	// 溢出块链由 newfs_extent_store 重新分配
+	while (inode->ext_nblks > 0) {
+		newfs_free_data_blk(inode->ext_blks[--inode->ext_nblks]);
+	}
+	newfs_mark_dirty(inode, inode->ftype == NEWFS_DIR ? NEWFS_DIRTY_INODE | NEWFS_DIRTY_DENTRY
+													  : NEWFS_DIRTY_INODE);
+	return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,138 @@
+#include "../include/newfs.h"
+#include <pthread.h>
+#include <time.h>
+
+/******************************************************************************
+* SECTION: 后台回写线程
+* 每个操作结束时检查脏数据量，超过高水位即唤醒回写线程；回写线程另外按
+* dirty_expire_ms 周期醒来，最早的修改超时即回写。前台操作只修改内存并挂入脏链表，
+* 回写（日志提交、数据刷出）在回写线程中进行，加锁由 newfs_writeback 完成
+*******************************************************************************/
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t	   flusher_tid;
+static boolean		   flusher_running = FALSE;
+static boolean		   flusher_stop	   = FALSE;
+
+/**
+ * @brief 单调时钟，毫秒
+ *
+ * @return long
+ */
+long newfs_now_ms() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 当前脏数据字节数：脏 inode 估算值加块缓存中的脏块
+ *
+ * @return long
+ */
+static long newfs_dirty_bytes() {
+	return __atomic_load_n(&super.dirty_bytes, __ATOMIC_RELAXED)
+		+ (long)newfs_cache_dirty_blks() * NEWFS_BLK_SZ;
+}
+
+/**
+ * @brief 是否超过脏数据高水位
+ *
+ * @return boolean
+ */
+static boolean newfs_over_dirty_limit() {
+	return newfs_options.dirty_mb > 0
+		&& newfs_dirty_bytes() >= (long)newfs_options.dirty_mb * 1024 * 1024;
+}
+
+/**
+ * @brief 最早的未回写修改是否已超时
+ *
+ * @return boolean
+ */
+static boolean newfs_dirty_expired() {
+	long since = newfs_dirty_oldest();
+
+	if (since < 0) {
+		return newfs_cache_dirty_blks() > 0;	// 只剩缓存中的脏块，没有时间戳，直接回写
+	}
+	return newfs_now_ms() - since >= newfs_options.dirty_expire_ms;
+}
+
+/**
+ * @brief 回写线程主循环
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_flusher_main(void* arg) {
+	struct timespec ts;
+	long interval = newfs_options.dirty_expire_ms / 2 > 0 ? newfs_options.dirty_expire_ms / 2 : 1;
+
+	pthread_mutex_lock(&flusher_lock);
+	while (!flusher_stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec  += interval / 1000;
+		ts.tv_nsec += (interval % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&flusher_cond, &flusher_lock, &ts);
+		if (flusher_stop || !super.is_mounted) {
+			break;
+		}
+		pthread_mutex_unlock(&flusher_lock);
+		if (newfs_over_dirty_limit() || newfs_dirty_expired()) {
+			if (newfs_writeback() != NEWFS_ERROR_NONE || newfs_cache_flush() != NEWFS_ERROR_NONE) {
+				NEWFS_DBG("[%s] writeback error\n", __func__);
+			}
+			newfs_icache_reclaim(TRUE);		// 回写后的 inode 变为可淘汰
+		}
+		pthread_mutex_lock(&flusher_lock);
+	}
+	pthread_mutex_unlock(&flusher_lock);
+	return NULL;
+}
+
+/**
+ * @brief 启动回写线程，dirty_expire_ms <= 0 时不启动，回写只在 fsync 与卸载时进行
+ *
+ * @return int
+ */
+int newfs_flusher_start() {
+	if (newfs_options.dirty_expire_ms <= 0) {
+		return NEWFS_ERROR_NONE;
+	}
+	flusher_stop = FALSE;
+	if (pthread_create(&flusher_tid, NULL, newfs_flusher_main, NULL) != 0) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	flusher_running = TRUE;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止回写线程，剩余的脏数据由卸载流程回写
+ */
+void newfs_flusher_stop() {
+	if (!flusher_running) {
+		return;
+	}
+	pthread_mutex_lock(&flusher_lock);
+	flusher_stop = TRUE;
+	pthread_cond_signal(&flusher_cond);
+	pthread_mutex_unlock(&flusher_lock);
+	pthread_join(flusher_tid, NULL);
+	flusher_running = FALSE;
+}
+
+/**
+ * @brief 超过高水位时唤醒回写线程，每个 FUSE 操作返回时调用
+ */
+void newfs_flusher_kick() {
+	if (flusher_running && newfs_over_dirty_limit()) {
+		pthread_cond_signal(&flusher_cond);
+	}
+}
@@ -0,0 +1,205 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: inode 缓存
+* 除根目录外，已加载的 inode 按加载顺序挂在链表上，newfs_lookup 经过时只置访问位，
+* 不移动链表（多线程查找时不争用同一把锁）。数量超过 max_inodes 时从链头开始淘汰
+* （CLOCK 近似 LRU）：访问位被置的 inode 清位后移到链尾；只淘汰干净、无引用、
+* 且没有已加载子 inode 的 inode，冷子树因此自叶向根逐层回收。目录被淘汰时其目录项
+* 一并释放，之后经 newfs_lookup 的懒加载路径（dentry->inode == NULL）重新读入。
+* 低层接口下内核持有 lookup 计数的 inode 同样不淘汰，由 forget 归还后才可回收。
+* 淘汰持命名空间写锁，链表增删另有一把锁
+*******************************************************************************/
+#define NEWFS_ICACHE_SCAN	1024		/* 一次淘汰最多检查的 inode 数 */
+
+static pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct newfs_inode lru = {		// 哨兵，lru_next 为最久未使用
+	.lru_prev = &lru,
+	.lru_next = &lru,
+};
+static int nr_inodes = 0;
+
+static void newfs_icache_unlink(struct newfs_inode* inode) {
+	inode->lru_prev->lru_next = inode->lru_next;
+	inode->lru_next->lru_prev = inode->lru_prev;
+	inode->lru_prev = NULL;
+	inode->lru_next = NULL;
+}
+
+static void newfs_icache_append(struct newfs_inode* inode) {
+	inode->lru_prev			= lru.lru_prev;
+	inode->lru_next			= &lru;
+	lru.lru_prev->lru_next	= inode;
+	lru.lru_prev			= inode;
+}
+
+/**
+ * @brief 新加载或新建的 inode 加入缓存，并计入父目录的已加载子 inode 数
+ * 调用者持有父目录的写锁
+ *
+ * @param inode
+ */
+void newfs_icache_add(struct newfs_inode* inode) {
+	struct newfs_dentry* parent = inode->dentry->parent;
+
+	if (parent == NULL) {
+		return;		// 根目录常驻
+	}
+	parent->inode->cached_cnt++;
+	pthread_mutex_lock(&lru_lock);
+	newfs_icache_append(inode);
+	__atomic_add_fetch(&nr_inodes, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lru_lock);
+}
+
+/**
+ * @brief inode 释放前移出缓存
+ *
+ * @param inode
+ */
+void newfs_icache_del(struct newfs_inode* inode) {
+	if (inode->lru_next == NULL) {
+		return;
+	}
+	inode->dentry->parent->inode->cached_cnt--;
+	pthread_mutex_lock(&lru_lock);
+	newfs_icache_unlink(inode);
+	__atomic_sub_fetch(&nr_inodes, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lru_lock);
+}
+
+/**
+ * @brief 访问 inode，置访问位
+ *
+ * @param inode
+ */
+void newfs_icache_touch(struct newfs_inode* inode) {
+	if (inode == NULL || __atomic_load_n(&inode->referenced, __ATOMIC_RELAXED)) {
+		return;
+	}
+	__atomic_store_n(&inode->referenced, TRUE, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 打开目录或文件时持有 inode，持有期间不会被淘汰
+ * 调用者持命名空间读锁；已被删除的 inode 交给 newfs_orphan_hold
+ *
+ * @param inode
+ */
+void newfs_inode_hold(struct newfs_inode* inode) {
+	if (inode->dentry == NULL) {
+		newfs_orphan_hold(inode);
+		return;
+	}
+	__atomic_add_fetch(&inode->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 关闭时放下 inode，调用者持命名空间读锁；已被删除的 inode 交给 newfs_orphan_put
+ *
+ * @param inode
+ */
+void newfs_inode_put(struct newfs_inode* inode) {
+	if (inode->dentry == NULL) {
+		newfs_orphan_put(inode, 1, 0);
+		return;
+	}
+	__atomic_sub_fetch(&inode->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 淘汰一个 inode：释放其目录项（目录）与内存中的 inode，dentry 保留
+ *
+ * @param inode
+ */
+static void newfs_icache_evict(struct newfs_inode* inode) {
+	struct newfs_dentry* dentry = inode->dentry;
+	struct newfs_dentry* child;
+
+	while ((child = inode->dentrys) != NULL) {
+		inode->dentrys = child->brother;
+		newfs_dentry_release(child);
+	}
+	newfs_free_inode(inode);
+	dentry->inode = NULL;
+}
+
+/**
+ * @brief 超过 max_inodes 时淘汰冷 inode，调用者持有回写锁与命名空间写锁
+ * 跳过的 inode 移到链尾，一次调用的检查数有上限
+ */
+void newfs_icache_shrink() {
+	struct newfs_inode* inode;
+	boolean is_dir_evicted = FALSE;
+	int		budget		   = NEWFS_ICACHE_SCAN;
+
+	if (newfs_options.max_inodes <= 0) {
+		return;
+	}
+	while (nr_inodes > newfs_options.max_inodes && budget-- > 0) {
+		inode = lru.lru_next;
+		if (inode->referenced || inode->dirty != 0 || inode->refcnt != 0 || inode->nlookup != 0
+			|| inode->cursors != NULL || inode->cached_cnt != 0) {
+			inode->referenced = FALSE;
+			newfs_icache_unlink(inode);
+			newfs_icache_append(inode);
+			continue;
+		}
+		is_dir_evicted |= inode->dentrys != NULL;
+		newfs_icache_evict(inode);
+	}
+	// 被释放的目录项可能仍在路径缓存中
+	if (is_dir_evicted) {
+		newfs_dcache_invalidate();
+	}
+}
+
+/**
+ * @brief 在每个操作结束与后台回写后调用，超过 max_inodes 时加锁淘汰
+ * 前台操作只尝试加锁，拿不到就留给下一个操作；超出一批以上或 wait 为 TRUE 时等待加锁
+ *
+ * @param wait
+ */
+void newfs_icache_reclaim(boolean wait) {
+	int cnt = newfs_icache_count();
+
+	if (newfs_options.max_inodes <= 0 || cnt <= newfs_options.max_inodes) {
+		return;
+	}
+	if (wait || cnt > newfs_options.max_inodes + NEWFS_ICACHE_SCAN) {
+		newfs_wb_lock();
+		newfs_ns_wrlock();
+	} else {
+		if (!newfs_wb_trylock()) {
+			return;
+		}
+		if (!newfs_ns_trywrlock()) {
+			newfs_wb_unlock();
+			return;
+		}
+	}
+	if (super.is_mounted) {
+		newfs_icache_shrink();
+	}
+	newfs_ns_unlock();
+	newfs_wb_unlock();
+}
+
+/**
+ * @brief 已加载的 inode 数（不含根目录）
+ *
+ * @return int
+ */
+int newfs_icache_count() {
+	return __atomic_load_n(&nr_inodes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 卸载时清空链表，inode 本身由卸载流程释放
+ */
+void newfs_icache_clear() {
+	lru.lru_prev = &lru;
+	lru.lru_next = &lru;
+	nr_inodes	 = 0;
+}
@@ -0,0 +1,372 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 元数据日志
+* Layout
+* | Super | Journal | Inode Map | Data Map | Inode | Data |
+*
+* 日志区首块为日志头，其后顺序存放事务。一次 newfs_writeback 产生的所有元数据写
+* （inode、目录项块、extent 溢出块、位图修改范围）作为一个事务：
+*  1) 数据块先从块缓存刷出并落盘（ordered）
+*  2) 整个事务按块对齐一次顺序写入日志区并落盘，校验和通过即视为提交
+*  3) 再写回原位置（进入块缓存，之后随缓存刷出）
+* 日志区写满时做检查点：刷出缓存并落盘后从日志区开头重新写，日志头记录新的起点。
+* 事务不能超过日志区，回写的修改放不下时由 newfs_writeback 拆成多个事务
+* （见 newfs_journal_fits），元数据从不绕过日志写回原位置。
+* 挂载时若未正常卸载，从日志头开始按序号重放校验通过的事务，耗时与日志长度成正比
+*******************************************************************************/
+#define NEWFS_JOURNAL (super.journal)
+#define NEWFS_JOURNAL_SZ NEWFS_BLKS_SZ(super.journal_blks)
+
+static uint32_t crc_table[256];
+
+/**
+ * @brief CRC32（IEEE 802.3）
+ *
+ * @param buf
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_crc32(const char* buf, int len) {
+	uint32_t crc = 0xFFFFFFFF;
+
+	if (crc_table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			crc_table[i] = c;
+		}
+	}
+	for (int i = 0; i < len; i++) {
+		crc = crc_table[(crc ^ (uint8_t)buf[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * @brief 写日志头
+ *
+ * @return int
+ */
+static int newfs_journal_write_hdr() {
+	char* blk = (char*)calloc(1, NEWFS_BLK_SZ);
+	struct newfs_journal_hdr_d* hdr = (struct newfs_journal_hdr_d*)blk;
+	int ret;
+
+	if (blk == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	hdr->magic = NEWFS_JOURNAL_MAGIC;
+	hdr->seq   = NEWFS_JOURNAL.seq;
+	hdr->head  = NEWFS_JOURNAL.head;
+	ret = newfs_dev_write(super.journal_offset, blk, NEWFS_BLK_SZ);
+	free(blk);
+	return ret;
+}
+
+/**
+ * @brief 将事务中的记录写回原位置
+ *
+ * @param txn 事务起始地址（newfs_txn_d）
+ * @return int
+ */
+static int newfs_journal_apply(char* txn) {
+	struct newfs_txn_d*  txn_d = (struct newfs_txn_d*)txn;
+	struct newfs_jrec_d  rec;
+	char* pos = txn + sizeof(struct newfs_txn_d);
+
+	for (int i = 0; i < txn_d->nrec; i++) {
+		// 记录只按 4 字节对齐，64 位偏移需拷出后再访问
+		memcpy(&rec, pos, sizeof(struct newfs_jrec_d));
+		if (newfs_driver_write(rec.offset, pos + sizeof(struct newfs_jrec_d),
+							   rec.len) != NEWFS_ERROR_NONE) {
+			return -NEWFS_ERROR_IO;
+		}
+		pos += sizeof(struct newfs_jrec_d) + ROUND_UP(rec.len, 4);
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 挂载时初始化日志
+ *
+ * @param is_format 是否为新格式化的设备，是则写入空日志头
+ * @return int
+ */
+int newfs_journal_init(boolean is_format) {
+	char* blk;
+	struct newfs_journal_hdr_d* hdr;
+
+	memset(&NEWFS_JOURNAL, 0, sizeof(struct newfs_journal));
+	NEWFS_JOURNAL.cap = NEWFS_BLKS_SZ(NEWFS_DIR_BATCH_BLKS);
+	NEWFS_JOURNAL.buf = (char*)malloc(NEWFS_JOURNAL.cap);
+	if (NEWFS_JOURNAL.buf == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	NEWFS_JOURNAL.head = NEWFS_BLK_SZ;
+	NEWFS_JOURNAL.seq  = 1;
+	if (is_format) {
+		return newfs_journal_write_hdr();
+	}
+
+	blk = (char*)malloc(NEWFS_BLK_SZ);
+	if (blk == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_dev_read(super.journal_offset, blk, NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+		free(blk);
+		return -NEWFS_ERROR_IO;
+	}
+	hdr = (struct newfs_journal_hdr_d*)blk;
+	if (hdr->magic == NEWFS_JOURNAL_MAGIC && hdr->head >= NEWFS_BLK_SZ
+		&& hdr->head < NEWFS_JOURNAL_SZ) {
+		NEWFS_JOURNAL.head = hdr->head;
+		NEWFS_JOURNAL.seq  = hdr->seq;
+	}
+	free(blk);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 重放日志：从日志头记录的位置起，依次应用序号连续且校验通过的事务，
+ * 然后做检查点
+ *
+ * @return int
+ */
+int newfs_journal_replay() {
+	struct newfs_txn_d txn_d;
+	char* txn;
+	int   pos	= NEWFS_JOURNAL.head;
+	int   cnt	= 0;
+
+	while (pos + NEWFS_BLK_SZ <= NEWFS_JOURNAL_SZ) {
+		txn = (char*)malloc(NEWFS_BLK_SZ);
+		if (txn == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		if (newfs_dev_read(super.journal_offset + pos, txn, NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+			free(txn);
+			return -NEWFS_ERROR_IO;
+		}
+		memcpy(&txn_d, txn, sizeof(struct newfs_txn_d));
+		free(txn);
+		if (txn_d.magic != NEWFS_JOURNAL_MAGIC || txn_d.seq != NEWFS_JOURNAL.seq
+			|| txn_d.len < NEWFS_BLK_SZ || txn_d.len % NEWFS_BLK_SZ != 0
+			|| pos + txn_d.len > NEWFS_JOURNAL_SZ) {
+			break;
+		}
+
+		txn = (char*)malloc(txn_d.len);
+		if (txn == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		if (newfs_dev_read(super.journal_offset + pos, txn, txn_d.len) != NEWFS_ERROR_NONE) {
+			free(txn);
+			return -NEWFS_ERROR_IO;
+		}
+		if (newfs_crc32(txn + sizeof(struct newfs_txn_d),
+						txn_d.len - sizeof(struct newfs_txn_d)) != txn_d.csum) {
+			free(txn);		// 写了一半的事务，视为未提交
+			break;
+		}
+		if (newfs_journal_apply(txn) != NEWFS_ERROR_NONE) {
+			free(txn);
+			return -NEWFS_ERROR_IO;
+		}
+		free(txn);
+		pos += txn_d.len;
+		NEWFS_JOURNAL.seq++;
+		cnt++;
+	}
+	NEWFS_DBG("[%s] replayed %d transactions\n", __func__, cnt);
+	return newfs_journal_checkpoint();
+}
+
+/**
+ * @brief 开始一个事务，之后的 newfs_meta_write 都记入该事务
+ */
+void newfs_journal_begin() {
+	NEWFS_JOURNAL.is_active = TRUE;
+	NEWFS_JOURNAL.nrec		= 0;
+	NEWFS_JOURNAL.len		= sizeof(struct newfs_txn_d);
+}
+
+/**
+ * @brief 放弃当前事务，已记录的修改不写入日志也不写回原位置
+ */
+void newfs_journal_abort() {
+	NEWFS_JOURNAL.is_active = FALSE;
+	NEWFS_JOURNAL.nrec		= 0;
+}
+
+/**
+ * @brief 记下当前事务的位置，之后追加的记录可由 newfs_journal_rollback 撤销
+ */
+void newfs_journal_mark() {
+	NEWFS_JOURNAL.mark_len	= NEWFS_JOURNAL.len;
+	NEWFS_JOURNAL.mark_nrec = NEWFS_JOURNAL.nrec;
+}
+
+/**
+ * @brief 撤销 newfs_journal_mark 之后追加的记录，用于跳过回写失败的 inode
+ */
+void newfs_journal_rollback() {
+	NEWFS_JOURNAL.len  = NEWFS_JOURNAL.mark_len;
+	NEWFS_JOURNAL.nrec = NEWFS_JOURNAL.mark_nrec;
+}
+
+/**
+ * @brief 当前事务再追加 extra 字节的记录后是否仍放得下日志区
+ *
+ * @param extra 
+ * @return boolean
+ */
+boolean newfs_journal_fits(int extra) {
+	return ROUND_UP(NEWFS_JOURNAL.len + extra, NEWFS_BLK_SZ) <= NEWFS_JOURNAL_SZ - NEWFS_BLK_SZ;
+}
+
+/**
+ * @brief 切换直写：打开期间数据区的元数据写（目录项块、extent 溢出块）不记入事务，
+ * 经块缓存直接写出，提交时随数据块先于日志落盘
+ * 只用于写入新分配、尚未被已提交的元数据引用的块（见 newfs_inode_relocate），
+ * 提交前崩溃时这些块仍为空闲，原来的块不受影响
+ *
+ * @param on 
+ */
+void newfs_journal_direct(boolean on) {
+	NEWFS_JOURNAL.direct = on;
+}
+
+/**
+ * @brief 元数据写：处于事务中时记入日志，否则直接写
+ *
+ * @param offset 起始地址
+ * @param in_content
+ * @param size 大小
+ * @return int
+ */
+int newfs_meta_write(int64_t offset, char* in_content, int size) {
+	struct newfs_jrec_d rec;
+	int   need = sizeof(struct newfs_jrec_d) + ROUND_UP(size, 4);
+	int   cap;
+	char* tmp;
+
+	if (!NEWFS_JOURNAL.is_active
+		|| (NEWFS_JOURNAL.direct && offset >= super.data_offset)) {
+		return newfs_driver_write(offset, in_content, size);
+	}
+	if (NEWFS_JOURNAL.len + need > NEWFS_JOURNAL.cap) {
+		cap = NEWFS_JOURNAL.cap;
+		while (NEWFS_JOURNAL.len + need > cap) {
+			cap *= 2;
+		}
+		tmp = (char*)realloc(NEWFS_JOURNAL.buf, cap);
+		if (tmp == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		NEWFS_JOURNAL.buf = tmp;
+		NEWFS_JOURNAL.cap = cap;
+	}
+
+	rec.offset = offset;
+	rec.len	   = size;
+	memcpy(NEWFS_JOURNAL.buf + NEWFS_JOURNAL.len, &rec, sizeof(struct newfs_jrec_d));
+	memcpy(NEWFS_JOURNAL.buf + NEWFS_JOURNAL.len + sizeof(struct newfs_jrec_d), in_content, size);
+	memset(NEWFS_JOURNAL.buf + NEWFS_JOURNAL.len + sizeof(struct newfs_jrec_d) + size, 0,
+		   ROUND_UP(size, 4) - size);
+	NEWFS_JOURNAL.len += need;
+	NEWFS_JOURNAL.nrec++;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 提交当前事务
+ *
+ * @return int 事务超过日志区时返回 -NEWFS_ERROR_NOSPACE，不写入任何内容
+ */
+int newfs_journal_commit() {
+	struct newfs_txn_d* txn_d = (struct newfs_txn_d*)NEWFS_JOURNAL.buf;
+	int   len = ROUND_UP(NEWFS_JOURNAL.len, NEWFS_BLK_SZ);
+	int   cap;
+	char* tmp;
+
+	NEWFS_JOURNAL.is_active = FALSE;
+	if (NEWFS_JOURNAL.nrec == 0) {
+		return NEWFS_ERROR_NONE;
+	}
+#ifdef NEWFS_FAULT_INJECT
+	if (newfs_options.fail_commits > 0) {
+		newfs_options.fail_commits--;
+		NEWFS_DBG("[%s] injected commit failure\n", __func__);
+		return -NEWFS_ERROR_IO;
+	}
+#endif
+	if (len > NEWFS_JOURNAL_SZ - NEWFS_BLK_SZ) {
+		NEWFS_DBG("[%s] transaction of %d bytes exceeds journal\n", __func__, len);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	txn_d->magic = NEWFS_JOURNAL_MAGIC;
+	txn_d->seq	 = NEWFS_JOURNAL.seq;
+	txn_d->nrec	 = NEWFS_JOURNAL.nrec;
+
+	// ordered：本事务引用的数据块先于日志落盘
+	if (newfs_cache_flush() != NEWFS_ERROR_NONE || NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+
+	if (NEWFS_JOURNAL.head + len > NEWFS_JOURNAL_SZ
+		&& newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+
+	if (len > NEWFS_JOURNAL.cap) {
+		cap = len;
+		tmp = (char*)realloc(NEWFS_JOURNAL.buf, cap);
+		if (tmp == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
+		}
+		NEWFS_JOURNAL.buf = tmp;
+		NEWFS_JOURNAL.cap = cap;
+		txn_d = (struct newfs_txn_d*)NEWFS_JOURNAL.buf;
+	}
+	memset(NEWFS_JOURNAL.buf + NEWFS_JOURNAL.len, 0, len - NEWFS_JOURNAL.len);
+	txn_d->len	 = len;
+	txn_d->csum	 = newfs_crc32(NEWFS_JOURNAL.buf + sizeof(struct newfs_txn_d),
+							   len - sizeof(struct newfs_txn_d));
+
+	if (newfs_dev_write(super.journal_offset + NEWFS_JOURNAL.head,
+						NEWFS_JOURNAL.buf, len) != NEWFS_ERROR_NONE
+		|| NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	NEWFS_JOURNAL.head += len;
+	NEWFS_JOURNAL.seq++;
+
+	return newfs_journal_apply(NEWFS_JOURNAL.buf);
+}
+
+/**
+ * @brief 检查点：已提交事务写回原位置并落盘后，日志从头开始
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+	if (newfs_cache_flush() != NEWFS_ERROR_NONE || NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	NEWFS_JOURNAL.head = NEWFS_BLK_SZ;
+	if (newfs_journal_write_hdr() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	return NEWFS_DRIVER->sync();
+}
+
+/**
+ * @brief 卸载时释放日志
+ */
+void newfs_journal_destroy() {
+	free(NEWFS_JOURNAL.buf);
+	memset(&NEWFS_JOURNAL, 0, sizeof(struct newfs_journal));
+}
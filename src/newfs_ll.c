@@ -0,0 +1,709 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: FUSE 低层接口
+* 内核以 inode 号（nodeid）发起请求，不再逐次从根解析路径。根目录为 FUSE_ROOT_ID，
+* 其余 nodeid 即内存中 newfs_inode 的地址：每次回复目录项时 lookup 计数加一，
+* forget 时减去，计数非 0 的 inode 不会被淘汰，地址因此一直有效。
+* 被删除但内核仍持有计数或仍被打开的 inode 从目录树摘除（dentry 置为 NULL），
+* 最后一次 forget 或 release 时释放。open / create 把持有 inode 的句柄存入 fi->fh，
+* 读写经句柄进行。目录项与属性带超时返回，不存在的项也由内核缓存
+*******************************************************************************/
+static struct fuse_session* ll_session = NULL;
+
+static struct newfs_inode* newfs_ll_inode(fuse_ino_t ino) {
+	if (ino == FUSE_ROOT_ID) {
+		return super.root_dentry->inode;
+	}
+	return (struct newfs_inode*)(uintptr_t)ino;
+}
+
+static double newfs_ll_timeout(int ms) {
+	return ms > 0 ? ms / 1000.0 : 0;
+}
+
+/**
+ * @brief 填充目录项回复并增加 lookup 计数，调用者持命名空间读锁
+ * 计数先于回复增加，内核收到回复后随时可能发来 forget
+ *
+ * @param dentry
+ * @param e
+ * @return struct newfs_inode* 加载失败返回 NULL
+ */
+static struct newfs_inode* newfs_ll_entry(struct newfs_dentry* dentry,
+										  struct fuse_entry_param* e) {
+	struct newfs_inode* inode = newfs_lookup_load(dentry);
+
+	if (inode == NULL) {
+		return NULL;
+	}
+	newfs_icache_touch(inode);
+	memset(e, 0, sizeof(*e));
+	e->ino			 = (fuse_ino_t)(uintptr_t)inode;
+	e->attr_timeout	 = newfs_ll_timeout(newfs_options.attr_timeout_ms);
+	e->entry_timeout = newfs_ll_timeout(newfs_options.entry_timeout_ms);
+	newfs_fill_stat(dentry, FALSE, &e->attr);
+	__atomic_add_fetch(&inode->nlookup, 1, __ATOMIC_RELAXED);
+	return inode;
+}
+
+/**
+ * @brief 回复目录项，调用者持命名空间读锁
+ *
+ * @param req
+ * @param dentry
+ */
+static void newfs_ll_reply_entry(fuse_req_t req, struct newfs_dentry* dentry) {
+	struct fuse_entry_param e;
+	struct newfs_inode* inode = newfs_ll_entry(dentry, &e);
+
+	if (inode == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_IO);
+		return;
+	}
+	if (fuse_reply_entry(req, &e) != 0) {
+		// 请求已被中断，内核不会为这次回复发 forget
+		__atomic_sub_fetch(&inode->nlookup, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * @brief 挂载文件系统，失败时结束会话
+ *
+ * @param userdata
+ * @param conn
+ */
+static void newfs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+	(void)userdata;
+	if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] mount error\n", __func__);
+		fuse_session_exit(ll_session);
+		return;
+	}
+	if (newfs_flusher_start() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] flusher start error\n", __func__);
+	}
+	if (newfs_ra_start() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] readahead start error\n", __func__);
+	}
+	newfs_data_conn_init(conn);
+}
+
+static void newfs_ll_destroy(void* userdata) {
+	(void)userdata;
+	newfs_ra_stop();
+	newfs_flusher_stop();
+	if (newfs_umount() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] unmount error\n", __func__);
+	}
+}
+
+/**
+ * @brief 在目录中查找，不存在时回复 ino 为 0 的目录项，由内核按 entry_timeout 缓存
+ *
+ * @param req
+ * @param parent 目录的 nodeid
+ * @param name 文件名
+ */
+static void newfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode*  dir = newfs_ll_inode(parent);
+	struct newfs_dentry* dentry;
+	struct fuse_entry_param e;
+
+	if (dir->dentry == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	newfs_inode_rdlock(dir);
+	dentry = newfs_dir_find(dir, name, strlen(name));
+	newfs_inode_unlock(dir);
+	if (dentry == NULL) {
+		memset(&e, 0, sizeof(e));
+		e.entry_timeout = newfs_ll_timeout(newfs_options.entry_timeout_ms);
+		fuse_reply_entry(req, &e);
+		return;
+	}
+	newfs_ll_reply_entry(req, dentry);
+}
+
+/**
+ * @brief 归还 lookup 计数，已删除的 inode 在计数归零时释放
+ *
+ * @param ino
+ * @param nlookup
+ */
+static void newfs_ll_forget_one(fuse_ino_t ino, uint64_t nlookup) {
+	struct newfs_inode* inode;
+
+	if (ino == FUSE_ROOT_ID) {
+		return;
+	}
+	inode = newfs_ll_inode(ino);
+	if (inode->dentry == NULL) {
+		newfs_orphan_put(inode, 0, nlookup);
+		return;
+	}
+	__atomic_sub_fetch(&inode->nlookup, nlookup, __ATOMIC_RELAXED);
+}
+
+static void newfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+	NEWFS_OP_LOCK();
+	newfs_ll_forget_one(ino, nlookup);
+	fuse_reply_none(req);
+}
+
+static void newfs_ll_forget_multi(fuse_req_t req, size_t count,
+								  struct fuse_forget_data* forgets) {
+	NEWFS_OP_LOCK();
+	for (size_t i = 0; i < count; i++) {
+		newfs_ll_forget_one(forgets[i].ino, forgets[i].nlookup);
+	}
+	fuse_reply_none(req);
+}
+
+/**
+ * @brief 获取属性，已被删除（仍被打开或引用）的 inode 链接数为 0
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode = newfs_ll_inode(ino);
+	struct stat st;
+
+	(void)fi;
+	if (inode->dentry == NULL) {
+		newfs_fill_stat_orphan(inode, &st);
+	} else {
+		newfs_fill_stat(inode->dentry, ino == FUSE_ROOT_ID, &st);
+	}
+	fuse_reply_attr(req, &st, newfs_ll_timeout(newfs_options.attr_timeout_ms));
+}
+
+/**
+ * @brief 取文件 inode，调用者持命名空间读锁
+ * 已打开时取句柄中的 inode（文件被删除后仍可用），否则 nodeid 须为仍在目录树中的文件
+ *
+ * @param ino
+ * @param fi 文件信息，可以为 NULL
+ * @param inode 返回的文件 inode
+ * @return int
+ */
+static int newfs_ll_file(fuse_ino_t ino, struct fuse_file_info* fi, struct newfs_inode** inode) {
+	if (fi != NULL && fi->fh != 0) {
+		*inode = ((struct newfs_fh*)(uintptr_t)fi->fh)->inode;
+		return NEWFS_ERROR_NONE;
+	}
+	*inode = newfs_ll_inode(ino);
+	if ((*inode)->dentry == NULL) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if ((*inode)->ftype == NEWFS_DIR) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ll_truncate(fuse_ino_t ino, struct fuse_file_info* fi, off_t size) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_ll_file(ino, fi, &inode);
+
+	return ret == NEWFS_ERROR_NONE ? newfs_data_truncate(inode, size) : ret;
+}
+
+/**
+ * @brief 修改属性，与高层接口一致：忽略时间与权限的修改，改变大小即截断
+ *
+ * @param req
+ * @param ino
+ * @param attr
+ * @param to_set FUSE_SET_ATTR_* 的组合
+ * @param fi
+ */
+static void newfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+							 int to_set, struct fuse_file_info* fi) {
+	int ret;
+
+	if (to_set & FUSE_SET_ATTR_SIZE) {
+		ret = newfs_ll_truncate(ino, fi, attr->st_size);
+		if (ret != NEWFS_ERROR_NONE) {
+			fuse_reply_err(req, -ret);
+			return;
+		}
+	}
+	newfs_ll_getattr(req, ino, fi);
+}
+
+/**
+ * @brief 在 parent 目录下新建文件或目录，调用者持命名空间读锁
+ *
+ * @param parent 目录的 nodeid
+ * @param name 文件名
+ * @param ftype
+ * @param dentry 返回新建的目录项
+ * @return int
+ */
+static int newfs_ll_mkentry(fuse_ino_t parent, const char* name, FILE_TYPE ftype,
+							struct newfs_dentry** dentry) {
+	struct newfs_inode* dir = newfs_ll_inode(parent);
+
+	if (dir->dentry == NULL) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dir->ftype != NEWFS_DIR) {
+		return -ENOTDIR;
+	}
+	return newfs_create(dir->dentry, name, ftype, dentry);
+}
+
+/**
+ * @brief newfs_ll_create_entry 的一次尝试，成功时回复
+ */
+static int newfs_ll_do_create_entry(fuse_req_t req, fuse_ino_t parent, const char* name,
+									FILE_TYPE ftype) {
+	NEWFS_OP_LOCK();
+	struct newfs_dentry* dentry;
+	int ret = newfs_ll_mkentry(parent, name, ftype, &dentry);
+
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_ll_reply_entry(req, dentry);
+	}
+	return ret;
+}
+
+static void newfs_ll_create_entry(fuse_req_t req, fuse_ino_t parent, const char* name,
+								  FILE_TYPE ftype) {
+	int ret = newfs_ll_do_create_entry(req, parent, name, ftype);
+
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_ll_do_create_entry(req, parent, name, ftype);
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+	}
+}
+
+static void newfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name,
+						   mode_t mode, dev_t rdev) {
+	(void)rdev;
+	newfs_ll_create_entry(req, parent, name, S_ISDIR(mode) ? NEWFS_DIR : NEWFS_FILE);
+}
+
+static void newfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+	(void)mode;
+	newfs_ll_create_entry(req, parent, name, NEWFS_DIR);
+}
+
+/**
+ * @brief newfs_ll_create 的一次尝试，文件建好后由它回复
+ *
+ * @return int 新建目录项的错误，未回复
+ */
+static int newfs_ll_do_create(fuse_req_t req, fuse_ino_t parent, const char* name,
+							  struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_dentry*	dentry;
+	struct newfs_inode*		inode;
+	struct newfs_fh*		fh;
+	struct fuse_entry_param e;
+	int ret = newfs_ll_mkentry(parent, name, NEWFS_FILE, &dentry);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	fh = newfs_fh_open(dentry->inode);
+	if (fh == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return NEWFS_ERROR_NONE;
+	}
+	inode = newfs_ll_entry(dentry, &e);
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	if (fuse_reply_create(req, &e, fi) != 0) {
+		__atomic_sub_fetch(&inode->nlookup, 1, __ATOMIC_RELAXED);
+		newfs_fh_close(fh);
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建并打开文件，回复失败时归还 lookup 计数并关闭句柄
+ *
+ * @param req
+ * @param parent 目录的 nodeid
+ * @param name 文件名
+ * @param mode
+ * @param fi fi->fh 保存句柄
+ */
+static void newfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name,
+							mode_t mode, struct fuse_file_info* fi) {
+	int ret = newfs_ll_do_create(req, parent, name, fi);
+
+	(void)mode;
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_ll_do_create(req, parent, name, fi);
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+	}
+}
+
+static void newfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	NEWFS_OP_LOCK_EXCL();
+	struct newfs_inode*  dir	= newfs_ll_inode(parent);
+	struct newfs_dentry* dentry = NULL;
+
+	if (dir->dentry != NULL) {
+		dentry = newfs_dir_find(dir, name, strlen(name));
+	}
+	if (dentry == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	if (dentry->ftype == NEWFS_DIR) {
+		fuse_reply_err(req, NEWFS_ERROR_ISDIR);
+		return;
+	}
+	fuse_reply_err(req, -newfs_remove_dentry(dentry));
+}
+
+static void newfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	NEWFS_OP_LOCK_EXCL();
+	struct newfs_inode*  dir	= newfs_ll_inode(parent);
+	struct newfs_dentry* dentry = NULL;
+
+	if (dir->dentry != NULL) {
+		dentry = newfs_dir_find(dir, name, strlen(name));
+	}
+	if (dentry == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	if (dentry->ftype != NEWFS_DIR) {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+	fuse_reply_err(req, -newfs_remove_dentry(dentry));
+}
+
+static void newfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode*		 inode = newfs_ll_inode(ino);
+	struct newfs_dir_cursor* cursor;
+
+	if (inode->dentry == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	if (inode->dentry->ftype != NEWFS_DIR) {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+	cursor = newfs_dir_open(inode);
+	if (cursor == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	if (fuse_reply_open(req, fi) != 0) {
+		newfs_dir_close(cursor);
+	}
+}
+
+/**
+ * @brief 从游标处继续填充目录项，一次尽量填满 size 字节
+ * fuse_add_direntry 只用到 inode 号与文件类型，不为子项加载 inode
+ *
+ * @param req
+ * @param ino
+ * @param size 缓冲区大小
+ * @param off 第几个目录项
+ * @param fi fi->fh 为 newfs_dir_cursor
+ */
+static void newfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+							 struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+	struct newfs_dentry*	 sub_dentry;
+	struct stat				 sub_stat;
+	size_t					 len = 0;
+	size_t					 ent_sz;
+	char*					 buf;
+
+	(void)ino;
+	if (cursor->inode == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	buf = (char*)malloc(size);
+	if (buf == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return;
+	}
+	memset(&sub_stat, 0, sizeof(sub_stat));
+
+	newfs_inode_rdlock(cursor->inode);
+	newfs_dir_seek(cursor, off);
+	while ((sub_dentry = cursor->next) != NULL) {
+		sub_stat.st_ino	 = sub_dentry->ino;
+		sub_stat.st_mode = sub_dentry->ftype == NEWFS_DIR ? S_IFDIR : S_IFREG;
+		ent_sz = fuse_add_direntry(req, buf + len, size - len, sub_dentry->fname,
+								   &sub_stat, cursor->off + 1);
+		if (ent_sz > size - len) {
+			break;
+		}
+		len += ent_sz;
+		cursor->next = sub_dentry->brother;
+		cursor->off++;
+	}
+	newfs_inode_unlock(cursor->inode);
+
+	fuse_reply_buf(req, buf, len);
+	free(buf);
+}
+
+/**
+ * @brief 打开文件，句柄保存在 fi->fh 中，持有 inode 直到 release
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	struct newfs_fh*	fh;
+	int ret = newfs_ll_file(ino, NULL, &inode);
+
+	if (ret != NEWFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fh = newfs_fh_open(inode);
+	if (fh == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	if (fuse_reply_open(req, fi) != 0) {
+		newfs_fh_close(fh);
+	}
+}
+
+static void newfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_fh* fh = (struct newfs_fh*)(uintptr_t)fi->fh;
+
+	(void)ino;
+	if (fh != NULL) {
+		newfs_fh_close(fh);
+	}
+	fuse_reply_err(req, NEWFS_ERROR_NONE);
+}
+
+static void newfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+
+	(void)ino;
+	if (cursor != NULL) {
+		newfs_dir_close(cursor);
+	}
+	fuse_reply_err(req, NEWFS_ERROR_NONE);
+}
+
+/**
+ * @brief 读文件，整块以设备 fd 段回复，由 FUSE 经 splice 交给内核
+ * fd 段的块由本线程的 pin 保持到回复发送完，之后放下
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi
+ */
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+						  struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	struct fuse_bufvec* bufv;
+	int ret = newfs_ll_file(ino, fi, &inode);
+
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_ra_read((struct newfs_fh*)(uintptr_t)fi->fh, off, size);
+		ret = newfs_data_read_buf(inode, &bufv, size, off, (struct newfs_fh*)(uintptr_t)fi->fh);
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+	newfs_data_unpin();
+	newfs_data_buf_free(bufv);
+}
+
+/**
+ * @brief newfs_ll_write_buf 的一次尝试，持命名空间读锁
+ */
+static int newfs_ll_do_write_buf(fuse_ino_t ino, struct fuse_bufvec* bufv, off_t off,
+								 struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_ll_file(ino, fi, &inode);
+
+	if (ret == NEWFS_ERROR_NONE) {
+		ret = newfs_data_write_buf(inode, bufv, off);
+	}
+	return ret;
+}
+
+/**
+ * @brief 写文件，bufv 可以是内存或管道
+ *
+ * @param req
+ * @param ino
+ * @param bufv
+ * @param off
+ * @param fi
+ */
+static void newfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv,
+							   off_t off, struct fuse_file_info* fi) {
+	size_t idx = bufv->idx;
+	size_t pos = bufv->off;
+	int ret	   = newfs_ll_do_write_buf(ino, bufv, off, fi);
+
+	// bufv 可能是管道，只有未被消费时才能重试，同 newfs_write_buf
+	if (bufv->idx == idx && bufv->off == pos && newfs_retry_nospace(ret)) {
+		ret = newfs_ll_do_write_buf(ino, bufv, off, fi);
+	}
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_write(req, ret);
+}
+
+/**
+ * @brief newfs_ll_fallocate 的一次尝试，持命名空间读锁
+ */
+static int newfs_ll_do_fallocate(fuse_ino_t ino, int mode, off_t off, off_t len,
+								 struct fuse_file_info* fi) {
+	NEWFS_OP_LOCK();
+	struct newfs_inode* inode;
+	int ret = newfs_ll_file(ino, fi, &inode);
+
+	if (ret == NEWFS_ERROR_NONE) {
+		ret = newfs_data_fallocate(inode, mode, off, len);
+	}
+	return ret;
+}
+
+/**
+ * @brief 预分配空间或打洞，支持 FALLOC_FL_KEEP_SIZE 与 FALLOC_FL_PUNCH_HOLE
+ *
+ * @param req
+ * @param ino
+ * @param mode
+ * @param off
+ * @param len
+ * @param fi
+ */
+static void newfs_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t off, off_t len,
+							   struct fuse_file_info* fi) {
+	int ret = newfs_ll_do_fallocate(ino, mode, off, len, fi);
+
+	if (newfs_retry_nospace(ret)) {
+		ret = newfs_ll_do_fallocate(ino, mode, off, len, fi);
+	}
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 关闭文件，不做回写，同 newfs_flush
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	fuse_reply_err(req, 0);
+}
+
+static void newfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+						   struct fuse_file_info* fi) {
+	int ret = newfs_sync_fs();
+
+	(void)ino;
+	(void)datasync;
+	(void)fi;
+	newfs_icache_reclaim(FALSE);
+	fuse_reply_err(req, -ret);
+}
+
+static const struct fuse_lowlevel_ops ll_operations = {
+	.init		  = newfs_ll_init,
+	.destroy	  = newfs_ll_destroy,
+	.lookup		  = newfs_ll_lookup,
+	.forget		  = newfs_ll_forget,
+	.forget_multi = newfs_ll_forget_multi,
+	.getattr	  = newfs_ll_getattr,
+	.setattr	  = newfs_ll_setattr,
+	.mknod		  = newfs_ll_mknod,
+	.mkdir		  = newfs_ll_mkdir,
+	.unlink		  = newfs_ll_unlink,
+	.rmdir		  = newfs_ll_rmdir,
+	.create		  = newfs_ll_create,
+	.open		  = newfs_ll_open,
+	.release	  = newfs_ll_release,
+	.read		  = newfs_ll_read,
+	.write_buf	  = newfs_ll_write_buf,
+	.fallocate	  = newfs_ll_fallocate,
+	.opendir	  = newfs_ll_opendir,
+	.readdir	  = newfs_ll_readdir,
+	.releasedir	  = newfs_ll_releasedir,
+	.flush		  = newfs_ll_flush,
+	.fsync		  = newfs_ll_fsync,
+	.fsyncdir	  = newfs_ll_fsync,
+};
+
+/**
+ * @brief 低层接口入口：解析挂载点与 -f/-s 等通用参数，建立会话并进入请求循环
+ *
+ * @param args fuse_opt_parse 处理后剩余的参数
+ * @return int 0 成功
+ */
+int newfs_ll_main(struct fuse_args* args) {
+	struct fuse_chan* ch;
+	char* mountpoint;
+	int	  multithreaded;
+	int	  foreground;
+	int	  ret = -1;
+
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+		return 1;
+	}
+	ch = fuse_mount(mountpoint, args);
+	if (ch == NULL) {
+		free(mountpoint);
+		return 1;
+	}
+	ll_session = fuse_lowlevel_new(args, &ll_operations, sizeof(ll_operations), NULL);
+	if (ll_session != NULL) {
+		if (fuse_set_signal_handlers(ll_session) == 0) {
+			fuse_session_add_chan(ll_session, ch);
+			fuse_daemonize(foreground);
+			ret = multithreaded ? fuse_session_loop_mt(ll_session)
+								: fuse_session_loop(ll_session);
+			fuse_remove_signal_handlers(ll_session);
+			fuse_session_remove_chan(ch);
+		}
+		fuse_session_destroy(ll_session);
+		ll_session = NULL;
+	}
+	fuse_unmount(mountpoint, ch);
+	free(mountpoint);
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 并发控制
+* 命名空间读写锁：所有 FUSE 操作持读锁并发执行，只有释放内存中 dentry / inode
+* 的操作（删除、淘汰）与回写时抓取事务快照持写锁。读锁期间拿到的 dentry 与
+* inode 指针一直有效，路径查找因此不需要逐层引用计数。
+* 目录内容（目录项链表、哈希索引、子 dentry 的懒加载）与文件内容由 inode 自身的
+* 读写锁保护，加锁顺序为：回写锁 -> 命名空间锁 -> 父目录 inode -> 子 inode ->
+* 分配器、块缓存等内部锁。写锁偏向写者，同一线程不得重复持读锁
+*******************************************************************************/
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+static pthread_mutex_t  wb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief FUSE 操作入口加命名空间读锁，配合 NEWFS_OP_LOCK 使用
+ * 本线程上一个请求的回复已发送，先放下它的 pin（见 newfs_data_read_buf）
+ *
+ * @return int
+ */
+int newfs_op_lock() {
+	newfs_data_unpin();
+	pthread_rwlock_rdlock(&ns_lock);
+	return 0;
+}
+
+/**
+ * @brief 需要释放 dentry 的操作（unlink、rmdir）加写锁，配合 NEWFS_OP_LOCK_EXCL 使用
+ *
+ * @return int
+ */
+int newfs_op_lock_excl() {
+	newfs_data_unpin();
+	pthread_rwlock_wrlock(&ns_lock);
+	return 1;
+}
+
+/**
+ * @brief FUSE 操作返回时解锁，再按需淘汰多余的 inode、唤醒回写线程
+ *
+ * @param unused
+ */
+void newfs_op_unlock(int* unused) {
+	(void)unused;
+	pthread_rwlock_unlock(&ns_lock);
+	if (super.is_mounted) {
+		newfs_icache_reclaim(FALSE);
+	}
+	newfs_flusher_kick();
+}
+
+void newfs_ns_wrlock() {
+	pthread_rwlock_wrlock(&ns_lock);
+}
+
+/**
+ * @brief 尝试加命名空间写锁，不等待
+ *
+ * @return boolean
+ */
+boolean newfs_ns_trywrlock() {
+	return pthread_rwlock_trywrlock(&ns_lock) == 0;
+}
+
+void newfs_ns_rdlock() {
+	pthread_rwlock_rdlock(&ns_lock);
+}
+
+void newfs_ns_unlock() {
+	pthread_rwlock_unlock(&ns_lock);
+}
+
+/**
+ * @brief 回写锁：同一时刻只有一个日志事务，事务外的回写（flush）与淘汰 inode 要等提交完成，
+ * 否则可能从设备读回尚未写回原位置的旧 inode
+ */
+void newfs_wb_lock() {
+	pthread_mutex_lock(&wb_lock);
+}
+
+boolean newfs_wb_trylock() {
+	return pthread_mutex_trylock(&wb_lock) == 0;
+}
+
+void newfs_wb_unlock() {
+	pthread_mutex_unlock(&wb_lock);
+}
+
+void newfs_inode_rdlock(struct newfs_inode* inode) {
+	pthread_rwlock_rdlock(&inode->lock);
+}
+
+void newfs_inode_wrlock(struct newfs_inode* inode) {
+	pthread_rwlock_wrlock(&inode->lock);
+}
+
+void newfs_inode_unlock(struct newfs_inode* inode) {
+	pthread_rwlock_unlock(&inode->lock);
+}
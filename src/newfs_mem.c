@@ -0,0 +1,266 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 内存池
+* inode 与 dentry 各用一个 slab：按 NEWFS_SLAB_SZ 整块向系统申请，块内顺序切分，
+* 释放的对象挂入空闲链表优先复用。文件名存放在名字区中，按 NEWFS_NAME_ALIGN 对齐
+* 分级，每级一条空闲链表。同一目录下连续创建/加载的对象在内存中也相邻。
+* 三个池各有一把锁，inode 的读写锁在分配时初始化
+*******************************************************************************/
+#define NEWFS_SLAB_SZ		(64 * 1024)
+#define NEWFS_NAME_ALIGN	8
+#define NEWFS_NAME_CLASSES	(MAX_NAME_LEN / NEWFS_NAME_ALIGN)
+
+struct newfs_chunk {
+	struct newfs_chunk*	next;
+};
+
+struct newfs_slab {
+	const char*			name;
+	int					obj_sz;			// 按 NEWFS_NAME_ALIGN 对齐的对象大小
+	struct newfs_chunk*	chunks;			// 已申请的整块
+	char*				cur;			// 当前块中未切分部分
+	int					left;
+	void*				free_list;		// 空闲对象，首 8 字节为 next
+	long				in_use;
+	pthread_mutex_t		lock;
+};
+
+static struct newfs_slab inode_slab = {
+	.name	= "inode",
+	.obj_sz	= ROUND_UP(sizeof(struct newfs_inode), NEWFS_NAME_ALIGN),
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+};
+static struct newfs_slab dentry_slab = {
+	.name	= "dentry",
+	.obj_sz	= ROUND_UP(sizeof(struct newfs_dentry), NEWFS_NAME_ALIGN),
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+};
+static struct newfs_slab name_arena = {
+	.name	= "name",
+	.obj_sz	= NEWFS_NAME_ALIGN,
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+};
+static void* name_free[NEWFS_NAME_CLASSES];		// 第 i 级存放 (i + 1) * NEWFS_NAME_ALIGN 字节的名字
+static long  name_bytes = 0;					// 名字实际占用字节数（含结尾 0）
+
+/**
+ * @brief 从当前整块中切出 size 字节，不足时申请新块，块尾剩余部分丢弃
+ *
+ * @param slab
+ * @param size
+ * @return void*
+ */
+static void* newfs_slab_carve(struct newfs_slab* slab, int size) {
+	struct newfs_chunk* chunk;
+	void* obj;
+
+	if (slab->left < size) {
+		chunk = (struct newfs_chunk*)malloc(NEWFS_SLAB_SZ);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next  = slab->chunks;
+		slab->chunks = chunk;
+		slab->cur	 = (char*)chunk + ROUND_UP(sizeof(struct newfs_chunk), NEWFS_NAME_ALIGN);
+		slab->left	 = NEWFS_SLAB_SZ - ROUND_UP(sizeof(struct newfs_chunk), NEWFS_NAME_ALIGN);
+	}
+	obj = slab->cur;
+	slab->cur  += size;
+	slab->left -= size;
+	return obj;
+}
+
+/**
+ * @brief 分配一个清零的对象
+ *
+ * @param slab
+ * @return void*
+ */
+static void* newfs_slab_alloc(struct newfs_slab* slab) {
+	void* obj;
+
+	pthread_mutex_lock(&slab->lock);
+	obj = slab->free_list;
+	if (obj != NULL) {
+		slab->free_list = *(void**)obj;
+	} else {
+		obj = newfs_slab_carve(slab, slab->obj_sz);
+		if (obj == NULL) {
+			pthread_mutex_unlock(&slab->lock);
+			return NULL;
+		}
+	}
+	slab->in_use++;
+	pthread_mutex_unlock(&slab->lock);
+	memset(obj, 0, slab->obj_sz);
+	return obj;
+}
+
+static void newfs_slab_free(struct newfs_slab* slab, void* obj) {
+	pthread_mutex_lock(&slab->lock);
+	*(void**)obj	= slab->free_list;
+	slab->free_list = obj;
+	slab->in_use--;
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * @brief 归还 slab 的全部整块
+ *
+ * @param slab
+ */
+static void newfs_slab_destroy(struct newfs_slab* slab) {
+	struct newfs_chunk* chunk;
+
+	while (slab->chunks != NULL) {
+		chunk		 = slab->chunks;
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+	slab->cur		= NULL;
+	slab->left		= 0;
+	slab->free_list = NULL;
+	slab->in_use	= 0;
+}
+
+static long newfs_slab_bytes(struct newfs_slab* slab) {
+	long bytes = 0;
+
+	for (struct newfs_chunk* chunk = slab->chunks; chunk != NULL; chunk = chunk->next) {
+		bytes += NEWFS_SLAB_SZ;
+	}
+	return bytes;
+}
+
+/**
+ * @brief 分配一个清零的 inode
+ *
+ * @return struct newfs_inode* 内存不足返回 NULL
+ */
+struct newfs_inode* newfs_inode_new() {
+	struct newfs_inode* inode = (struct newfs_inode*)newfs_slab_alloc(&inode_slab);
+
+	if (inode != NULL) {
+		pthread_rwlock_init(&inode->lock, NULL);
+	}
+	return inode;
+}
+
+void newfs_inode_release(struct newfs_inode* inode) {
+	pthread_rwlock_destroy(&inode->lock);
+	newfs_slab_free(&inode_slab, inode);
+}
+
+/**
+ * @brief 分配一个清零的 dentry
+ *
+ * @return struct newfs_dentry* 内存不足返回 NULL
+ */
+struct newfs_dentry* newfs_dentry_new() {
+	return (struct newfs_dentry*)newfs_slab_alloc(&dentry_slab);
+}
+
+/**
+ * @brief 释放 dentry 及其文件名
+ *
+ * @param dentry
+ */
+void newfs_dentry_release(struct newfs_dentry* dentry) {
+	if (dentry->fname != NULL) {
+		newfs_name_release(dentry->fname);
+	}
+	newfs_slab_free(&dentry_slab, dentry);
+}
+
+/**
+ * @brief 在名字区中复制文件名，不截断
+ *
+ * @param name
+ * @return char* 内存不足或名字不短于 MAX_NAME_LEN 时返回 NULL
+ */
+char* newfs_name_dup(const char* name) {
+	int	  len	= strnlen(name, MAX_NAME_LEN);
+	int	  cls	= len / NEWFS_NAME_ALIGN;	// len + 1 字节所在的级
+	char* str;
+
+	if (len >= MAX_NAME_LEN) {
+		return NULL;
+	}
+	pthread_mutex_lock(&name_arena.lock);
+	str = (char*)name_free[cls];
+	if (str != NULL) {
+		name_free[cls] = *(void**)str;
+	} else {
+		str = (char*)newfs_slab_carve(&name_arena, (cls + 1) * NEWFS_NAME_ALIGN);
+		if (str == NULL) {
+			pthread_mutex_unlock(&name_arena.lock);
+			return NULL;
+		}
+	}
+	name_arena.in_use++;
+	name_bytes += len + 1;
+	pthread_mutex_unlock(&name_arena.lock);
+	memcpy(str, name, len);
+	str[len] = '\0';
+	return str;
+}
+
+/**
+ * @brief 归还文件名，按长度放回对应级的空闲链表
+ *
+ * @param name
+ */
+void newfs_name_release(char* name) {
+	int len = strlen(name);
+	int cls = len / NEWFS_NAME_ALIGN;
+
+	pthread_mutex_lock(&name_arena.lock);
+	*(void**)name  = name_free[cls];
+	name_free[cls] = name;
+	name_arena.in_use--;
+	name_bytes -= len + 1;
+	pthread_mutex_unlock(&name_arena.lock);
+}
+
+/**
+ * @brief 内存使用统计
+ *
+ * @param stats
+ */
+void newfs_mem_stat(struct newfs_mem_stats* stats) {
+	pthread_mutex_lock(&inode_slab.lock);
+	pthread_mutex_lock(&dentry_slab.lock);
+	pthread_mutex_lock(&name_arena.lock);
+	stats->inodes		= inode_slab.in_use;
+	stats->dentries		= dentry_slab.in_use;
+	stats->names		= name_arena.in_use;
+	stats->name_bytes	= name_bytes;
+	stats->inode_bytes	= newfs_slab_bytes(&inode_slab);
+	stats->dentry_bytes = newfs_slab_bytes(&dentry_slab);
+	stats->arena_bytes	= newfs_slab_bytes(&name_arena);
+	pthread_mutex_unlock(&name_arena.lock);
+	pthread_mutex_unlock(&dentry_slab.lock);
+	pthread_mutex_unlock(&inode_slab.lock);
+}
+
+void newfs_mem_dump() {
+	struct newfs_mem_stats stats;
+
+	newfs_mem_stat(&stats);
+	NEWFS_DBG("[%s] inodes: %ld (%ld KB), dentries: %ld (%ld KB), names: %ld, %ld B (%ld KB)\n",
+			  __func__, stats.inodes, stats.inode_bytes / 1024, stats.dentries,
+			  stats.dentry_bytes / 1024, stats.names, stats.name_bytes, stats.arena_bytes / 1024);
+}
+
+/**
+ * @brief 卸载时整体归还内存池，之后所有 inode、dentry 与文件名均失效
+ */
+void newfs_mem_destroy() {
+	newfs_mem_dump();
+	newfs_slab_destroy(&inode_slab);
+	newfs_slab_destroy(&dentry_slab);
+	newfs_slab_destroy(&name_arena);
+	memset(name_free, 0, sizeof(name_free));
+	name_bytes = 0;
+}
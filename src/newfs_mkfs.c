@@ -0,0 +1,143 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 格式化
+* Layout
+* | Super | Journal | Inode Map | Data Map | Inode | Data |
+*
+* 按设备大小与块大小计算布局：inode 数 = 设备大小 / inode_ratio，日志约占设备的 1/256，
+* 其余空间扣除 data 位图后全部作为数据区。格式化只顺序写超级块、日志头、两张位图
+* 和根目录 inode，inode 表与数据区不需要清零
+*******************************************************************************/
+
+/**
+ * @brief 由设备大小计算布局，结果写入 super
+ *
+ * @param opts mkfs 参数
+ * @return int
+ */
+static int newfs_mkfs_layout(struct newfs_mkfs_options* opts) {
+	int64_t disk_blks = super.sz_disk / NEWFS_BLK_SZ;
+	int64_t max_ino;
+	int64_t journal_sz;
+	int bits_per_blk = NEWFS_BLKS_SZ(UINT8_BITS);
+	int journal_blks = opts->journal_blks;
+	int rest;
+
+	// 日志大小按字节计算，不随块大小变化
+	if (journal_blks <= 0) {
+		journal_sz	 = super.sz_disk / 256;
+		journal_sz	 = journal_sz < NEWFS_JOURNAL_MIN_SZ ? NEWFS_JOURNAL_MIN_SZ : journal_sz;
+		journal_sz	 = journal_sz > NEWFS_JOURNAL_MAX_SZ ? NEWFS_JOURNAL_MAX_SZ : journal_sz;
+		journal_blks = journal_sz / NEWFS_BLK_SZ;
+	}
+	journal_blks = journal_blks < NEWFS_JOURNAL_MIN_BLKS ? NEWFS_JOURNAL_MIN_BLKS : journal_blks;
+
+	// 块号与 inode 号为 int，超过 NEWFS_MAX_BLKS 的设备空间不使用
+	disk_blks = disk_blks > NEWFS_MAX_BLKS ? NEWFS_MAX_BLKS : disk_blks;
+	super.sz_disk		 = NEWFS_BLKS_SZ(disk_blks);
+
+	max_ino				 = super.sz_disk / opts->inode_ratio;
+	max_ino				 = max_ino > NEWFS_MAX_BLKS ? NEWFS_MAX_BLKS : max_ino;
+	super.max_ino		 = ROUND_UP(max_ino > NEWFS_ROOT_INO ? (int)max_ino : NEWFS_ROOT_INO + 1,
+									UINT8_BITS);
+	super.map_inode_blks = (super.max_ino + bits_per_blk - 1) / bits_per_blk;
+	super.inode_blks	 = ROUND_UP((int64_t)super.max_ino * (int64_t)sizeof(struct newfs_inode_d),
+									NEWFS_BLK_SZ) / NEWFS_BLK_SZ;
+	super.journal_blks	 = journal_blks;
+
+	// 剩余块由 data 位图与数据区分摊：每 bits_per_blk 个数据块需要 1 个位图块
+	rest = disk_blks - 1 - journal_blks - super.map_inode_blks - super.inode_blks;
+	if (rest < 2) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	super.map_data_blks	 = (rest + bits_per_blk) / (bits_per_blk + 1);
+	super.max_data_blks	 = rest - super.map_data_blks;
+
+	super.journal_offset   = NEWFS_SUPER_OFS + NEWFS_BLK_SZ;
+	super.map_inode_offset = super.journal_offset + NEWFS_BLKS_SZ(journal_blks);
+	super.map_data_offset  = super.map_inode_offset + NEWFS_BLKS_SZ(super.map_inode_blks);
+	super.inode_offset	   = super.map_data_offset + NEWFS_BLKS_SZ(super.map_data_blks);
+	super.data_offset	   = super.inode_offset + NEWFS_BLKS_SZ(super.inode_blks);
+	super.sz_usage		   = 0;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 格式化 newfs_options.device
+ *
+ * @param opts mkfs 参数
+ * @return int
+ */
+int newfs_mkfs(struct newfs_mkfs_options* opts) {
+	struct newfs_inode_d root_d;
+	int ret;
+
+	if (opts->inode_ratio < (int)sizeof(struct newfs_inode_d)) {
+		NEWFS_DBG("[%s] inode ratio %d too small\n", __func__, opts->inode_ratio);
+		return -NEWFS_ERROR_INVAL;
+	}
+
+	super.driver = newfs_driver_find(newfs_options.backend);
+	if (super.driver == NULL) {
+		NEWFS_DBG("[%s] unknown backend %s\n", __func__, newfs_options.backend);
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
+	ret = NEWFS_DRIVER->open(newfs_options.device);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	ret = NEWFS_DRIVER->geometry(&super.sz_disk, &super.sz_io);
+	if (ret == NEWFS_ERROR_NONE && !newfs_blk_sz_valid(opts->blk_sz)) {
+		NEWFS_DBG("[%s] unsupported block size %d\n", __func__, opts->blk_sz);
+		ret = -NEWFS_ERROR_INVAL;
+	}
+	if (ret == NEWFS_ERROR_NONE) {
+		super.blk_sz = opts->blk_sz;
+		ret = newfs_mkfs_layout(opts);
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		NEWFS_DRIVER->close();
+		return ret;
+	}
+
+	// 两张位图相邻，清零后一次写出，只占用根目录的 inode 号
+	super.map_inode = (char*)calloc(1, NEWFS_BLKS_SZ(super.map_inode_blks + super.map_data_blks));
+	if (super.map_inode == NULL) {
+		NEWFS_DRIVER->close();
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	super.map_data = super.map_inode + NEWFS_BLKS_SZ(super.map_inode_blks);
+	newfs_bitmap_set(super.map_inode, NEWFS_ROOT_INO);
+
+	memset(&root_d, 0, sizeof(struct newfs_inode_d));
+	root_d.ino	   = NEWFS_ROOT_INO;
+	root_d.ftype   = NEWFS_DIR;
+	root_d.ext_blk = NEWFS_BLK_NONE;
+
+	// 先抹掉旧超级块，中途失败时设备不会被当作旧文件系统挂载
+	super.state = NEWFS_STATE_CLEAN;
+	if (newfs_driver_write(NEWFS_SUPER_OFS, super.map_data + NEWFS_BLKS_SZ(super.map_data_blks) - NEWFS_BLK_SZ,
+						   NEWFS_BLK_SZ) != NEWFS_ERROR_NONE
+		|| newfs_driver_write(super.map_inode_offset, super.map_inode,
+						   NEWFS_BLKS_SZ(super.map_inode_blks + super.map_data_blks)) != NEWFS_ERROR_NONE
+		|| newfs_driver_write(NEWFS_INO_OFS(NEWFS_ROOT_INO), (char*)&root_d,
+							  sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE
+		|| newfs_journal_init(TRUE) != NEWFS_ERROR_NONE
+		|| NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE
+		|| newfs_write_super() != NEWFS_ERROR_NONE		// 超级块最后写，之前中断不会留下可挂载的半成品
+		|| NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
+		ret = -NEWFS_ERROR_IO;
+	}
+
+	printf("blocks: %lld x %d, inodes: %d, data blocks: %d, journal blocks: %d\n",
+		   (long long)(super.sz_disk / NEWFS_BLK_SZ), NEWFS_BLK_SZ, super.max_ino, super.max_data_blks,
+		   super.journal_blks);
+
+	newfs_journal_destroy();
+	free(super.map_inode);
+	super.map_inode = NULL;
+	super.map_data	= NULL;
+	NEWFS_DRIVER->close();
+	return ret;
+}
@@ -0,0 +1,174 @@
+#include "../include/newfs.h"
+#include <pthread.h>
+
+/******************************************************************************
+* SECTION: 顺序读预读
+* 每个打开的句柄记录上次读到的位置：从该位置继续读视为顺序读，预读窗口从请求
+* 大小的两倍（至少 NEWFS_RA_MIN_BLKS）开始，之后每次顺序命中翻倍，上限为
+* readahead_kb；离上次位置超过一个窗口的读视为随机访问，窗口清零不再预读。
+* 读者前方已预读的块不足半个窗口时，把下一段放入队列，由预读线程持 inode
+* 读锁读入内核页缓存（newfs_data_prefetch），读者不等待预读完成
+*******************************************************************************/
+static pthread_mutex_t	   ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	   ra_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t		   ra_tid;
+static boolean			   ra_running = FALSE;
+static boolean			   ra_stop	  = FALSE;
+static struct newfs_ra_req ra_queue[NEWFS_RA_QUEUE];
+static int				   ra_head	  = 0;
+static int				   ra_cnt	  = 0;
+
+/**
+ * @brief 执行一个预读请求并放下 inode
+ * inode 读锁排除了同一文件上的写入与截断，读入的块不会是过时内容
+ *
+ * @param req
+ */
+static void newfs_ra_run(struct newfs_ra_req* req) {
+	newfs_ns_rdlock();
+	if (super.is_mounted) {
+		newfs_inode_rdlock(req->inode);
+		newfs_data_prefetch(req->inode, req->lblk, req->cnt);
+		newfs_inode_unlock(req->inode);
+	}
+	newfs_inode_put(req->inode);
+	newfs_ns_unlock();
+}
+
+/**
+ * @brief 预读线程主循环，停止时丢弃尚未执行的请求
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_ra_main(void* arg) {
+	struct newfs_ra_req req;
+
+	pthread_mutex_lock(&ra_lock);
+	for (;;) {
+		while (ra_cnt == 0 && !ra_stop) {
+			pthread_cond_wait(&ra_cond, &ra_lock);
+		}
+		if (ra_cnt == 0) {
+			break;
+		}
+		req		= ra_queue[ra_head];
+		ra_head = (ra_head + 1) % NEWFS_RA_QUEUE;
+		ra_cnt--;
+		pthread_mutex_unlock(&ra_lock);
+		if (ra_stop) {
+			req.cnt = 0;
+		}
+		newfs_ra_run(&req);
+		pthread_mutex_lock(&ra_lock);
+	}
+	pthread_mutex_unlock(&ra_lock);
+	return NULL;
+}
+
+/**
+ * @brief 启动预读线程，readahead_kb <= 0 或后端不支持 fd 时不启动，读取不预读
+ * 文件数据不进入块缓存，没有 fd 时预读无处存放
+ *
+ * @return int
+ */
+int newfs_ra_start() {
+	if (newfs_options.readahead_kb <= 0 || !NEWFS_DRIVER->fd_io) {
+		return NEWFS_ERROR_NONE;
+	}
+	ra_stop = FALSE;
+	if (pthread_create(&ra_tid, NULL, newfs_ra_main, NULL) != 0) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	ra_running = TRUE;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止预读线程，在卸载前调用
+ */
+void newfs_ra_stop() {
+	if (!ra_running) {
+		return;
+	}
+	pthread_mutex_lock(&ra_lock);
+	ra_stop = TRUE;
+	pthread_cond_signal(&ra_cond);
+	pthread_mutex_unlock(&ra_lock);
+	pthread_join(ra_tid, NULL);
+	ra_running = FALSE;
+}
+
+/**
+ * @brief 放入预读请求，持有 inode 直到预读线程执行完；队列满时放弃
+ *
+ * @param inode
+ * @param lblk
+ * @param cnt
+ */
+static void newfs_ra_submit(struct newfs_inode* inode, int lblk, int cnt) {
+	struct newfs_ra_req* req;
+
+	pthread_mutex_lock(&ra_lock);
+	if (ra_cnt < NEWFS_RA_QUEUE && !ra_stop) {
+		req		   = &ra_queue[(ra_head + ra_cnt) % NEWFS_RA_QUEUE];
+		req->inode = inode;
+		req->lblk  = lblk;
+		req->cnt   = cnt;
+		ra_cnt++;
+		newfs_inode_hold(inode);
+		pthread_cond_signal(&ra_cond);
+	}
+	pthread_mutex_unlock(&ra_lock);
+}
+
+/**
+ * @brief 读取前更新句柄的预读状态，需要时发起异步预读，调用者持命名空间读锁
+ * 内核可能在同一句柄上并发发出相邻的读请求，落在上次位置一个窗口以内的乱序读
+ * 保持窗口不变，不算作随机访问
+ *
+ * @param fh 打开的句柄，NULL 时不预读
+ * @param off 文件内偏移
+ * @param size 读取字节数
+ */
+void newfs_ra_read(struct newfs_fh* fh, off_t off, size_t size) {
+	int64_t max	  = (int64_t)newfs_options.readahead_kb * 1024 / NEWFS_BLK_SZ;
+	int64_t start = off / NEWFS_BLK_SZ;
+	int64_t end	  = (off + (int64_t)size + NEWFS_BLK_SZ - 1) / NEWFS_BLK_SZ;
+	int64_t from  = 0;
+	int64_t to	  = 0;
+
+	if (fh == NULL || !ra_running || size == 0) {
+		return;
+	}
+	max = max > 0 ? max : 1;
+
+	pthread_mutex_lock(&fh->ra_lock);
+	if (off == fh->ra_pos) {
+		if (fh->ra_win == 0) {
+			fh->ra_win = 2 * (end - start) > NEWFS_RA_MIN_BLKS ? 2 * (end - start)
+															   : NEWFS_RA_MIN_BLKS;
+		} else {
+			fh->ra_win *= 2;
+		}
+		fh->ra_win = fh->ra_win < max ? fh->ra_win : max;
+		fh->ra_pos = off + size;
+	} else if (fh->ra_win == 0 || off < fh->ra_pos - NEWFS_BLKS_SZ(fh->ra_win)
+			   || off > fh->ra_pos + NEWFS_BLKS_SZ(fh->ra_win)) {
+		fh->ra_win	= 0;
+		fh->ra_next = 0;
+		fh->ra_pos	= off + size;
+	} else if (off + (int64_t)size > fh->ra_pos) {
+		fh->ra_pos = off + size;
+	}
+	if (fh->ra_win > 0 && fh->ra_next - end < fh->ra_win / 2 + 1) {
+		from = fh->ra_next > end ? fh->ra_next : end;
+		to	 = end + fh->ra_win;
+		fh->ra_next = to;
+	}
+	pthread_mutex_unlock(&fh->ra_lock);
+
+	if (to > from && from < NEWFS_MAX_BLKS) {
+		newfs_ra_submit(fh->inode, from, (to < NEWFS_MAX_BLKS ? to : NEWFS_MAX_BLKS) - from);
+	}
+}
@@ -0,0 +1,238 @@
+#include "../include/newfs.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/******************************************************************************
+* SECTION: io_uring 后端
+* 直接使用 io_uring_setup / io_uring_enter 系统调用，不依赖 liburing
+* 单次读写仍走 pread/pwrite，批量请求（缓存回写、目录预取）一次提交、一次收割
+*******************************************************************************/
+struct newfs_uring {
+	int				ring_fd;
+	unsigned		entries;
+
+	void*			sq_ptr;
+	size_t			sq_sz;
+	void*			cq_ptr;
+	size_t			cq_sz;
+	struct io_uring_sqe* sqes;
+	size_t			sqes_sz;
+
+	unsigned*		sq_head;
+	unsigned*		sq_tail;
+	unsigned*		sq_mask;
+	unsigned*		sq_array;
+	unsigned*		cq_head;
+	unsigned*		cq_tail;
+	unsigned*		cq_mask;
+	struct io_uring_cqe* cqes;
+
+	struct iovec*	iovs;
+};
+
+static struct newfs_uring ring;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int newfs_uring_setup(unsigned entries, struct io_uring_params* p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int newfs_uring_enter(unsigned to_submit, unsigned min_complete) {
+	return (int)syscall(__NR_io_uring_enter, ring.ring_fd, to_submit, min_complete,
+						IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void newfs_uring_unmap() {
+	if (ring.sqes != NULL && ring.sqes != MAP_FAILED) {
+		munmap(ring.sqes, ring.sqes_sz);
+	}
+	if (ring.cq_ptr != NULL && ring.cq_ptr != MAP_FAILED && ring.cq_ptr != ring.sq_ptr) {
+		munmap(ring.cq_ptr, ring.cq_sz);
+	}
+	if (ring.sq_ptr != NULL && ring.sq_ptr != MAP_FAILED) {
+		munmap(ring.sq_ptr, ring.sq_sz);
+	}
+	if (ring.ring_fd > 0) {
+		close(ring.ring_fd);
+	}
+	free(ring.iovs);
+	memset(&ring, 0, sizeof(ring));
+}
+
+/**
+ * @brief 打开镜像文件并建立深度为 --queue-depth 的 io_uring
+ * 
+ * @param path 
+ * @return int 
+ */
+int newfs_uring_open(const char* path) {
+	struct io_uring_params p;
+	unsigned depth = newfs_options.queue_depth > 0 ? newfs_options.queue_depth : 64;
+	int fd = open(path, O_RDWR);
+
+	if (fd < 0) {
+		return -errno;
+	}
+	super.fd = fd;
+
+	memset(&ring, 0, sizeof(ring));
+	memset(&p, 0, sizeof(p));
+	ring.ring_fd = newfs_uring_setup(depth, &p);
+	if (ring.ring_fd < 0) {
+		NEWFS_DBG("[%s] io_uring_setup failed: %s\n", __func__, strerror(errno));
+		ring.ring_fd = 0;
+		close(fd);
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
+	ring.entries = p.sq_entries;
+
+	ring.sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_sz > ring.sq_sz) {
+			ring.sq_sz = ring.cq_sz;
+		}
+		ring.cq_sz = ring.sq_sz;
+	}
+	ring.sq_ptr = mmap(NULL, ring.sq_sz, PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ptr == MAP_FAILED) {
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	} else {
+		ring.cq_ptr = mmap(NULL, ring.cq_sz, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_CQ_RING);
+		if (ring.cq_ptr == MAP_FAILED) {
+			goto err;
+		}
+	}
+	ring.sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = (struct io_uring_sqe*)mmap(NULL, ring.sqes_sz, PROT_READ | PROT_WRITE,
+										   MAP_SHARED | MAP_POPULATE, ring.ring_fd,
+										   IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED) {
+		goto err;
+	}
+
+	ring.sq_head  = (unsigned*)((char*)ring.sq_ptr + p.sq_off.head);
+	ring.sq_tail  = (unsigned*)((char*)ring.sq_ptr + p.sq_off.tail);
+	ring.sq_mask  = (unsigned*)((char*)ring.sq_ptr + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned*)((char*)ring.sq_ptr + p.sq_off.array);
+	ring.cq_head  = (unsigned*)((char*)ring.cq_ptr + p.cq_off.head);
+	ring.cq_tail  = (unsigned*)((char*)ring.cq_ptr + p.cq_off.tail);
+	ring.cq_mask  = (unsigned*)((char*)ring.cq_ptr + p.cq_off.ring_mask);
+	ring.cqes	  = (struct io_uring_cqe*)((char*)ring.cq_ptr + p.cq_off.cqes);
+
+	ring.iovs = (struct iovec*)malloc(ring.entries * sizeof(struct iovec));
+	if (ring.iovs == NULL) {
+		goto err;
+	}
+	return NEWFS_ERROR_NONE;
+err:
+	newfs_uring_unmap();
+	close(fd);
+	return -NEWFS_ERROR_IO;
+}
+
+int newfs_uring_close() {
+	newfs_uring_unmap();
+	return close(super.fd) < 0 ? -errno : NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 批量提交读写请求，每轮最多填满一次提交队列，等待整轮完成后继续
+ * 短读写按 pread/pwrite 补齐剩余部分。调用者持有 ring_lock
+ * 
+ * @param reqs 请求数组
+ * @param cnt 请求个数
+ * @return int 
+ */
+static int newfs_uring_do_submit(struct newfs_io_req* reqs, int cnt) {
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	struct newfs_io_req* req;
+	unsigned tail;
+	unsigned head;
+	int		 batch;
+	int		 submitted;
+	int		 reaped;
+	int		 n;
+	int		 ret = NEWFS_ERROR_NONE;
+
+	while (cnt > 0) {
+		batch = cnt < (int)ring.entries ? cnt : (int)ring.entries;
+		tail  = *ring.sq_tail;
+		for (int i = 0; i < batch; i++) {
+			unsigned idx = (tail + i) & *ring.sq_mask;
+			sqe = &ring.sqes[idx];
+			memset(sqe, 0, sizeof(*sqe));
+			ring.iovs[i].iov_base = reqs[i].buf;
+			ring.iovs[i].iov_len  = reqs[i].size;
+			sqe->opcode    = reqs[i].op == NEWFS_IO_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe->fd        = super.fd;
+			sqe->off       = reqs[i].offset;
+			sqe->addr      = (unsigned long)&ring.iovs[i];
+			sqe->len       = 1;
+			sqe->user_data = i;
+			ring.sq_array[idx] = idx;
+		}
+		__atomic_store_n(ring.sq_tail, tail + batch, __ATOMIC_RELEASE);
+
+		submitted = 0;
+		reaped	  = 0;
+		while (reaped < batch) {
+			n = newfs_uring_enter(batch - submitted, 1);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -NEWFS_ERROR_IO;
+			}
+			submitted += n;
+			head = *ring.cq_head;
+			while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+				cqe = &ring.cqes[head & *ring.cq_mask];
+				req = &reqs[cqe->user_data];
+				if (cqe->res < 0) {
+					ret = -NEWFS_ERROR_IO;
+				} else if (cqe->res < req->size) {
+					int done = cqe->res;
+					int rest = req->size - done;
+					ssize_t n = req->op == NEWFS_IO_WRITE
+						? pwrite(super.fd, req->buf + done, rest, req->offset + done)
+						: pread(super.fd, req->buf + done, rest, req->offset + done);
+					if (n != rest) {
+						ret = -NEWFS_ERROR_IO;
+					}
+				}
+				head++;
+				reaped++;
+			}
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		}
+
+		reqs += batch;
+		cnt  -= batch;
+	}
+	return ret;
+}
+
+/**
+ * @brief 批量提交读写请求，队列为所有线程共用，整批持锁提交与收割
+ * 
+ * @param reqs 请求数组
+ * @param cnt 请求个数
+ * @return int 
+ */
+int newfs_uring_submit(struct newfs_io_req* reqs, int cnt) {
+	int ret;
+
+	pthread_mutex_lock(&ring_lock);
+	ret = newfs_uring_do_submit(reqs, cnt);
+	pthread_mutex_unlock(&ring_lock);
+	return ret;
+}
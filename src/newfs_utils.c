@@ -1,12 +1,21 @@
 #include "../include/newfs.h"
+#include <limits.h>
 
 /******************************************************************************
 * SECTION: 工具函数
 *******************************************************************************/
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;	/* 保护脏链表 */
+
 struct newfs_dentry* new_dentry(char *fname, FILE_TYPE ftype) {
-    struct newfs_dentry * dentry = (struct newfs_dentry*) malloc(sizeof (struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    memcpy(dentry->fname, fname, MAX_NAME_LEN);
+    struct newfs_dentry * dentry = newfs_dentry_new();
+    if (dentry == NULL) {
+        return NULL;
+    }
+    dentry->fname = newfs_name_dup(fname);
+    if (dentry->fname == NULL) {
+        newfs_dentry_release(dentry);
+        return NULL;
+    }
     dentry->ftype = ftype;
     dentry->ino   = -1;
     dentry->inode     = NULL;
@@ -15,62 +24,199 @@ struct newfs_dentry* new_dentry(char *fname, FILE_TYPE ftype) {
 	return dentry;
 }
 
+static pthread_key_t  scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void newfs_scratch_key_init() {
+	pthread_key_create(&scratch_key, free);
+}
+
+/**
+ * @brief 获取当前线程的暂存缓冲区，容量不足时扩容
+ * 非对齐读写在这里完成拼接，避免每次调用都 malloc/free；FUSE 工作线程退出时随线程释放
+ * 
+ * @param size 需要的字节数
+ * @return char* 缓冲区地址，失败返回 NULL
+ */
+static char* newfs_get_scratch(int size) {
+	static __thread char*	scratch		= NULL;
+	static __thread int		scratch_sz	= 0;
+	char*					tmp;
+
+	if (size > scratch_sz) {
+		pthread_once(&scratch_once, newfs_scratch_key_init);
+		tmp = (char*)realloc(scratch, size);
+		if (tmp == NULL) {
+			return NULL;
+		}
+		scratch		= tmp;
+		scratch_sz	= size;
+		pthread_setspecific(scratch_key, scratch);
+	}
+	return scratch;
+}
+
+/**
+ * @brief 块大小是否合法：NEWFS_DEFAULT_BLK_SZ 到 NEWFS_MAX_BLK_SZ 之间的 2 的幂，
+ * 且为设备 IO 单元的整数倍
+ * 
+ * @param blk_sz 块大小
+ * @return boolean 
+ */
+boolean newfs_blk_sz_valid(int blk_sz) {
+	return blk_sz >= NEWFS_DEFAULT_BLK_SZ && blk_sz <= NEWFS_MAX_BLK_SZ
+		&& (blk_sz & (blk_sz - 1)) == 0 && blk_sz % super.sz_io == 0;
+}
+
+/**
+ * @brief 块设备读，offset 与 size 必须按 NEWFS_IO_SZ 对齐
+ * 连续的 IO 单元作为一次请求交给存储后端
+ * 
+ * @param offset 起始地址
+ * @param out_content 指针地址
+ * @param size 大小
+ * @return 0 成功，否则失败
+ */
+int newfs_dev_read(int64_t offset, char *out_content, int size) {
+	return NEWFS_DRIVER->read(offset, out_content, size);
+}
+
+/**
+ * @brief 块设备写，offset 与 size 必须按 NEWFS_IO_SZ 对齐
+ * 
+ * @param offset 起始地址
+ * @param in_content 指针地址
+ * @param size 大小
+ * @return 0 成功，否则失败
+ */
+int newfs_dev_write(int64_t offset, char *in_content, int size) {
+	return NEWFS_DRIVER->write(offset, in_content, size);
+}
+
+/**
+ * @brief 批量提交块设备请求，后端支持时一次提交、一次收割
+ * 
+ * @param reqs 请求数组
+ * @param cnt 请求个数
+ * @return 0 成功，否则失败
+ */
+int newfs_dev_submit(struct newfs_io_req* reqs, int cnt) {
+	int ret;
+
+	if (NEWFS_DRIVER->submit != NULL) {
+		return NEWFS_DRIVER->submit(reqs, cnt);
+	}
+	for (int i = 0; i < cnt; i++) {
+		ret = reqs[i].op == NEWFS_IO_WRITE
+			? NEWFS_DRIVER->write(reqs[i].offset, reqs[i].buf, reqs[i].size)
+			: NEWFS_DRIVER->read(reqs[i].offset, reqs[i].buf, reqs[i].size);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	return NEWFS_ERROR_NONE;
+}
+
 /**
- * @param 驱动读
+ * @brief 块设备读，offset 与 size 不要求对齐，不经过块缓存
+ * 对齐的请求直接读入目标地址，非对齐的请求经由线程暂存缓冲区中转
  * 
  * @param offset 起始地址
  * @param out_content 指针地址
  * @param size 大小
  * @return 0 成功，否则失败
  */
-int newfs_driver_read(int offset, char *out_content, int size) {
-    int			offset_aligned	= ROUND_DOWN(offset, NEWFS_IO_SZ);
+int newfs_dev_pread(int64_t offset, char *out_content, int size) {
+	int64_t		offset_aligned	= ROUND_DOWN(offset, NEWFS_IO_SZ);
 	int			bias			= offset - offset_aligned;
 	int			size_aligned	= ROUND_UP(size + bias, NEWFS_IO_SZ);
-	char*	tmp_content		= (char*)malloc(size_aligned);
-	char*	cur 			= tmp_content;
+	char*		tmp_content;
+	int			ret;
+
+	if (bias == 0 && size == size_aligned) {
+		return newfs_dev_read(offset, out_content, size);
+	}
+
+	tmp_content = newfs_get_scratch(size_aligned);
+	if (tmp_content == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 
-	// 读取整个块
-	ddriver_seek(NEWFS_DRIVER, offset_aligned, SEEK_SET);
-	while (size_aligned != 0) {
-		ddriver_read(NEWFS_DRIVER, cur, NEWFS_IO_SZ);
-		cur 			+= NEWFS_IO_SZ;
-		size_aligned 	-= NEWFS_IO_SZ;
+	ret = newfs_dev_read(offset_aligned, tmp_content, size_aligned);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
 	}
 
 	// 将目标区域内容复制到目标地址中
 	memcpy(out_content, tmp_content + bias, size);
-	free(tmp_content);
 	return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 驱动读
+ * 启用块缓存时经缓存读取；否则直接读设备（newfs_dev_pread）
+ * 
+ * @param offset 起始地址
+ * @param out_content 指针地址
+ * @param size 大小
+ * @return 0 成功，否则失败
+ */
+int newfs_driver_read(int64_t offset, char *out_content, int size) {
+	if (newfs_cache_enabled()) {
+		return newfs_cache_read(offset, out_content, size);
+	}
+	return newfs_dev_pread(offset, out_content, size);
+}
+
 /**
  * @brief 驱动写
+ * 启用块缓存时只写入缓存并标记脏块；否则对齐的请求直接写入设备，
+ * 非对齐的请求只对首尾不完整的 IO 单元做读改写
  * 
  * @param offset 
  * @param in_content 
  * @param size 
  * @return int 
  */
-int newfs_driver_write(int offset, char *in_content, int size) {
-	int			offset_aligned	= ROUND_DOWN(offset, NEWFS_IO_SZ);
+int newfs_driver_write(int64_t offset, char *in_content, int size) {
+	int64_t		offset_aligned	= ROUND_DOWN(offset, NEWFS_IO_SZ);
 	int			bias			= offset - offset_aligned;
 	int			size_aligned	= ROUND_UP(size + bias, NEWFS_IO_SZ);
-	char*	tmp_content 	= (char*)malloc(size_aligned);
-	char*	cur 			= tmp_content;
+	int			tail_offset		= size_aligned - NEWFS_IO_SZ;
+	char*		tmp_content;
+	int			ret;
 
-	newfs_driver_read(offset_aligned, tmp_content, size_aligned);
-	memcpy(tmp_content + bias, in_content, size);
+	if (newfs_cache_enabled()) {
+		return newfs_cache_write(offset, in_content, size);
+	}
 
-	ddriver_seek(NEWFS_DRIVER, offset_aligned, SEEK_SET);
-	while (size_aligned != 0) {
-		ddriver_write(NEWFS_DRIVER, cur, NEWFS_IO_SZ);
-		cur				+= NEWFS_IO_SZ;
-		size_aligned	-= NEWFS_IO_SZ;
+	if (bias == 0 && size == size_aligned) {
+		return newfs_dev_write(offset, in_content, size);
 	}
 
-	free(tmp_content);
-	return NEWFS_ERROR_NONE;
+	tmp_content = newfs_get_scratch(size_aligned);
+	if (tmp_content == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	// 首部不完整
+	if (bias != 0) {
+		ret = newfs_dev_read(offset_aligned, tmp_content, NEWFS_IO_SZ);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	// 尾部不完整，且与首部不是同一个 IO 单元
+	if ((bias + size) % NEWFS_IO_SZ != 0 && (tail_offset != 0 || bias == 0)) {
+		ret = newfs_dev_read(offset_aligned + tail_offset, tmp_content + tail_offset,
+							 NEWFS_IO_SZ);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	memcpy(tmp_content + bias, in_content, size);
+
+	return newfs_dev_write(offset_aligned, tmp_content, size_aligned);
 }
 
 
@@ -83,45 +229,25 @@ int newfs_driver_write(int offset, char *in_content, int size) {
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry* dentry) {
 	struct newfs_inode* inode;
-	int byte_cursor = 0;
-	int bit_cursor	= 0;
-	int ino_cursor	= 0;
-	int data_blks	= 0;
-	int init_blks	= 1;
-	boolean is_find_free_entry = FALSE;
-
-	if (strcmp(dentry->fname, "/") == 0) {
-		ino_cursor = NEWFS_ROOT_INO;
-		super.map_inode[0] |= (0x1 << NEWFS_ROOT_INO);
-		is_find_free_entry = TRUE;
-	} else {
-		// 分配索引节点位图，找到空闲位置 ino_cursor
-		for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(super.map_inode_blks);
-			byte_cursor++) {
-			for (bit_cursor = 0; bit_cursor < UINT8_BITS; ++bit_cursor) {
-				if ((super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {
-					super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-					is_find_free_entry = TRUE;
-					break;
-				}
-				ino_cursor++;
-			}
-			if (is_find_free_entry)
-				break;
-		}
-	}
+	int ino_cursor;
 
-	if (!is_find_free_entry || ino_cursor >= super.max_ino)
+	// 分配索引节点位图，找到空闲位置 ino_cursor，根目录由 mkfs 创建
+	ino_cursor = newfs_alloc_ino();
+	if (ino_cursor < 0)
 		return (struct newfs_inode*)-NEWFS_ERROR_NOSPACE;
 
 	// 初始化 inode 属性值
-	inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+	inode = newfs_inode_new();
+	if (inode == NULL) {
+		newfs_free_ino(ino_cursor);
+		return (struct newfs_inode*)-NEWFS_ERROR_NOSPACE;
+	}
 
-	memset(inode->block_pos, 0, sizeof(inode->block_pos));
 	inode->ino	= ino_cursor;
 	inode->size	= 0;
 	inode->link = 0;
-	inode->blks = 1;
+	inode->blks = 0;
+	inode->ftype = dentry->ftype;
 
 	dentry->inode	= inode;
 	dentry->ino		= inode->ino;
@@ -131,37 +257,187 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry* dentry) {
 	inode->dir_cnt	= 0;
 	inode->dentrys	= NULL;
 
-	// 分配数据块位图
-	// 只分配 1 个数据块，后续再进行扩展
-	ino_cursor = 0;
-	while (data_blks < init_blks && ino_cursor < super.max_data_blks) {
-		for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(super.map_data_blks); ++byte_cursor) {
-			for (bit_cursor = 0; bit_cursor < UINT8_BITS; ++bit_cursor) {
-				if ((super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {
-					super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-					inode->block_pos[data_blks++] = ino_cursor;
-				}
-				++ino_cursor;
+	// 数据块在写入（文件）或添加目录项（目录）时才分配，空文件不占数据块
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE);
+	newfs_icache_add(inode);
 
-				if (data_blks >= init_blks || ino_cursor >= super.max_data_blks) break;
-			}
-			if (data_blks >= init_blks || ino_cursor >= super.max_data_blks) break;
+	return inode;
+}
+
+/**
+ * @brief 将 inode 标记为脏并挂入脏链表，由 newfs_writeback 统一回写
+ * 调用者持有 inode 的写锁
+ * 
+ * @param inode 
+ * @param flags NEWFS_DIRTY_* 的组合
+ */
+void newfs_mark_dirty(struct newfs_inode* inode, int flags) {
+	int added = flags & ~inode->dirty;
+	int bytes = 0;
+
+	if (added == 0) {
+		return;
+	}
+	if (added & NEWFS_DIRTY_INODE) {
+		bytes += sizeof(struct newfs_inode_d);
+	}
+	if (added & NEWFS_DIRTY_DENTRY) {
+		bytes += NEWFS_BLKS_SZ(inode->blks);
+	}
+	if (added & NEWFS_DIRTY_DATA) {
+		bytes += NEWFS_BLK_SZ;			// 整块写入直接落到设备，内存中只有不完整的块
+	}
+	inode->dirty_bytes += bytes;
+	__atomic_add_fetch(&super.dirty_bytes, bytes, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&dirty_lock);
+	if (inode->dirty == 0) {
+		if (super.dirty_inodes == NULL) {
+			super.dirty_since = newfs_now_ms();
 		}
+		inode->dirty_prev = NULL;
+		inode->dirty_next = super.dirty_inodes;
+		if (super.dirty_inodes != NULL) {
+			super.dirty_inodes->dirty_prev = inode;
+		}
+		super.dirty_inodes = inode;
 	}
-	if (data_blks < init_blks || ino_cursor >= super.max_data_blks)
-		return (struct newfs_inode*)-NEWFS_ERROR_NOSPACE;
+	inode->dirty |= flags;
+	pthread_mutex_unlock(&dirty_lock);
+}
 
-	// 分配数据块缓存空间
-	if (inode->dentry->ftype == NEWFS_FILE) {
-		inode->block_pointer[0] = (char*)malloc(sizeof(NEWFS_BLK_SZ));
+/**
+ * @brief 增加脏 inode 的待回写字节数估算，用于延迟分配块的内存缓存
+ * 调用者持有 inode 的写锁，且 inode 已标记为脏
+ * 
+ * @param inode 
+ * @param bytes 
+ */
+void newfs_dirty_add(struct newfs_inode* inode, int bytes) {
+	inode->dirty_bytes += bytes;
+	__atomic_add_fetch(&super.dirty_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 清除脏标志并从脏链表摘除
+ * 
+ * @param inode 
+ */
+void newfs_clean_inode(struct newfs_inode* inode) {
+	if (inode->dirty == 0) {
+		return;
 	}
-	
-	return inode;
+	pthread_mutex_lock(&dirty_lock);
+	if (inode->dirty_prev != NULL) {
+		inode->dirty_prev->dirty_next = inode->dirty_next;
+	} else {
+		super.dirty_inodes = inode->dirty_next;
+	}
+	if (inode->dirty_next != NULL) {
+		inode->dirty_next->dirty_prev = inode->dirty_prev;
+	}
+	__atomic_sub_fetch(&super.dirty_bytes, inode->dirty_bytes, __ATOMIC_RELAXED);
+	inode->dirty_bytes = 0;
+	inode->dirty	  = 0;
+	inode->dirty_prev = NULL;
+	inode->dirty_next = NULL;
+	pthread_mutex_unlock(&dirty_lock);
+}
+
+/**
+ * @brief 最早的未回写修改的时间，供回写线程判断是否超时
+ * 
+ * @return long 脏链表为空时返回 -1
+ */
+long newfs_dirty_oldest() {
+	long since;
+
+	pthread_mutex_lock(&dirty_lock);
+	since = super.dirty_inodes != NULL ? super.dirty_since : -1;
+	pthread_mutex_unlock(&dirty_lock);
+	return since;
+}
+
+/**
+ * @brief 脏链表上的 inode 数，调用者持命名空间写锁
+ * 
+ * @return int 
+ */
+static int newfs_dirty_count() {
+	int cnt = 0;
+
+	for (struct newfs_inode* inode = super.dirty_inodes; inode != NULL; inode = inode->dirty_next) {
+		cnt++;
+	}
+	return cnt;
 }
 
 
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 从逻辑块 lblk 开始物理连续的目录块数，不超过 nblks 和 NEWFS_DIR_BATCH_BLKS
+ * 
+ * @param inode 目录 inode
+ * @param lblk 起始逻辑块
+ * @param nblks 目录项占用的逻辑块数
+ * @return int 
+ */
+static int newfs_dir_run(struct newfs_inode* inode, int lblk, int nblks) {
+	int pblk = newfs_bmap(inode, lblk);
+	int run  = 1;
+
+	while (lblk + run < nblks && run < NEWFS_DIR_BATCH_BLKS
+		   && newfs_bmap(inode, lblk + run) == pblk + run) {
+		run++;
+	}
+	return run;
+}
+
+/**
+ * @brief 仅去掉部分脏标志，没有剩余标志时从脏链表摘除
+ * 
+ * @param inode 
+ * @param flags 
+ */
+static void newfs_clean_flags(struct newfs_inode* inode, int flags) {
+	if ((inode->dirty & ~flags) == 0) {
+		newfs_clean_inode(inode);
+		return;
+	}
+	pthread_mutex_lock(&dirty_lock);
+	inode->dirty &= ~flags;
+	pthread_mutex_unlock(&dirty_lock);
+}
+
+/**
+ * @brief 回写文件数据：为延迟分配的块分配物理块，内存中的脏块写到设备
+ * 元数据（extent、位图）只在内存中修改，留给日志事务；调用者持有 inode 写锁，
+ * 不需要命名空间写锁
+ * 
+ * @param inode 
+ * @return int 
+ */
+int newfs_sync_data(struct newfs_inode* inode) {
+	if (inode->ftype != NEWFS_FILE || !(inode->dirty & NEWFS_DIRTY_DATA)) {
+		return NEWFS_ERROR_NONE;
+	}
+
+	// 延迟分配的块此时才分配物理块，整个文件尽量连续，extent 随之确定
+	if (newfs_inode_map_delayed(inode) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] delayed allocation error\n", __func__);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_data_sync(inode) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] io error\n", __func__);
+		return -NEWFS_ERROR_IO;
+	}
+	newfs_clean_flags(inode, NEWFS_DIRTY_DATA);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 按脏标志将内存 inode 的元数据记入当前事务，不清除脏标志
+ * 不再递归子目录项，子 inode 各自在脏链表上。文件数据通常已由 newfs_writeback
+ * 在命名空间锁外写出，这里只写其后新写入的部分，保证事务引用的块先于提交写出
  * 
  * @param inode 
  * @return int 
@@ -169,81 +445,340 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry* dentry) {
 int newfs_sync_inode(struct newfs_inode* inode) {
 	struct newfs_inode_d  inode_d;
     struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
+    struct newfs_dentry_d* dentry_d;
     int	ino				= inode->ino;
+	char* blk_buf;
+	int nblks;
+	int run;
+	int idx;
+	int ret;
+
+	ret = newfs_sync_data(inode);
+	if (ret != NEWFS_ERROR_NONE || inode->dirty == 0) {
+		return ret;
+	}
 
 	// 构造 inode_d
+	memset(&inode_d, 0, sizeof(inode_d));
 	inode_d.ino			= ino;
 	inode_d.size		= inode->size;
-	inode_d.ftype		= inode->dentry->ftype;
+	inode_d.ftype		= inode->ftype;
 	inode_d.link		= inode->link;
 	inode_d.dir_cnt		= inode->dir_cnt;
 	inode_d.blks		= inode->blks;
-	memcpy(inode_d.block_pos, inode->block_pos, sizeof(inode->block_pos));
-
-	int offset;
-	int blk_ino = 0;	// 位于内存节点的第 i 个数据块
-	int blk_sz	= 0;
+	if (newfs_extent_store(inode, &inode_d) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] extent store error\n", __func__);
+		return -NEWFS_ERROR_IO;
+	}
 
 	// 将 inode 刷入内存
-	if (newfs_driver_write(NEWFS_INO_OFS(ino), (char*)&inode_d,
-						sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
+	if (newfs_meta_write(NEWFS_INO_OFS(ino), (char*)&inode_d,
+						 sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] io error\n", __func__);
         return -NEWFS_ERROR_IO;
 	}
 
-	if (inode->dentry->ftype == NEWFS_DIR) {
-		dentry_cursor	= inode->dentrys;
-		offset			= NEWFS_DATA_OFS(inode->block_pos[blk_ino]);
-		while (dentry_cursor != NULL) {
-			memcpy(dentry_d.fname, dentry_cursor->fname, MAX_NAME_LEN);
-			dentry_d.ftype  = dentry_cursor->ftype;
-			dentry_d.ino	= dentry_cursor->ino;
-			if (newfs_driver_write(offset, (char*)&dentry_d,
-									sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-				NEWFS_DBG("[%s] io error\n", __func__);
-				return -NEWFS_ERROR_IO;
-			}
-
-			if (dentry_cursor->inode != NULL)
-				newfs_sync_inode(dentry_cursor->inode);
-			
-			dentry_cursor = dentry_cursor->brother;
-
-			blk_sz		 += sizeof(struct newfs_dentry_d);
-			offset		 += sizeof(struct newfs_dentry_d);
-			if (blk_sz + sizeof(struct newfs_dentry_d) >= NEWFS_BLK_SZ) {
-				blk_sz  = 0;
-				blk_ino++;
-				offset = NEWFS_DATA_OFS(inode->block_pos[blk_ino]);
-			}
+	if (inode->ftype == NEWFS_DIR && (inode->dirty & NEWFS_DIRTY_DENTRY)) {
+		// 第 idx 个目录项位于第 idx / NEWFS_DENTRY_PER_BLK 个逻辑块，按物理连续段整块写出
+		nblks	= (inode->dir_cnt + NEWFS_DENTRY_PER_BLK - 1) / NEWFS_DENTRY_PER_BLK;
+		blk_buf = (char*)malloc(NEWFS_BLKS_SZ(NEWFS_DIR_BATCH_BLKS));
+		if (blk_buf == NULL) {
+			return -NEWFS_ERROR_NOSPACE;
 		}
-	} else if (inode->dentry->ftype == NEWFS_FILE) {
-		for (int i = 0; i < inode->blks; ++i) {
-			if (newfs_driver_write(NEWFS_DATA_OFS(inode->block_pos[i]), inode->block_pointer[i],
-								NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+		dentry_cursor = inode->dentrys;
+		for (int lblk = 0; lblk < nblks; lblk += run) {
+			run = newfs_dir_run(inode, lblk, nblks);
+			memset(blk_buf, 0, NEWFS_BLKS_SZ(run));
+			for (idx = 0; idx < run * (int)NEWFS_DENTRY_PER_BLK && dentry_cursor != NULL; ++idx) {
+				dentry_d = (struct newfs_dentry_d*)(blk_buf + NEWFS_BLKS_SZ(idx / NEWFS_DENTRY_PER_BLK)
+								+ (idx % NEWFS_DENTRY_PER_BLK) * sizeof(struct newfs_dentry_d));
+				strcpy(dentry_d->fname, dentry_cursor->fname);
+				dentry_d->ftype = dentry_cursor->ftype;
+				dentry_d->ino	= dentry_cursor->ino;
+				dentry_cursor	= dentry_cursor->brother;
+			}
+			if (newfs_meta_write(NEWFS_DATA_OFS(newfs_bmap(inode, lblk)), blk_buf,
+								 NEWFS_BLKS_SZ(run)) != NEWFS_ERROR_NONE) {
 				NEWFS_DBG("[%s] io error\n", __func__);
+				free(blk_buf);
 				return -NEWFS_ERROR_IO;
 			}
 		}
+		free(blk_buf);
 	}
 	return NEWFS_ERROR_NONE;
 }
 
 /**
  * @brief 为一个inode分配dentry，采用头插法
+ * 目录已有数据块装满时扩展一个数据块
  * 
  * @param inode 
  * @param dentry 
  * @return int 
  */
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+	if (inode->dir_cnt + 1 > inode->blks * (int)NEWFS_DENTRY_PER_BLK
+		&& newfs_inode_extend(inode, 1) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (newfs_dir_index_insert(inode, dentry) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 	dentry->brother = inode->dentrys;
 	inode->dentrys = dentry;
 	inode->dir_cnt++;
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE | NEWFS_DIRTY_DENTRY);
 	return inode->dir_cnt;
 }
 
+/**
+ * @brief 将 dentry 从目录中摘除（兄弟链表与哈希索引），不释放 dentry
+ * 
+ * @param inode 父目录 inode
+ * @param dentry 
+ */
+void newfs_drop_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+	struct newfs_dentry** pos = &inode->dentrys;
+
+	while (*pos != NULL && *pos != dentry) {
+		pos = &(*pos)->brother;
+	}
+	if (*pos == NULL) {
+		return;
+	}
+	*pos = dentry->brother;
+	newfs_dir_index_remove(inode, dentry);
+	inode->dir_cnt--;
+	newfs_mark_dirty(inode, NEWFS_DIRTY_INODE | NEWFS_DIRTY_DENTRY);
+
+	// 正停在该目录项上的 readdir 游标跳到下一项
+	for (struct newfs_dir_cursor* cursor = inode->cursors; cursor != NULL;
+		 cursor = cursor->cursor_next) {
+		if (cursor->next == dentry) {
+			cursor->next = dentry->brother;
+		}
+	}
+	dentry->brother = NULL;
+}
+
+/**
+ * @brief 在目录中创建文件或目录，调用者持命名空间读锁
+ * 查找后释放过目录锁，其他线程可能已创建同名项，持目录写锁后再查一次
+ * 
+ * @param parent 所在目录的 dentry
+ * @param fname 文件名
+ * @param ftype 
+ * @param created 返回新建的 dentry
+ * @return int 文件名不短于 MAX_NAME_LEN 时返回 -NEWFS_ERROR_NAMETOOLONG
+ */
+int newfs_create(struct newfs_dentry* parent, const char* fname, FILE_TYPE ftype,
+				 struct newfs_dentry** created) {
+	struct newfs_inode*  dir = parent->inode;
+	struct newfs_dentry* dentry;
+	struct newfs_inode*  inode;
+	int ret = NEWFS_ERROR_NONE;
+
+	if (strlen(fname) >= MAX_NAME_LEN) {
+		return -NEWFS_ERROR_NAMETOOLONG;	// 磁盘目录项放不下，不截断
+	}
+	newfs_inode_wrlock(dir);
+	if (newfs_dir_find(dir, fname, strlen(fname)) != NULL) {
+		ret = -NEWFS_ERROR_EXISTS;
+		goto out;
+	}
+	dentry = new_dentry((char*)fname, ftype);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_NOSPACE;
+		goto out;
+	}
+	dentry->parent = parent;
+	inode = newfs_alloc_inode(dentry);
+	if ((intptr_t)inode < 0) {
+		newfs_dentry_release(dentry);
+		ret = (int)(intptr_t)inode;
+		goto out;
+	}
+	if (newfs_alloc_dentry(dir, dentry) < 0) {
+		newfs_inode_free_blks(inode);
+		newfs_free_ino(inode->ino);
+		newfs_free_inode(inode);
+		newfs_dentry_release(dentry);
+		ret = -NEWFS_ERROR_NOSPACE;
+		goto out;
+	}
+	*created = dentry;
+out:
+	newfs_inode_unlock(dir);
+	return ret;
+}
+
+/**
+ * @brief 删除 dentry 指向的文件或空目录：从父目录摘除，释放数据块与 inode 号
+ * 仍被打开或内核仍持有 lookup 计数（低层接口）的 inode 只摘除（dentry 置为 NULL），
+ * 由 newfs_orphan_put 在最后一个引用放下时释放；打开的文件推迟到最后一次关闭
+ * 才释放数据块与 inode 号，期间仍可读写。调用者持命名空间写锁
+ * 
+ * @param dentry 
+ * @return int 
+ */
+int newfs_remove_dentry(struct newfs_dentry* dentry) {
+	struct newfs_inode* inode;
+
+	if (dentry->inode == NULL) {
+		dentry->inode = newfs_read_inode(dentry, dentry->ino);
+		if (dentry->inode == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+	}
+	inode = dentry->inode;
+	if (inode->dir_cnt != 0) {
+		return -NEWFS_ERROR_NOTEMPTY;
+	}
+
+	newfs_drop_dentry(dentry->parent->inode, dentry);
+	newfs_dcache_drop(dentry);
+	for (struct newfs_dir_cursor* cursor = inode->cursors; cursor != NULL;
+		 cursor = cursor->cursor_next) {
+		cursor->inode = NULL;
+		newfs_inode_put(inode);
+	}
+	inode->cursors = NULL;
+	if (inode->refcnt == 0) {
+		newfs_inode_free_blks(inode);
+		newfs_free_ino(inode->ino);
+	}
+	if (inode->refcnt != 0 || inode->nlookup != 0) {
+		newfs_clean_inode(inode);
+		newfs_icache_del(inode);
+		inode->dentry = NULL;
+	} else {
+		newfs_free_inode(inode);
+	}
+	newfs_dentry_release(dentry);
+	return NEWFS_ERROR_NONE;
+}
+
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 持有已摘除的 inode（低层接口按 inode 号打开、预读），调用者持命名空间读锁
+ * 与 newfs_orphan_put 在同一把锁内修改计数，不会与最后一次放下交错
+ *
+ * @param inode
+ */
+void newfs_orphan_hold(struct newfs_inode* inode) {
+	pthread_mutex_lock(&orphan_lock);
+	__atomic_add_fetch(&inode->refcnt, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&orphan_lock);
+}
+
+/**
+ * @brief 放下已摘除 inode 的打开句柄（refs）或 lookup 计数（nlookup），调用者持命名空间读锁
+ * 两种引用可能在不同线程同时放下，计数的修改与判断在 orphan_lock 内完成，
+ * 最后一次关闭时释放数据块与 inode 号，两种引用都归零时释放内存。
+ * 打开期间崩溃时数据块与 inode 号不会被回收
+ *
+ * @param inode
+ * @param refs
+ * @param nlookup
+ */
+void newfs_orphan_put(struct newfs_inode* inode, int refs, uint64_t nlookup) {
+	boolean is_free;
+
+	pthread_mutex_lock(&orphan_lock);
+	__atomic_sub_fetch(&inode->nlookup, nlookup, __ATOMIC_RELAXED);
+	if (refs != 0 && __atomic_sub_fetch(&inode->refcnt, refs, __ATOMIC_RELAXED) == 0) {
+		newfs_inode_free_blks(inode);
+		newfs_free_ino(inode->ino);
+		newfs_clean_inode(inode);
+	}
+	is_free = inode->refcnt == 0 && inode->nlookup == 0;
+	pthread_mutex_unlock(&orphan_lock);
+	if (is_free) {
+		newfs_free_inode(inode);
+	}
+}
+
+/**
+ * @brief 填充文件属性，dentry 的父目录被调用者读锁定或已加载完成
+ * 
+ * @param dentry 
+ * @param is_root 是否为根目录
+ * @param newfs_stat 
+ */
+void newfs_fill_stat(struct newfs_dentry* dentry, boolean is_root, struct stat* newfs_stat) {
+	struct newfs_inode* inode = dentry->inode;
+
+	memset(newfs_stat, 0, sizeof(struct stat));
+	if (inode != NULL) {
+		newfs_inode_rdlock(inode);
+	}
+	if (dentry->ftype == NEWFS_DIR) {
+		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
+		if (inode != NULL)
+			newfs_stat->st_size = inode->dir_cnt * sizeof(struct newfs_dentry_d);
+	} else if (dentry->ftype == NEWFS_FILE) {
+		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
+		if (inode != NULL)
+			newfs_stat->st_size = inode->size;
+	}
+	if (inode != NULL) {
+		newfs_inode_unlock(inode);
+	}
+
+	newfs_stat->st_ino		= dentry->ino;
+	newfs_stat->st_nlink 	= 1;
+	newfs_stat->st_uid 	 	= getuid();
+	newfs_stat->st_gid 	 	= getgid();
+	newfs_stat->st_atime   	= time(NULL);
+	newfs_stat->st_mtime   	= time(NULL);
+	newfs_stat->st_blksize 	= NEWFS_BLK_SZ;
+
+	if (is_root) {
+		newfs_stat->st_size	= super.sz_usage; 
+		newfs_stat->st_blocks = super.sz_disk / NEWFS_BLK_SZ;
+		newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
+	}
+}
+
+/**
+ * @brief 填充已从目录树摘除、仍被打开的文件属性，链接数为 0
+ * 
+ * @param inode 
+ * @param newfs_stat 
+ */
+void newfs_fill_stat_orphan(struct newfs_inode* inode, struct stat* newfs_stat) {
+	struct newfs_dentry dentry;
+
+	memset(&dentry, 0, sizeof(dentry));
+	dentry.ftype = inode->ftype;
+	dentry.ino	 = inode->ino;
+	dentry.inode = inode;
+	newfs_fill_stat(&dentry, FALSE, newfs_stat);
+	newfs_stat->st_nlink = 0;
+}
+
+/**
+ * @brief 释放内存中的 inode，不修改位图，未回写的修改随之丢弃
+ * 
+ * @param inode 
+ */
+void newfs_free_inode(struct newfs_inode* inode) {
+	newfs_clean_inode(inode);
+	newfs_icache_del(inode);
+	if (inode->block_pointer != NULL) {
+		for (int i = 0; i < inode->blk_cap; i++) {
+			free(inode->block_pointer[i]);
+		}
+	}
+	free(inode->block_pointer);
+	free(inode->extents);
+	free(inode->ext_blks);
+	free(inode->dhash);
+	newfs_inode_release(inode);
+}
+
 
 /**
  * @brief 根据目录项读取对应的索引节点
@@ -253,144 +788,475 @@ int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
  * @return struct newfs_inode* 
  */
 struct newfs_inode* newfs_read_inode(struct newfs_dentry* dentry, int ino) {
-	struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+	struct newfs_inode* inode = newfs_inode_new();
 	struct newfs_inode_d inode_d;
 	struct newfs_dentry* sub_dentry;
-	struct newfs_dentry_d dentry_d;
+	struct newfs_dentry_d* dentry_d;
+	char*  blk_buf;
 	int	   dir_cnt = 0;
+	int	   nblks;
+	int	   run;
 
+	if (inode == NULL) {
+		return NULL;
+	}
 	if (newfs_driver_read(NEWFS_INO_OFS(ino), (char *)&inode_d,
 							sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] io error\n", __func__);
-		return NULL;
+		goto fail;
 	}
 	inode->dir_cnt = 0;
 	inode->ino = inode_d.ino;
 	inode->size = inode_d.size;
 	inode->link = inode_d.link;
 	inode->blks = inode_d.blks;
+	inode->ftype = dentry->ftype;
 	inode->dentry = dentry;
 	inode->dentrys = NULL;
-	memcpy(inode->block_pos, inode_d.block_pos, sizeof(inode_d.block_pos));
+	if (newfs_extent_load(inode, &inode_d) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] extent load error\n", __func__);
+		goto fail;
+	}
 
-	int offset;
-	int blk_ino = 0;
-	int blk_sz  = 0;
 	if (inode->dentry->ftype == NEWFS_DIR) {
 		dir_cnt = inode_d.dir_cnt;
-		offset  = NEWFS_DATA_OFS(inode->block_pos[blk_ino]);
-		for (int i = 0; i < dir_cnt; ++i) {
-			if (newfs_driver_read(offset, (char*)&dentry_d, 
-									sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
+		newfs_dir_index_init(inode, dir_cnt);
+		nblks	= (dir_cnt + NEWFS_DENTRY_PER_BLK - 1) / NEWFS_DENTRY_PER_BLK;
+		blk_buf = (char*)malloc(NEWFS_BLKS_SZ(NEWFS_DIR_BATCH_BLKS));
+		if (blk_buf == NULL) {
+			goto fail;
+		}
+		// 每次读入一段物理连续的目录块，解析前先预取下一段
+		for (int lblk = 0, i = 0; lblk < nblks; lblk += run) {
+			run = newfs_dir_run(inode, lblk, nblks);
+			if (lblk + run < nblks) {
+				newfs_cache_prefetch_range(NEWFS_DATA_OFS(newfs_bmap(inode, lblk + run)) / NEWFS_BLK_SZ,
+										   newfs_dir_run(inode, lblk + run, nblks));
+			}
+			if (newfs_driver_read(NEWFS_DATA_OFS(newfs_bmap(inode, lblk)), blk_buf,
+								  NEWFS_BLKS_SZ(run)) != NEWFS_ERROR_NONE) {
 				NEWFS_DBG("[%s] io error\n", __func__);
-				return NULL;
+				free(blk_buf);
+				goto fail;
 			}
-			
-			sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-			sub_dentry->parent  = inode->dentry;
-			sub_dentry->ino		= dentry_d.ino;
-			newfs_alloc_dentry(inode, sub_dentry);
-
-			blk_sz += sizeof(struct newfs_dentry_d);
-			offset += sizeof(struct newfs_dentry_d);
-			if (blk_sz + sizeof(struct newfs_dentry_d) >= NEWFS_BLK_SZ) {
-				blk_sz = 0;
-				blk_ino++;
-				offset = NEWFS_DATA_OFS(inode->block_pos[blk_ino]);
+			for (int j = 0; j < run * (int)NEWFS_DENTRY_PER_BLK && i < dir_cnt; ++j, ++i) {
+				dentry_d = (struct newfs_dentry_d*)(blk_buf + NEWFS_BLKS_SZ(j / NEWFS_DENTRY_PER_BLK)
+								+ (j % NEWFS_DENTRY_PER_BLK) * sizeof(struct newfs_dentry_d));
+				sub_dentry = new_dentry(dentry_d->fname, dentry_d->ftype);
+				if (sub_dentry == NULL) {
+					free(blk_buf);
+					goto fail;
+				}
+				sub_dentry->parent  = inode->dentry;
+				sub_dentry->ino		= dentry_d->ino;
+				if (newfs_alloc_dentry(inode, sub_dentry) < 0) {
+					newfs_dentry_release(sub_dentry);
+					free(blk_buf);
+					goto fail;
+				}
 			}
 		}
+		free(blk_buf);
+		newfs_clean_inode(inode);		// 从磁盘加载的目录项无需回写
 	} else if (inode->dentry->ftype == NEWFS_FILE) {
-		for (int i = 0; i < inode->blks; ++i) {
-			inode->block_pointer[i] = (char*)malloc(NEWFS_BLK_SZ);
-			if (newfs_driver_read(NEWFS_DATA_OFS(inode->block_pos[i]), (char*)inode->block_pointer[i],
-								NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
-				NEWFS_DBG("[%s] io error\n", __func__);
-				return NULL;
-			}	
+		// 文件数据按需读取，这里只建立空的块缓存表
+		inode->blk_cap		 = inode->blks > 0 ? inode->blks : 1;
+		inode->block_pointer = (char**)calloc(inode->blk_cap, sizeof(char*));
+		if (inode->block_pointer == NULL) {
+			goto fail;
 		}
 	}
+	newfs_icache_add(inode);
 	return inode;
+
+fail:
+	// 尚未加入缓存，已挂上的目录项与 inode 一并释放
+	while ((sub_dentry = inode->dentrys) != NULL) {
+		inode->dentrys = sub_dentry->brother;
+		newfs_dentry_release(sub_dentry);
+	}
+	newfs_free_inode(inode);
+	return NULL;
+}
+
+
+/**
+ * @brief 写超级块，超级块只在挂载和卸载时改变（state），不经过日志
+ * 
+ * @return int 
+ */
+int newfs_write_super() {
+	struct newfs_super_d newfs_super_d;
+
+	memset(&newfs_super_d, 0, sizeof(struct newfs_super_d));
+	newfs_super_d.magic_num			= NEWFS_MAGIC;
+	newfs_super_d.features			= NEWFS_FEATURES;
+	newfs_super_d.sz_usage			= super.sz_usage;
+	newfs_super_d.max_ino			= super.max_ino;
+	newfs_super_d.max_data_blks		= super.max_data_blks;
+	newfs_super_d.map_inode_blks	= super.map_inode_blks;
+	newfs_super_d.map_inode_offset  = super.map_inode_offset;
+	newfs_super_d.map_data_blks		= super.map_data_blks;
+	newfs_super_d.map_data_offset	= super.map_data_offset;
+	newfs_super_d.inode_offset		= super.inode_offset;
+	newfs_super_d.data_offset		= super.data_offset;
+	newfs_super_d.journal_offset	= super.journal_offset;
+	newfs_super_d.journal_blks		= super.journal_blks;
+	newfs_super_d.state				= super.state;
+	newfs_super_d.blk_sz			= NEWFS_BLK_SZ;
+	newfs_super_d.sz_disk			= super.sz_disk;
+	newfs_super_d.inode_blks		= super.inode_blks;
+
+	if (newfs_driver_write(NEWFS_SUPER_OFS, (char*)&newfs_super_d,
+							sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回位图中被修改的字节范围
+ * 
+ * @return int 
+ */
+static int newfs_write_maps() {
+	if (super.map_inode_dlo <= super.map_inode_dhi
+		&& newfs_meta_write(super.map_inode_offset + super.map_inode_dlo,
+							super.map_inode + super.map_inode_dlo,
+							super.map_inode_dhi - super.map_inode_dlo + 1) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (super.map_data_dlo <= super.map_data_dhi
+		&& newfs_meta_write(super.map_data_offset + super.map_data_dlo,
+							super.map_data + super.map_data_dlo,
+							super.map_data_dhi - super.map_data_dlo + 1) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	newfs_map_clean();
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 持有脏链表上带有 flags 中任一标志（0 表示全部）的 inode，调用者持命名空间写锁
+ * 
+ * @param flags 
+ * @param cnt 返回个数
+ * @return struct newfs_inode** 由调用者释放，内存不足返回 NULL
+ */
+static struct newfs_inode** newfs_dirty_hold(int flags, int* cnt) {
+	struct newfs_inode** inodes;
+	struct newfs_inode*  inode;
+	int n = newfs_dirty_count();
+
+	inodes = (struct newfs_inode**)malloc((n > 0 ? n : 1) * sizeof(struct newfs_inode*));
+	if (inodes == NULL) {
+		return NULL;
+	}
+	*cnt = 0;
+	for (inode = super.dirty_inodes; inode != NULL; inode = inode->dirty_next) {
+		if (flags == 0 || (inode->dirty & flags)) {
+			newfs_inode_hold(inode);
+			inodes[(*cnt)++] = inode;
+		}
+	}
+	return inodes;
+}
+
+/**
+ * @brief 保存位图的脏范围后写入当前事务，事务中止时据此重新标记
+ * 
+ * @param map_lo 返回 inode 位图、数据位图的脏范围（字节）
+ * @param map_hi 
+ * @return int 
+ */
+static int newfs_wb_maps(int* map_lo, int* map_hi) {
+	map_lo[0] = super.map_inode_dlo;
+	map_hi[0] = super.map_inode_dhi;
+	map_lo[1] = super.map_data_dlo;
+	map_hi[1] = super.map_data_dhi;
+	return newfs_write_maps();
+}
+
+/**
+ * @brief 当前事务再记入位图后是否仍放得下日志区
+ */
+static boolean newfs_wb_fits() {
+	return newfs_journal_fits(newfs_map_txn_bytes() + 2 * (sizeof(struct newfs_jrec_d) + 4));
+}
+
+/**
+ * @brief 回写中 inode 的深度：目录项没有修改的 inode 为 INT_MAX，否则为目录的层数
+ */
+static int newfs_wb_depth(struct newfs_inode* inode) {
+	struct newfs_dentry* dentry = inode->dentry;
+	int depth = 0;
+
+	if (inode->ftype != NEWFS_DIR || !(inode->dirty & NEWFS_DIRTY_DENTRY)) {
+		return INT_MAX;
+	}
+	while (dentry != NULL && dentry->parent != NULL) {
+		dentry = dentry->parent;
+		depth++;
+	}
+	return depth;
+}
+
+/**
+ * @brief 回写的顺序：先是目录项没有修改的 inode，再是目录项有修改的目录，从深到浅
+ * 回写拆成多个事务时，新建的 inode 不晚于指向它的目录项提交，崩溃最多泄漏 inode；
+ * 目录项的修改排在最后，尽量落在同一个事务中
+ */
+static int newfs_wb_cmp(const void* a, const void* b) {
+	int da = newfs_wb_depth(((const struct newfs_wb_inode*)a)->inode);
+	int db = newfs_wb_depth(((const struct newfs_wb_inode*)b)->inode);
+
+	return da < db ? 1 : da > db ? -1 : 0;
+}
+
+/**
+ * @brief 回写脏链表上的 inode 以及位图的修改范围
+ * 同一次回写中的全部修改作为一个日志事务提交，多次操作的修改由此合并为一次顺序写。
+ *  1) 持命名空间写锁抓取有脏数据的文件，之后只持命名空间读锁与各文件的写锁写数据，
+ *     前台操作照常进行
+ *  2) 持命名空间写锁构造元数据事务，事务中不含执行到一半的操作；这一步只在内存中
+ *     追加记录，写入事务的 inode 摘出脏链表并持有
+ *  3) 释放命名空间锁后提交；中止时事务中的 inode 重新标记为脏，位图范围与释放的块
+ *     留给下一次回写，不丢失修改
+ * 修改放不下日志区时按 newfs_wb_cmp 的顺序拆成多个事务：记入一个 inode 后放不下就撤销它，
+ * 持命名空间写锁提交此前的 inode 与当时的位图，再从它开始下一个事务。中间的事务中释放
+ * 的块与 inode 号仍为占用，只在最后一个事务中归还，崩溃最多泄漏空间。单个 inode 独占
+ * 一个事务仍放不下时（如很大的目录），目录块与 extent 溢出块搬到新块上直接写出
+ * （newfs_inode_relocate），事务中只记 inode。
+ * 个别 inode 构造失败（如 extent 溢出块空间不足）时撤销它的记录、留在脏链表上并返回错误，
+ * 其余 inode 照常提交，不会被一个 inode 堵住。调用者不能持有命名空间锁
+ * 
+ * @return int 
+ */
+int newfs_writeback() {
+	struct newfs_inode**   files;
+	struct newfs_wb_inode* txn;
+	struct newfs_inode*	   inode;
+	int nfiles = 0;
+	int ndirty = 0;
+	int ntxn   = 0;
+	int done   = 0;						// 前 done 个 inode 已随中间事务提交
+	int map_lo[2] = { INT_MAX, INT_MAX };
+	int map_hi[2] = { -1, -1 };
+	int dirty;
+	int err	   = NEWFS_ERROR_NONE;		// 个别 inode 的错误
+	int ret	   = NEWFS_ERROR_NONE;		// 整个事务的错误
+	int rc;
+
+	newfs_wb_lock();
+	newfs_ns_wrlock();
+	files = newfs_dirty_hold(NEWFS_DIRTY_DATA, &nfiles);
+	newfs_ns_unlock();
+	if (files == NULL) {
+		newfs_wb_unlock();
+		return -NEWFS_ERROR_NOSPACE;
+	}
+
+	newfs_ns_rdlock();
+	for (int i = 0; i < nfiles; i++) {
+		newfs_inode_wrlock(files[i]);
+		rc = newfs_sync_data(files[i]);
+		newfs_inode_unlock(files[i]);
+		if (rc != NEWFS_ERROR_NONE) {
+			err = rc;
+		}
+	}
+	newfs_ns_unlock();
+
+	newfs_ns_wrlock();
+	txn = (struct newfs_wb_inode*)malloc((newfs_dirty_count() + 1) * sizeof(struct newfs_wb_inode));
+	if (txn == NULL) {
+		ret = -NEWFS_ERROR_NOSPACE;
+	} else {
+		for (inode = super.dirty_inodes; inode != NULL; inode = inode->dirty_next) {
+			txn[ndirty++].inode = inode;
+		}
+		qsort(txn, ndirty, sizeof(struct newfs_wb_inode), newfs_wb_cmp);
+
+		// 写入事务的 inode 依次前移到 txn[ntxn]，ntxn 不超过 i
+		newfs_journal_begin();
+		for (int i = 0; i < ndirty; i++) {
+			inode = txn[i].inode;
+			dirty = inode->dirty;
+			newfs_journal_mark();
+			rc = newfs_sync_inode(inode);
+			if (rc == NEWFS_ERROR_NONE && !newfs_wb_fits() && ntxn > done) {
+				newfs_journal_rollback();
+				ret = newfs_wb_maps(map_lo, map_hi);
+				ret = ret == NEWFS_ERROR_NONE ? newfs_journal_commit() : ret;
+				if (ret != NEWFS_ERROR_NONE) {
+					break;
+				}
+				done = ntxn;
+				newfs_journal_begin();
+				newfs_journal_mark();
+				rc = newfs_sync_inode(inode);
+			}
+			if (rc == NEWFS_ERROR_NONE && !newfs_wb_fits()) {
+				newfs_journal_rollback();
+				rc = newfs_inode_relocate(inode);
+				dirty |= inode->dirty;
+				if (rc == NEWFS_ERROR_NONE) {
+					newfs_journal_direct(TRUE);
+					rc = newfs_sync_inode(inode);
+					newfs_journal_direct(FALSE);
+				}
+				if (rc == NEWFS_ERROR_NONE && !newfs_wb_fits()) {
+					rc = -NEWFS_ERROR_NOSPACE;
+				}
+			}
+			if (rc != NEWFS_ERROR_NONE) {
+				NEWFS_DBG("[%s] skip inode %d: %d\n", __func__, inode->ino, rc);
+				newfs_journal_rollback();
+				err = rc;
+				continue;
+			}
+			txn[ntxn].inode = inode;
+			txn[ntxn].dirty = dirty;
+			newfs_inode_hold(inode);
+			newfs_clean_inode(inode);
+			ntxn++;
+		}
+		if (ret == NEWFS_ERROR_NONE) {
+			// extent 溢出块可能在上面的回写中分配或释放，位图最后写
+			newfs_free_defer_begin();
+			ret = newfs_wb_maps(map_lo, map_hi);
+			newfs_free_defer_hold();
+		}
+	}
+	newfs_ns_unlock();
+
+	if (txn != NULL) {
+		if (ret != NEWFS_ERROR_NONE) {
+			newfs_journal_abort();
+		} else {
+			ret = newfs_journal_commit();
+		}
+		if (ret != NEWFS_ERROR_NONE) {
+			newfs_map_redirty(map_lo[0], map_hi[0], map_lo[1], map_hi[1]);
+		} else {
+			done = ntxn;
+		}
+		newfs_free_defer_end(ret == NEWFS_ERROR_NONE);
+	}
+
+	// 放下持有的 inode；所在事务未提交时，仍在目录树中的 inode 重新标记为脏
+	newfs_ns_rdlock();
+	for (int i = 0; i < ntxn; i++) {
+		inode = txn[i].inode;
+		if (i >= done && inode->dentry != NULL) {
+			newfs_inode_wrlock(inode);
+			newfs_mark_dirty(inode, txn[i].dirty);
+			newfs_inode_unlock(inode);
+		}
+		newfs_inode_put(inode);
+	}
+	for (int i = 0; i < nfiles; i++) {
+		newfs_inode_put(files[i]);
+	}
+	newfs_ns_unlock();
+	free(txn);
+	free(files);
+	newfs_wb_unlock();
+	return ret != NEWFS_ERROR_NONE ? ret : err;
 }
 
+/**
+ * @brief 空间不足时，若回写可能腾出空间（见 newfs_space_pending），先回写一次
+ * 调用者不能持有命名空间锁
+ * 
+ * @param ret 操作的返回值
+ * @return boolean 是否值得重试该操作
+ */
+boolean newfs_retry_nospace(int ret) {
+	return ret == -NEWFS_ERROR_NOSPACE && newfs_space_pending()
+		&& newfs_writeback() == NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 回写所有修改并保证落盘，供 fsync 使用
+ * 事务提交时数据块与日志均已落盘，原位置的元数据留给检查点
+ * 
+ * @return int 
+ */
+int newfs_sync_fs() {
+	return newfs_writeback();
+}
 
 /**
  * @brief 挂载sfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map | Data Map | Inode | Data |
+ * | Super | Journal | Inode Map | Data Map | Inode | Data |
  * 
- * BLK_SZ = 2*IO_SZ
+ * BLK_SZ 由 mkfs.newfs 指定，为 IO_SZ 的整数倍
  * 
- * 每个Inode占用一个Blk
+ * 布局由 mkfs.newfs 按设备大小计算并写入超级块，挂载只读取不计算
  * @param options 
  * @return int 
  */
 int newfs_mount(struct custom_options olptions) {
     int						ret = NEWFS_ERROR_NONE;
-	int						driver_fd;
 	struct newfs_dentry* 	root_dentry;
 	struct newfs_inode*		root_inode;
 	struct newfs_super_d 	super_d;
 
-	int						inode_nums;
-	int						super_blks;
-	int						map_inode_blks;
-	int						map_data_blks;
-	int						inode_blks;
-	int						data_blks;
-	boolean 				is_init = FALSE;	// 用于标记是否为第一次加载
-
 	super.is_mounted = FALSE;
-
-	// 读取超级块
-	driver_fd = ddriver_open(newfs_options.device);
-	
-	if (driver_fd < 0) {
-		return driver_fd;
+	super.dirty_inodes = NULL;
+	super.dirty_bytes  = 0;
+
+	// 打开存储后端
+	super.driver = newfs_driver_find(newfs_options.backend);
+	if (super.driver == NULL) {
+		NEWFS_DBG("[%s] unknown backend %s\n", __func__, newfs_options.backend);
+		return -NEWFS_ERROR_UNSUPPORTED;
 	}
 
-    super.fd = driver_fd;
-	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &super.sz_disk);
-	ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, &super.sz_io);
+	ret = NEWFS_DRIVER->open(newfs_options.device);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
 
-	root_dentry = new_dentry("/", NEWFS_DIR);
+	ret = NEWFS_DRIVER->geometry(&super.sz_disk, &super.sz_io);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
 
 	if (newfs_driver_read(NEWFS_SUPER_OFS, (char*)&super_d,
                             sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
         return -NEWFS_ERROR_IO;
 
-	printf("%x\n", super_d.magic_num);
-	printf("inode_ofs: %d\n", super_d.map_inode_offset);
-	printf("data_ofs: %d\n", super_d.map_data_offset);
-	printf("-------------------------------------------\n");
 	if (super_d.magic_num != NEWFS_MAGIC) {
-		// 计算超级块、索引块、数据块、索引位图块、数据位图块数目
-		super_blks = ROUND_UP(sizeof(struct newfs_super_d), NEWFS_BLK_SZ) / NEWFS_BLK_SZ;
-		inode_nums = NEWFS_FILE_NUM;
-		inode_blks = ROUND_UP(inode_nums * sizeof(struct newfs_inode_d), NEWFS_BLK_SZ) / NEWFS_BLK_SZ;
-		data_blks  = NEWFS_FILE_NUM * NEWFS_DATA_PER_FILE;
-		map_inode_blks = (ROUND_UP(ROUND_UP(inode_nums, UINT8_BITS), NEWFS_BLK_SZ) + (NEWFS_BLK_SZ * sizeof(char)) - 1) / (NEWFS_BLK_SZ * sizeof(char));
-		map_data_blks  = (ROUND_UP(ROUND_UP(data_blks, UINT8_BITS), NEWFS_BLK_SZ) + (NEWFS_BLK_SZ * sizeof(char)) - 1) / (NEWFS_BLK_SZ * sizeof(char));
-
-		super.max_ino			= inode_nums;
-		super.max_data_blks		= inode_nums * NEWFS_DATA_PER_FILE;
-		super_d.max_ino			= inode_nums;
-		super_d.max_data_blks	= super.max_data_blks;
-		super_d.map_inode_blks	= map_inode_blks;
-		super_d.map_inode_offset	= NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
-		super_d.map_data_blks		= map_data_blks;
-		super_d.map_data_offset	= super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
-		super_d.inode_offset		= super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-		super_d.data_offset		= super_d.inode_offset    + NEWFS_BLKS_SZ(inode_blks);
-		super_d.sz_usage			= 0;
-		
-		printf("This is init\n");
-		printf("%x\n", super_d.magic_num);
-		printf("inode_ofs: %d\n", super_d.map_inode_offset);
-		printf("data_ofs: %d\n", super_d.map_data_offset);
-		is_init = TRUE;
+		NEWFS_DBG("[%s] %s is not formatted, run mkfs.newfs first\n", __func__, newfs_options.device);
+		NEWFS_DRIVER->close();
+		return -NEWFS_ERROR_INVAL;
+	}
+	if ((super_d.features & NEWFS_FEATURE_64BIT) == 0 || (super_d.features & NEWFS_FEATURE_EXT_CHAIN) == 0
+		|| (super_d.features & ~NEWFS_FEATURES) != 0) {
+		NEWFS_DBG("[%s] unsupported features 0x%x, run mkfs.newfs again\n", __func__, super_d.features);
+		NEWFS_DRIVER->close();
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (!newfs_blk_sz_valid(super_d.blk_sz) || super_d.sz_disk > super.sz_disk) {
+		NEWFS_DBG("[%s] geometry mismatch: blk_sz %d, sz_disk %lld\n", __func__,
+				  super_d.blk_sz, (long long)super_d.sz_disk);
+		NEWFS_DRIVER->close();
+		return -NEWFS_ERROR_INVAL;
 	}
 
+	// 块大小确定后才能按块初始化缓存
+	super.blk_sz				 = super_d.blk_sz;
+	if (newfs_cache_init(newfs_options.cache_mb * 1024 * 1024 / NEWFS_BLK_SZ) != NEWFS_ERROR_NONE) {
+		NEWFS_DRIVER->close();
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	root_dentry = new_dentry("/", NEWFS_DIR);
+
+	super.sz_disk				 = super_d.sz_disk;		// 设备可能比文件系统大
 	super.sz_usage				 = super_d.sz_usage;
 	super.max_ino				 = super_d.max_ino;
 	super.max_data_blks			 = super_d.max_data_blks;
@@ -401,8 +1267,21 @@ int newfs_mount(struct custom_options olptions) {
 	super.map_data_blks			 = super_d.map_data_blks;
 	super.map_data_offset		 = super_d.map_data_offset;
 	super.inode_offset			 = super_d.inode_offset;
+	super.inode_blks			 = super_d.inode_blks;
 	super.data_offset			 = super_d.data_offset;
+	super.journal_offset		 = super_d.journal_offset;
+	super.journal_blks			 = super_d.journal_blks;
+	if (super.map_inode == NULL || super.map_data == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 
+	// 未正常卸载时先重放日志，位图与 inode 以重放后的为准
+	if (newfs_journal_init(FALSE) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (super_d.state != NEWFS_STATE_CLEAN && newfs_journal_replay() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
 
 	if (newfs_driver_read(super_d.map_inode_offset, (char*)super.map_inode,
 					  NEWFS_BLKS_SZ(super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
@@ -412,69 +1291,84 @@ int newfs_mount(struct custom_options olptions) {
 					  NEWFS_BLKS_SZ(super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
 		return -NEWFS_ERROR_IO;
 	}
-
-	if (is_init) {
-		root_inode	= newfs_alloc_inode(root_dentry);
-		// root_inode->ino = NEWFS_ROOT_INO;
-		newfs_sync_inode(root_inode);
-	}
+	newfs_map_clean();
+	newfs_alloc_init();
 
 	root_inode				= newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+	if (root_inode == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	root_dentry->inode		= root_inode;
 	super.root_dentry		= root_dentry;
 	super.is_mounted		= TRUE;
 
+	// 挂载期间超级块标记为未正常卸载
+	super.state = NEWFS_STATE_DIRTY;
+	if (newfs_write_super() != NEWFS_ERROR_NONE || newfs_cache_flush() != NEWFS_ERROR_NONE
+		|| NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+
 	newfs_dump_map();
 	return ret;
 }
 
 
+/**
+ * @brief 释放目录树中已加载的 inode，dentry 随内存池整体归还
+ * 
+ * @param dentry 
+ */
+static void newfs_release_tree(struct newfs_dentry* dentry) {
+	struct newfs_inode* inode = dentry->inode;
+
+	if (inode == NULL) {
+		return;
+	}
+	for (struct newfs_dentry* child = inode->dentrys; child != NULL; child = child->brother) {
+		newfs_release_tree(child);
+	}
+	newfs_free_inode(inode);
+}
+
 /**
  * @brief 卸载文件系统
  * 
  * @return int
  */
 int newfs_umount() {
-	struct newfs_super_d newfs_super_d;
-
 	if (!super.is_mounted) {
 		return NEWFS_ERROR_NONE;
 	}
 
-	newfs_sync_inode(super.root_dentry->inode);
-
-	newfs_super_d.magic_num			= NEWFS_MAGIC;
-	newfs_super_d.sz_usage			= super.sz_usage;
-	newfs_super_d.max_ino			= super.max_ino;
-	newfs_super_d.map_inode_blks	= super.map_inode_blks;
-	newfs_super_d.map_inode_offset  = super.map_inode_offset;
-	newfs_super_d.map_data_blks		= super.map_data_blks;
-	newfs_super_d.map_data_offset	= super.map_data_offset;
-	newfs_super_d.inode_offset		= super.inode_offset;
-	newfs_super_d.data_offset		= super.data_offset;
-
-	if (newfs_driver_write(NEWFS_SUPER_OFS, (char*)&newfs_super_d,
-							sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+	// 提交最后一个事务并做检查点，日志清空后才标记正常卸载
+	if (newfs_writeback() != NEWFS_ERROR_NONE || newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
 		return -NEWFS_ERROR_IO;
 	}
-
-	if (newfs_driver_write(newfs_super_d.map_inode_offset, (char*)super.map_inode,
-							NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
+	super.state = NEWFS_STATE_CLEAN;
+	if (newfs_write_super() != NEWFS_ERROR_NONE) {
 		return -NEWFS_ERROR_IO;
 	}
-	printf("inode_ofs: %d\n", newfs_super_d.map_inode_offset);
-	printf("data_ofs: %d\n", newfs_super_d.map_data_offset);
-	printf("--------------------------------------------\n");
 	newfs_dump_map();
 
-	if (newfs_driver_write(newfs_super_d.map_data_offset, (char*)super.map_data,
-							NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
+	newfs_dcache_clear();
+	newfs_release_tree(super.root_dentry);
+	newfs_icache_clear();
+	newfs_mem_destroy();
+	super.root_dentry = NULL;
+	super.is_mounted  = FALSE;
+	if (newfs_cache_destroy() != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+
+	if (NEWFS_DRIVER->sync() != NEWFS_ERROR_NONE) {
 		return -NEWFS_ERROR_IO;
 	}
 
 	free(super.map_inode);
 	free(super.map_data);
-	ddriver_close(NEWFS_DRIVER);
+	newfs_journal_destroy();
+	NEWFS_DRIVER->close();
 
 	return NEWFS_ERROR_NONE;
 }
@@ -503,6 +1397,32 @@ int newfs_calc_lvl(const char * path) {
     return lvl;
 }
 
+/**
+ * @brief 懒加载 dentry 指向的 inode
+ * 已加载时无锁返回；否则持父目录写锁读入，并发的加载只有一个生效
+ * 调用者持命名空间读锁，且不持父目录的锁
+ * 
+ * @param dentry 
+ * @return struct newfs_inode* 读失败返回 NULL
+ */
+struct newfs_inode* newfs_lookup_load(struct newfs_dentry* dentry) {
+	struct newfs_inode* inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+	struct newfs_inode* dir;
+
+	if (inode != NULL || dentry->parent == NULL) {
+		return inode;
+	}
+	dir = dentry->parent->inode;
+	newfs_inode_wrlock(dir);
+	inode = dentry->inode;
+	if (inode == NULL) {
+		inode = newfs_read_inode(dentry, dentry->ino);
+		__atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
+	}
+	newfs_inode_unlock(dir);
+	return inode;
+}
+
 /**
  * @brief 
  * path: /qwe/ad  total_lvl = 2,
@@ -515,19 +1435,38 @@ int newfs_calc_lvl(const char * path) {
  *      1) find /'s inode       lvl = 1
  *      2) find qwe's dentry
  * 
+ * 调用者持命名空间读锁，逐层只持当前目录的读锁
+ * 
  * @param path 
- * @return struct sfs_inode* 
+ * @return struct sfs_inode* 路径上的 inode 读失败返回 NULL，is_find 为 FALSE
  */
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
 	struct newfs_dentry* dentry_cursor  = super.root_dentry;
 	struct newfs_dentry* dentry_ret 	= NULL;
 	struct newfs_inode*	 inode;
-	int total_lvl = newfs_calc_lvl(path);
+	int total_lvl;
 	int lvl = 0;
-	boolean is_hit;
+	boolean is_cacheable = TRUE;	// 只缓存命中，以及父目录存在、最后一级不存在的结果
 	char *fname = NULL;
-	char* path_cpy = (char*)malloc(sizeof(path));
+	char* path_cpy;
+	char* save_ptr;
+
+	// 先查路径缓存
+	dentry_ret = newfs_dcache_lookup(path, is_find, is_root);
+	if (dentry_ret != NULL) {
+		inode = newfs_lookup_load(dentry_ret);
+		if (inode == NULL) {
+			*is_find = FALSE;
+			return NULL;
+		}
+		newfs_icache_touch(inode);
+		return dentry_ret;
+	}
+
+	total_lvl = newfs_calc_lvl(path);
+	path_cpy = (char*)malloc(strlen(path) + 1);
 	*is_root = FALSE;
+	*is_find = FALSE;
 	strcpy(path_cpy, path);
 
 	if (total_lvl == 0) {
@@ -536,53 +1475,60 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
 		dentry_ret = super.root_dentry;
 	}
 
-	fname = strtok(path_cpy, "/");
+	fname = strtok_r(path_cpy, "/", &save_ptr);
 	while (fname) {
 		lvl++;
-		if (dentry_cursor->inode == NULL) {
-			newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+		inode = newfs_lookup_load(dentry_cursor);
+		if (inode == NULL) {
+			dentry_ret = NULL;
+			break;
 		}
-
-		inode = dentry_cursor->inode;
+		newfs_icache_touch(inode);
 
 		if (inode->dentry->ftype == NEWFS_FILE && lvl < total_lvl) {
 			NEWFS_DBG("[%s] not a dir\n", __func__);
 			dentry_ret = inode->dentry;
+			is_cacheable = FALSE;
 			break;
 		}
 
 		if (inode->dentry->ftype == NEWFS_DIR) {
-			dentry_cursor	= inode->dentrys;
-			is_hit			= FALSE;
+			newfs_inode_rdlock(inode);
+			dentry_cursor = newfs_dir_find(inode, fname, strlen(fname));
 
-			while (dentry_cursor) {
-				if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-					is_hit = TRUE;
-					break;
-				}
-				dentry_cursor = dentry_cursor->brother;
-			}
-
-			if (!is_hit) {
+			if (dentry_cursor == NULL) {
 				*is_find = FALSE;
 				NEWFS_DBG("[%s] not found %s\n", __func__, fname);
 				dentry_ret = inode->dentry;
+				// 负缓存在目录读锁内插入，同一目录下的创建随后会删除它
+				if (lvl == total_lvl) {
+					newfs_dcache_insert(path, dentry_ret, FALSE, FALSE);
+				}
+				newfs_inode_unlock(inode);
+				is_cacheable = FALSE;
 				break;
 			}
+			newfs_inode_unlock(inode);
 
-			if (is_hit && lvl == total_lvl) {
+			if (lvl == total_lvl) {
 				*is_find = TRUE;
 				dentry_ret = dentry_cursor;
 				break;
 			}
 		}
-		fname = strtok(NULL, "/");
+		fname = strtok_r(NULL, "/", &save_ptr);
 	}
 
-	if (dentry_ret->inode == NULL) {
-		dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+	// 路径上或最后一级的 inode 读失败：不算找到，也不缓存
+	if (dentry_ret != NULL && newfs_lookup_load(dentry_ret) == NULL) {
+		dentry_ret = NULL;
 	}
-
+	if (dentry_ret == NULL) {
+		*is_find = FALSE;
+	} else if (is_cacheable) {
+		newfs_dcache_insert(path, dentry_ret, *is_find, *is_root);
+	}
+	free(path_cpy);
 	return dentry_ret;
 }
 
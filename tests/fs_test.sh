@@ -6,8 +6,9 @@ cd $WORK_DIR
 
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
-ALL_POINTS=23
+ALL_POINTS=65
 POINTS=0
+MOUNT_OPTS=""
 
 function pass() {
     RES=$1
@@ -20,10 +21,24 @@ function fail() {
     echo -e "\033[31mfail: ${RES}\033[0m"
 }
 
+function test_mkfs() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_MKFS"
+    ../build/mkfs.${PROJECT_NAME} --device="$HOME"/ddriver
+    if [ $? -ne 0 ]; then
+        fail $TEST_CASE
+        exit 1
+    else
+        pass $TEST_CASE
+    fi
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
 function test_mount() {
     TEST_CASE=$1
     echo ">>>>>>>>>>>>>>>>>>>> TEST_MOUNT"
-    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MOUNT_OPTS} ${MNTPOINT}
     if [ $? -ne 0 ]; then
         fail $TEST_CASE
         exit 1
@@ -46,6 +61,22 @@ function core_tester() {
     fi
 }
 
+function check_same() {
+    EXPECT=$1
+    ACTUAL=$2
+    cmp ${EXPECT} ${ACTUAL}
+    if [ $? -ne 0 ]; then
+        fail "$3"
+    else
+        pass "-> $3"
+    fi
+}
+
+function remount_fs() {
+    fusermount -u ${MNTPOINT}
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MOUNT_OPTS} ${MNTPOINT}
+}
+
 function test_mkdir() {
     TEST_CASE=$1
     echo ">>>>>>>>>>>>>>>>>>>> TEST_MKDIR"
@@ -111,11 +142,11 @@ function test_remount() {
         pass "-> fusermount -u ${MNTPOINT}"
     fi
 
-    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MOUNT_OPTS} ${MNTPOINT}
     if [ $? -ne 0 ]; then
         fail "remount"
     else 
-        pass "-> ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}"
+        pass "-> ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MOUNT_OPTS} ${MNTPOINT}"
     fi
     
     core_tester ls ${MNTPOINT}/;
@@ -136,9 +167,146 @@ function test_remount() {
     echo "<<<<<<<<<<<<<<<<<<<<"
 }
 
+function test_writeback_abort() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_WRITEBACK_ABORT"
+
+    # 第一次日志提交注入失败，修改须留在内存中，重试后落盘
+    head -c 65536 /dev/urandom > /tmp/${PROJECT_NAME}_wb
+    # --fail-commits 只在打开 NEWFS_FAULT_INJECT 的测试构建 newfs_fi 中提供
+    ../build/${PROJECT_NAME}_fi --device="$HOME"/ddriver --dirty-expire-ms=0 --fail-commits=1 ${MNTPOINT}
+    dd if=/tmp/${PROJECT_NAME}_wb of=${MNTPOINT}/file2 bs=4096 conv=fsync 2>/dev/null
+    if [ $? -eq 0 ]; then
+        fail "$TEST_CASE fsync should fail"
+    else
+        pass "-> fsync with injected commit failure"
+    fi
+
+    dd if=/dev/null of=${MNTPOINT}/file2 count=0 conv=notrunc,fsync 2>/dev/null
+    if [ $? -ne 0 ]; then
+        fail "$TEST_CASE fsync retry"
+    else
+        pass "-> fsync retry"
+    fi
+    fusermount -u ${MNTPOINT}
+
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}
+    cmp /tmp/${PROJECT_NAME}_wb ${MNTPOINT}/file2
+    if [ $? -ne 0 ]; then
+        fail "$TEST_CASE content after remount"
+    else
+        pass "-> content after remount"
+    fi
+    fusermount -u ${MNTPOINT}
+    rm -f /tmp/${PROJECT_NAME}_wb
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_delalloc() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_DELALLOC"
+
+    # 小块追加只预留空间，fsync 时才分配物理块写出，重新挂载后内容不变
+    head -c 300001 /dev/urandom > /tmp/${PROJECT_NAME}_da
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}
+    dd if=/tmp/${PROJECT_NAME}_da of=${MNTPOINT}/file3 bs=700 2>/dev/null
+    check_same /tmp/${PROJECT_NAME}_da ${MNTPOINT}/file3 "read back before sync"
+    sync ${MNTPOINT}/file3
+    check_same /tmp/${PROJECT_NAME}_da ${MNTPOINT}/file3 "read back after sync"
+    remount_fs
+    check_same /tmp/${PROJECT_NAME}_da ${MNTPOINT}/file3 "read back after remount"
+    fusermount -u ${MNTPOINT}
+    rm -f /tmp/${PROJECT_NAME}_da
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_unlink_open() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_UNLINK_OPEN"
+
+    # 删除仍被打开的文件：名字立即消失，已打开的句柄照常读到原内容，关闭后释放
+    head -c 300000 /dev/urandom > /tmp/${PROJECT_NAME}_uo
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MOUNT_OPTS} ${MNTPOINT}
+    cp /tmp/${PROJECT_NAME}_uo ${MNTPOINT}/file4
+    sync ${MNTPOINT}/file4
+    exec 3< ${MNTPOINT}/file4
+    rm ${MNTPOINT}/file4
+    if [ -e ${MNTPOINT}/file4 ]; then
+        fail "$TEST_CASE name after unlink"
+    else
+        pass "-> rm while open"
+    fi
+    cat <&3 > /tmp/${PROJECT_NAME}_uo_rd
+    exec 3<&-
+    check_same /tmp/${PROJECT_NAME}_uo /tmp/${PROJECT_NAME}_uo_rd "read after unlink"
+    remount_fs
+    if [ -e ${MNTPOINT}/file4 ]; then
+        fail "$TEST_CASE name after remount"
+    else
+        pass "-> gone after remount"
+    fi
+    fusermount -u ${MNTPOINT}
+    rm -f /tmp/${PROJECT_NAME}_uo /tmp/${PROJECT_NAME}_uo_rd
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function zero_range() {
+    dd if=/dev/zero of=$1 bs=1 seek=$2 count=$3 conv=notrunc 2>/dev/null
+}
+
+function test_fallocate() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_FALLOCATE"
+    MODEL=/tmp/${PROJECT_NAME}_fa
+    mkdir -p ${MODEL}
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver ${MNTPOINT}
+
+    # 预分配的块读为零；-k 不改变大小，之后扩大到预分配范围内同样读为零
+    fallocate -l 65536 ${MNTPOINT}/fa0
+    truncate -s 65536 ${MODEL}/fa0
+    fallocate -k -l 65536 ${MNTPOINT}/fa1
+    truncate -s 32768 ${MNTPOINT}/fa1
+    truncate -s 32768 ${MODEL}/fa1
+
+    # 在未写入区间中间写入不完整的块
+    fallocate -l 16384 ${MNTPOINT}/fa2
+    truncate -s 16384 ${MODEL}/fa2
+    head -c 100 /dev/urandom > /tmp/${PROJECT_NAME}_fa_w0
+    head -c 3000 /dev/urandom > /tmp/${PROJECT_NAME}_fa_w1
+    for F in ${MNTPOINT}/fa2 ${MODEL}/fa2; do
+        dd if=/tmp/${PROJECT_NAME}_fa_w0 of=${F} bs=1 seek=1000 conv=notrunc 2>/dev/null
+        dd if=/tmp/${PROJECT_NAME}_fa_w1 of=${F} bs=1 seek=5000 conv=notrunc 2>/dev/null
+    done
+
+    # 打洞：整块、止于块边界、始于块边界、跨越块边界
+    head -c 8192 /dev/urandom > ${MODEL}/fa3
+    cp ${MODEL}/fa3 ${MNTPOINT}/fa3
+    for R in "1024 1024" "3000 1096" "4096 100" "6000 300"; do
+        set -- ${R}
+        fallocate -p -o $1 -l $2 ${MNTPOINT}/fa3
+        zero_range ${MODEL}/fa3 $1 $2
+    done
+
+    for F in fa0 fa1 fa2 fa3; do
+        check_same ${MODEL}/${F} ${MNTPOINT}/${F} "${F} before remount"
+    done
+    remount_fs
+    for F in fa0 fa1 fa2 fa3; do
+        check_same ${MODEL}/${F} ${MNTPOINT}/${F} "${F} after remount"
+    done
+    fusermount -u ${MNTPOINT}
+    rm -rf ${MODEL} /tmp/${PROJECT_NAME}_fa_w0 /tmp/${PROJECT_NAME}_fa_w1
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
 
 function test_main() {
     ddriver -r
+    test_mkfs "[all-the-mkfs-test]"
     test_mount "[all-the-mount-test]"
     echo ""
     test_mkdir "[all-the-mkdir-test]"
@@ -149,6 +317,29 @@ function test_main() {
     echo ""
     test_remount "[all-the-remount-test]"
     echo ""
+    test_writeback_abort "[all-the-writeback-abort-test]"
+    echo ""
+    test_delalloc "[all-the-delalloc-test]"
+    echo ""
+    test_fallocate "[all-the-fallocate-test]"
+    echo ""
+
+    # 低层接口：重新格式化后再跑一遍目录用例，覆盖 lookup/forget 计数与已删除文件的句柄
+    MOUNT_OPTS="--lowlevel"
+    ddriver -r
+    test_mkfs "[lowlevel-mkfs-test]"
+    test_mount "[lowlevel-mount-test]"
+    echo ""
+    test_mkdir "[lowlevel-mkdir-test]"
+    echo ""
+    test_touch "[lowlevel-touch-test]"
+    echo ""
+    test_ls "[lowlevel-ls-test]"
+    echo ""
+    test_remount "[lowlevel-remount-test]"
+    echo ""
+    test_unlink_open "[lowlevel-unlink-open-test]"
+    echo ""
 
     if [ $POINTS -eq $ALL_POINTS ]; then
         pass "恭喜你，通过所有测试 ($ALL_POINTS/$ALL_POINTS)"
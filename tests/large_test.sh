@@ -0,0 +1,103 @@
+#!/bin/bash
+# 大设备测试：在稀疏镜像文件上格式化并挂载 newfs，偏移超过 2 GiB
+ORIGIN_WORK_DIR=$PWD
+
+WORK_DIR=$(cd `dirname $0`; pwd)
+cd $WORK_DIR
+
+MNTPOINT='./mnt'
+PROJECT_NAME="newfs"
+IMAGE='./large.img'
+IMAGE_SZ=${IMAGE_SZ:-4T}
+BLOCK_SZ=${BLOCK_SZ:-65536}
+ALL_POINTS=12
+POINTS=0
+
+function pass() {
+    RES=$1
+    POINTS=$(($POINTS+1))
+    echo -e "\033[32mpass: ${RES}\033[0m"
+}
+
+function fail() {
+    RES=$1
+    echo -e "\033[31mfail: ${RES}\033[0m"
+}
+
+function core_tester() {
+    CMD=$1
+    PARAM=$2
+    echo "TEST: "$CMD $PARAM
+    $CMD $PARAM
+    if [ $? -ne 0 ]; then
+        fail $CMD $PARAM
+    else     
+        pass "-> $CMD $PARAM"
+    fi
+}
+
+function test_mkfs() {
+    TEST_CASE=$1
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_MKFS"
+    rm -f ${IMAGE}
+    truncate -s ${IMAGE_SZ} ${IMAGE}
+    ../build/mkfs.${PROJECT_NAME} --backend=file --device=${IMAGE} --block-size=${BLOCK_SZ}
+    if [ $? -ne 0 ]; then
+        fail $TEST_CASE
+        rm -f ${IMAGE}
+        exit 1
+    else
+        pass $TEST_CASE
+    fi
+
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_mount() {
+    TEST_CASE=$1
+    ../build/${PROJECT_NAME} --backend=file --device=${IMAGE} ${MNTPOINT}
+    if [ $? -ne 0 ]; then
+        fail $TEST_CASE
+        rm -f ${IMAGE}
+        exit 1
+    else
+        pass $TEST_CASE
+    fi
+}
+
+function test_main() {
+    mkdir -p ${MNTPOINT}
+    test_mkfs "[large-mkfs-test]"
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_LARGE"
+    test_mount "[large-mount-test]"
+    core_tester mkdir ${MNTPOINT}/dir0
+    core_tester mkdir ${MNTPOINT}/dir0/dir0
+    core_tester touch ${MNTPOINT}/dir0/file0
+    core_tester touch ${MNTPOINT}/dir0/dir0/file0
+    core_tester fusermount "-u ${MNTPOINT}"
+
+    test_mount "[large-remount-test]"
+    core_tester ls ${MNTPOINT}/dir0
+    core_tester ls ${MNTPOINT}/dir0/dir0/file0
+    sleep 1
+    core_tester fusermount "-u ${MNTPOINT}"
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    # 镜像为稀疏文件，实际占用应远小于标称大小
+    echo "image: $(du -h --apparent-size ${IMAGE} | cut -f1) apparent, $(du -h ${IMAGE} | cut -f1) allocated"
+    if [ $(du -k ${IMAGE} | cut -f1) -lt $((1024 * 1024)) ]; then
+        pass "[large-sparse-test]"
+    else
+        fail "[large-sparse-test]"
+    fi
+    rm -f ${IMAGE}
+
+    if [ $POINTS -eq $ALL_POINTS ]; then
+        pass "恭喜你，通过所有测试 ($ALL_POINTS/$ALL_POINTS)"
+    else
+        fail "再接再厉! ($POINTS/$ALL_POINTS)"
+    fi
+}
+
+test_main
@@ -0,0 +1,56 @@
+#include "../include/newfs.h"
+#include <getopt.h>
+
+/******************************************************************************
+* SECTION: mkfs.newfs 入口
+*******************************************************************************/
+static void usage(const char* prog) {
+	fprintf(stderr,
+			"usage: %s --device=PATH [--backend=NAME] [--inode-ratio=N] "
+			"[--block-size=N] [--journal-blks=N]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{"device",		 required_argument, NULL, 'd'},
+		{"backend",		 required_argument, NULL, 'B'},
+		{"inode-ratio",	 required_argument, NULL, 'i'},
+		{"block-size",	 required_argument, NULL, 'b'},
+		{"journal-blks", required_argument, NULL, 'j'},
+		{"help",		 no_argument,		NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	struct newfs_mkfs_options opts;
+	int c, ret;
+
+	opts.inode_ratio  = NEWFS_INODE_RATIO;
+	opts.blk_sz		  = NEWFS_DEFAULT_BLK_SZ;
+	opts.journal_blks = 0;
+	newfs_options.device  = NULL;
+	newfs_options.backend = NULL;
+
+	while ((c = getopt_long(argc, argv, "d:B:i:b:j:h", long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'd': newfs_options.device	= optarg;		break;
+		case 'B': newfs_options.backend = optarg;		break;
+		case 'i': opts.inode_ratio		= atoi(optarg); break;
+		case 'b': opts.blk_sz			= atoi(optarg); break;
+		case 'j': opts.journal_blks		= atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (newfs_options.device == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = newfs_mkfs(&opts);
+	if (ret != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "mkfs.newfs: format %s failed (%d)\n", newfs_options.device, ret);
+		return 1;
+	}
+	return 0;
+}